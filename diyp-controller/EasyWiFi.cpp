@@ -15,14 +15,15 @@
  * Released into the public domain on github: https://github.com/javos65/EasyWifi-for-MKR1010
  */
 
+#include <ctype.h>
 #include "dp.h"
 #include "EasyWiFi.h"
+#include "dp_log.h"
 
-#ifdef WATCHDOG_ENABLED
-#include <wdt_samd21.h>
-#endif
+#undef _DP_FSM_TYPE
+#define _DP_FSM_TYPE EasyWiFi // used for the state machine macro NEXT()
 
-extern void menu_wifi(char *msg);
+DP_FSM_STATE_TABLE(EasyWiFi, EASYWIFI_STATES);
 
 #define DBGON // Debug option  -serial print
 // #define DBGON_X   // Debug option - incl packets
@@ -70,127 +71,351 @@ typedef struct WifiCredentials
 
 // ***************************************
 
-EasyWiFi::EasyWiFi()
+EasyWiFi::EasyWiFi() : StateMachine(&EasyWiFi::state_off)
 {
 }
 
-// Login to local network  //
+// Login to local network: starts the state machine, see control()  //
 void EasyWiFi::start()
 {
-  int noconnect = 0, totalconnect = 0;
-  ;
-  WiFi.disconnect();
-  delay(2000);
-  NINAled(BLUE); // Starting to connect: Set Blue
-  int G_Wifistatus = WiFi.status();
-  if ((G_Wifistatus != WL_CONNECTED) || (WiFi.RSSI() <= -90) || (WiFi.RSSI() == 0))
-  { // check if connected
-    // Read SSId File
-    if (Read_Credentials(G_ssid, G_pass) == 0)
-    {                  // read credentials, if not possible, re-use the old-already loaded credentials
-      NINAled(ORANGE); // no credentials found SET YELLOW
+  WiFi.setTimeout(0); // WiFi.begin() and WiFi.beginAP() return at once, the states poll the status
+  _enabled = true;
+  _start = millis();
+  _attempts_total = 0;
+}
+
+void EasyWiFi::control()
+{
+  unsigned long start = micros();
+  run();
+  _max_run_us = max(_max_run_us, usec_since(start));
+}
+
+// wait for start()
+void EasyWiFi::state_off()
+{
+  if (_enabled)
+    NEXT(state_disconnect);
+}
+
+// drop an old association and wait 2 seconds (the state timeout)
+void EasyWiFi::state_disconnect()
+{
+  ON_ENTRY()
+  {
+    WiFi.disconnect();
+    NINAled(BLUE); // Starting to connect: Set Blue
+  }
+  ON_STATE_TIMEOUT() NEXT(state_check);
+}
+
+// still (or again) associated: no new logon
+void EasyWiFi::state_check()
+{
+  int status = WiFi.status();
+  long rssi = (status == WL_CONNECTED) ? WiFi.RSSI() : 0;
+  if ((status == WL_CONNECTED) && (rssi > -90) && (rssi != 0))
+  {
 #ifdef DBGON
-      Serial.println("* Using old credentials");
+    Serial.println("* Already connected."); // you're already connected
 #endif
-    }
-    while ((G_Wifistatus != WL_CONNECTED) || (WiFi.RSSI() <= -90) || (WiFi.RSSI() == 0))
-    { // attempt to connect to WiFi network:
-      noconnect = 0;
-      menu_wifi("connecting");
-      while (((G_Wifistatus != WL_CONNECTED) || (WiFi.RSSI() <= -90) || (WiFi.RSSI() == 0)) && noconnect < MAXCONNECT)
-      { // attempt to connect to WiFi network 3 times
-        menu_wifi(G_ssid);
-
-#ifdef WATCHDOG_ENABLED
-        wdt_reset();
+    NEXT(state_connected);
+  }
+  else
+    NEXT(state_load);
+}
+
+// read the credentials file (a few requests to the module: open, seek, read, close)
+void EasyWiFi::state_load()
+{
+  if (Read_Credentials(G_ssid, G_pass) == 0)
+  {                  // read credentials, if not possible, re-use the old-already loaded credentials
+    NINAled(ORANGE); // no credentials found SET YELLOW
+#ifdef DBGON
+    Serial.println("* Using old credentials");
 #endif
+  }
+  _noconnect = 0;
+  NEXT(state_join);
+}
 
+// one logon attempt: WiFi.begin() only hands the credentials to the module, state joining waits for the result
+void EasyWiFi::state_join()
+{
 #ifdef DBGON
-        Serial.print("* Attempt#");
-        Serial.print(noconnect);
-        Serial.print(" to connect to Network: ");
-        Serial.println(G_ssid); // print the network name (SSID);
+  Serial.print("* Attempt#");
+  Serial.print(_noconnect);
+  Serial.print(" to connect to Network: ");
+  Serial.println(G_ssid); // print the network name (SSID);
 #endif
-        G_Wifistatus = WiFi.begin(G_ssid, G_pass); // Connect to WPA/WPA2 network. Change this line if using open or WEP network:
-        delay(2000);                               // wait 2 seconds for connection:
-        noconnect++;                               // try-counter
-      }
-      totalconnect = totalconnect + noconnect; // count total failed connects
-      if (G_Wifistatus == WL_CONNECTED)
-      {
-        NINAled(GREEN); // Set Green
+  WiFi.begin(G_ssid, G_pass); // Connect to WPA/WPA2 network. Change this line if using open or WEP network:
+  _noconnect++;               // try-counter
+  _attempts_total++;
+  NEXT(state_joining);
+}
+
+void EasyWiFi::state_joining()
+{
+  int status = WiFi.status();
+  long rssi = (status == WL_CONNECTED) ? WiFi.RSSI() : 0;
+  if ((status == WL_CONNECTED) && (rssi > -90) && (rssi != 0))
+    NEXT(state_connected);
+  else if (status == WL_CONNECT_FAILED)
+    fail();
+  else
+    ON_STATE_TIMEOUT() fail();
+}
+
+// a logon attempt failed: retry, open the AP after MAXCONNECT attempts, or give up
+void EasyWiFi::fail()
+{
+  if (_noconnect < MAXCONNECT)
+  {
+    NEXT(state_join);
+    return;
+  }
+  if (_reconnecting)
+  { // the credentials worked before (the access point may be rebooting): keep trying, never open the setup AP
+    NEXT(state_retry);
+    return;
+  }
+  _totalconnect = _totalconnect + _noconnect; // count total failed connects
+  if ((_totalconnect > ESCAPECONNECT) || (G_useAP == false))
+  {               // quite login service ?
+    NINAled(RED); // Set red
 #ifdef DBGON
-        printWiFiStatus(); // you're connected now, so print out the status anmd break while loop
+    Serial.println("* Connection not possible after too many retries, quit wifi.start process");
 #endif
-        break;
-      }
-      else if ((totalconnect > ESCAPECONNECT) || (G_useAP == false))
-      {               // quite login service ?
-        NINAled(RED); // Set red
+    LOG(WIFI_FAILED, (unsigned)_totalconnect);
+    _enabled = false;
+    NEXT(state_off);
+  }
+  else
+  { // no connection possible : exit without server started
 #ifdef DBGON
-        Serial.println("* Connection not possible after too many retries, quit wifi.start process");
+    Serial.println("* Connection not possible after several retries, opening Access Point");
 #endif
-        break;
-      }
-      else
-      { // no connection possible : exit without server started
+    NEXT(state_scan);
+  }
+}
+
+void EasyWiFi::state_connected()
+{
+  ON_ENTRY()
+  {
+    NINAled(GREEN); // Set Green
+    _totalconnect = 0;
+    if (_reconnecting)
+    {
+      _link.reconnect_ms = time_since(_lost);
+      _link.max_reconnect_ms = max(_link.max_reconnect_ms, _link.reconnect_ms);
+      _reconnecting = false;
+      LOG(WIFI_RECONNECTED, G_ssid, _link.reconnect_ms);
+    }
+    else
+    {
+      _connect_ms = time_since(_start);
+      LOG(WIFI_CONNECTED, G_ssid, (unsigned)_attempts_total, _connect_ms);
+    }
+    _link_up = _sampled = millis();
+    _low_since = 0;
 #ifdef DBGON
-        Serial.println("* Connection not possible after several retries, opening Access Point");
+    printWiFiStatus(); // you're connected now, so print out the status
 #endif
-        // start direct-Wifi connect to manualy input Wifi credentials
-        NINAled(PURPLE); // no network, : RED
-        listNetworks();  // load avaialble networks in a list
-        APSetup();
-        NINAled(PURPLE); // start AP, : Purple
-        G_APInputflag = 0;
-        while (!G_APInputflag)
-        { // Keep AP open till input is received or till 30 seconds are over
-          // Check AP status - new client on or of ?
-          menu_wifi("CONFIG-AP mode");
-#ifdef WATCHDOG_ENABLED
-          wdt_reset();
+  }
+  if (time_since(_sampled) >= WIFI_SUPERVISE_PERIOD * 1000)
+    supervise();
+}
+
+// link check: two requests to the WiFi module, every WIFI_SUPERVISE_PERIOD
+void EasyWiFi::supervise()
+{
+  unsigned long start = micros();
+  _sampled = millis();
+  int status = WiFi.status();
+  long rssi = WiFi.RSSI();
+  _link.max_sample_us = max(_link.max_sample_us, usec_since(start));
+  if (status != WL_CONNECTED)
+  {
+    lost("link lost");
+    return;
+  }
+  if (rssi == 0)
+    return; // (no value)
+  _link.rssi = rssi;
+  _link.rssi_min = _link.samples ? min(_link.rssi_min, rssi) : rssi;
+  _link.rssi_max = _link.samples ? max(_link.rssi_max, rssi) : rssi;
+  _link.rssi_mean = _link.samples ? _link.rssi_mean + WIFI_RSSI_FILTER * (rssi - _link.rssi_mean) : rssi;
+  _link.samples++;
+  if (rssi >= WIFI_RSSI_MIN)
+    _low_since = 0;
+  else if (!_low_since)
+    _low_since = millis();
+  else if (time_since(_low_since) >= WIFI_RSSI_LOW_TIME)
+    lost("weak signal");
+}
+
+// the link is lost or too weak: log on again in the background (state disconnect), the reconnect time is measured
+void EasyWiFi::lost(const char *reason)
+{
+  _link.drops++;
+  _link.uptime += time_since(_link_up);
+  _lost = millis();
+  _reconnecting = true;
+  LOG(WIFI_LINK_LOST, reason, (int)_link.rssi, time_since(_link_up) / 1000);
+  NINAled(ORANGE);
+  NEXT(state_disconnect);
+}
+
+// MAXCONNECT logon attempts after a lost link failed: wait (the state timeout) and try again
+void EasyWiFi::state_retry()
+{
+  ON_STATE_TIMEOUT() NEXT(state_check);
+}
+
+const wifi_link_t &EasyWiFi::link()
+{
+  _link.up = is_connected() ? time_since(_link_up) : 0;
+  return _link;
+}
+
+// scan for the networks to list on the AP page (WiFi.scanNetworks() would wait for the result with delay())
+void EasyWiFi::state_scan()
+{
+  ON_ENTRY()
+  {
+    NINAled(PURPLE); // no network, : RED
+    if (WiFiDrv::startScanNetworks() == WL_FAILURE)
+    {
+      NEXT(state_ap_start);
+      return;
+    }
+  }
+  int numSsid = WiFiDrv::getScanNetworks();
+  if (numSsid > 0)
+  {
+    listNetworks(numSsid); // load avaialble networks in a list
+    NEXT(state_ap_start);
+  }
+  else
+    ON_STATE_TIMEOUT()
+    {
+#ifdef DBGON
+      Serial.println("* Couldn't get a Wifi List");
 #endif
+      NEXT(state_ap_start);
+    }
+}
 
-          if (G_APStatus != WiFi.status())
-          {
-            G_APStatus = WiFi.status(); // it has changed update the variable
-            if (G_APStatus == WL_AP_CONNECTED)
-            { // a device has connected to the AP
+/* Wifi Acces Point Initialisation: close Wifi and wait 3 seconds (the state timeout) */
+void EasyWiFi::state_ap_start()
+{
+  ON_ENTRY()
+  {
 #ifdef DBGON
-              Serial.println("Device connected to AP\n");
+    Serial.print("* Creating access point named: ");
+    Serial.println(ACCESPOINTNAME);
 #endif
-              NINAled(CYAN);        // Client on AP : purple
-              G_DNSRqstcounter = 0; // reset DNS counter
-            }
-            else
-            { // a device has disconnected from the AP, and we are back in listening mode
+    //G_APip = IPAddress((char)random(11, 172), (char)random(0, 255), (char)random(0, 255), 0x01); // Generate random IP adress in Privit IP range
+    G_APip = IPAddress((char)192, (char)168, (char)11, (char)1); // Generate random IP adress in Privit IP range
+    WiFi.end();                                                  // close Wifi - juist to be suire
+    _tries = APTRIES;
+  }
+  ON_STATE_TIMEOUT() NEXT(state_ap_begin);
+}
+
+void EasyWiFi::state_ap_begin()
+{
+  WiFi.config(G_APip, G_APip, G_APip, IPAddress(255, 255, 255, 0)); // Setup config
+  WiFi.beginAP(ACCESPOINTNAME, APCHANNEL);                          // setup AccessPoint, state ap_wait polls the status
+  _tries--;
+  NEXT(state_ap_wait);
+}
+
+void EasyWiFi::state_ap_wait()
+{
+  G_APStatus = WiFi.status();
+  if (G_APStatus == WL_AP_LISTENING || G_APStatus == WL_AP_CONNECTED)
+  {
+    printWiFiStatus();          // you're connected now, so print out the status
+    G_DNSRqstcounter = 0;
+    G_UDPAP_DNS.begin(UDPPORT); // start the UDP server
+    G_APWebserver.begin();      // start the AP web server on port 80
+    NEXT(state_ap);
+  }
+  else
+    ON_STATE_TIMEOUT()
+    {
+      if (_tries > 0)
+      { // retry
 #ifdef DBGON
-              Serial.println("Device disconnected from AP\n");
+        Serial.print(".");
 #endif
-            }
-          } // end if loop changed G_APStatus
-          if (G_APStatus == WL_AP_CONNECTED) // IF client connected to AP, start DNS and check Webserver
-          {
-            APDNSScan();         // check DNS requests
-            APWiFiClientCheck(); // check HTTP server Client
-          }
-        }
-        G_UDPAP_DNS.stop(); // Close UDP connection
-        WiFi.end();
-        WiFi.disconnect();
-        NINAled(BLUE); // new credentials : BLUE
-        delay(1000);
+        NEXT(state_ap_begin);
       }
-    } // ever while loop till connected
-  } // end if not connected
-  else
+      else
+      { // not possible to connect in 5 retries
+#ifdef DBGON
+        Serial.println("* Creating access point failed");
+#endif
+        NINAled(RED);
+        LOG(WIFI_AP_FAILED);
+        _enabled = false;
+        NEXT(state_off);
+      }
+    }
+}
+
+// Keep AP open till input is received
+void EasyWiFi::state_ap()
+{
+  ON_ENTRY()
   {
-    NINAled(GREEN); // Set Green
+    NINAled(PURPLE); // start AP, : Purple
+    G_APInputflag = 0;
+    LOG(WIFI_AP_OPEN, ACCESPOINTNAME);
+  }
+  // Check AP status - new client on or of ?
+  int status = WiFi.status();
+  if (G_APStatus != status)
+  {
+    G_APStatus = status; // it has changed update the variable
+    if (G_APStatus == WL_AP_CONNECTED)
+    { // a device has connected to the AP
 #ifdef DBGON
-    Serial.println("* Already connected."); // you're already connected
-    printWiFiStatus();
+      Serial.println("Device connected to AP\n");
+#endif
+      NINAled(CYAN);        // Client on AP : purple
+      G_DNSRqstcounter = 0; // reset DNS counter
+    }
+    else
+    { // a device has disconnected from the AP, and we are back in listening mode
+#ifdef DBGON
+      Serial.println("Device disconnected from AP\n");
 #endif
+    }
+  } // end if loop changed G_APStatus
+  if (G_APStatus == WL_AP_CONNECTED) // IF client connected to AP, start DNS and check Webserver
+  {
+    APDNSScan();         // check DNS requests
+    APWiFiClientCheck(); // check HTTP server Client
+  }
+  if (G_APInputflag)
+    NEXT(state_ap_stop);
+}
+
+// close the AP and wait 1 second (the state timeout), then log on with the new credentials
+void EasyWiFi::state_ap_stop()
+{
+  ON_ENTRY()
+  {
+    APClose();          // (the thank-you page has been sent)
+    G_UDPAP_DNS.stop(); // Close UDP connection
+    WiFi.end();
+    WiFi.disconnect();
+    NINAled(BLUE); // new credentials : BLUE
   }
+  ON_STATE_TIMEOUT() NEXT(state_check);
 }
 
 // SERIALPRINT Wifi Status - only for debug
@@ -213,9 +438,6 @@ void EasyWiFi::printWiFiStatus()
   Serial.print("- Rssi: ");
   Serial.print(rssi);
   Serial.println(" dBm");
-  static char buf[64];
-  sprintf(buf, "%u.%u.%u.%u", ip[0], ip[1], ip[2], ip[3]);
-  menu_wifi(buf);
 #endif
 }
 
@@ -247,13 +469,11 @@ byte EasyWiFi::apname(char *name)
   return t;
 }
 
-// Scan for available Wifi Networks and place is Glovbal SSIDList
-void EasyWiFi::listNetworks()
+// Place the networks of a completed scan in the Global SSIDList
+void EasyWiFi::listNetworks(int numSsid)
 {
   int t;
   String tmp;
-  // scan for nearby networks:
-  int numSsid = WiFi.scanNetworks();
   if (numSsid == -1)
   {
 #ifdef DBGON
@@ -292,357 +512,421 @@ void EasyWiFi::listNetworks()
   }
 }
 
-/* Wifi Acces Point Initialisation */
-void EasyWiFi::APSetup()
+/* DNS Routines via UDP, act on DSN requests on Port 53: every name resolves to the AP, so a phone opens the portal */
+/* assume wifi UDP connection has been set up; answers at most AP_DNS_PACKETS requests per call */
+void EasyWiFi::APDNSScan()
 {
-  int tr = 5; // 5 tries to setup AP
-#ifdef DBGON
-  Serial.print("* Creating access point named: ");
-  Serial.println(ACCESPOINTNAME);
-#endif
-  //G_APip = IPAddress((char)random(11, 172), (char)random(0, 255), (char)random(0, 255), 0x01); // Generate random IP adress in Privit IP range
-  G_APip = IPAddress((char)192, (char)168, (char)11, (char)1); // Generate random IP adress in Privit IP range
-  WiFi.end();                                                                                  // close Wifi - juist to be suire
-  delay(3000);                                                                                 // Wait 3 seconds
-  WiFi.config(G_APip, G_APip, G_APip, IPAddress(255, 255, 255, 0));                            // Setup config
-  while (tr > 0)
+  static byte G_DNSReplybuffer[DNSHEADER_SIZE + AP_DNS_QUESTION_SIZE + DNSANSWER_SIZE]; // buffer to hold the send DNS reply
+  unsigned int t, r, p;    // generic loop counter, reply and packet counters
+  unsigned int packetSize;
+
+  for (int packets = 0; packets < AP_DNS_PACKETS && (packetSize = G_UDPAP_DNS.parsePacket()); packets++)
+  {                                                  // We've received a packet, read the data from it
+    packetSize = min(packetSize, (unsigned int)sizeof(G_UDPPacketbuffer));
+    G_UDPAP_DNS.read(G_UDPPacketbuffer, packetSize); // read the packet into the buffer
+    G_APDNSclientip = G_UDPAP_DNS.remoteIP();
+    G_DNSClientport = G_UDPAP_DNS.remotePort();
+    if ((G_APDNSclientip == G_APip) || packetSize <= DNSHEADER_SIZE) // skip own requests - ie ntp-pool time requestfrom Wifi module
+      continue;
+
+    // Copy Packet ID and IP into DNS header and DNS answer
+    G_DNSReplyheader[0] = G_UDPPacketbuffer[0];
+    G_DNSReplyheader[1] = G_UDPPacketbuffer[1]; // Copy ID of Packet offset 0 in Header
+    G_DNSReplyanswer[12] = G_APip[0];
+    G_DNSReplyanswer[13] = G_APip[1];
+    G_DNSReplyanswer[14] = G_APip[2];
+    G_DNSReplyanswer[15] = G_APip[3]; // copy AP Ip adress offset 12 in Answer
+    r = 0;                            // set reply buffer counter
+    p = DNSHEADER_SIZE;               // set packetbuffer counter @ QUESTION QNAME section
+    // copy Header into reply
+    memcpy(G_DNSReplybuffer, G_DNSReplyheader, DNSHEADER_SIZE);
+    r += DNSHEADER_SIZE;
+    // copy Question into reply: Name labels till octet=0x00, plus Qtype and Qclass (5 octets)
+    while (p < packetSize && G_UDPPacketbuffer[p] != 0)
+      p++;
+    t = p + 5 - DNSHEADER_SIZE; // length of the question
+    if (p + 5 > packetSize || t > AP_DNS_QUESTION_SIZE)
+      continue; // malformed or too long
+    memcpy(G_DNSReplybuffer + r, G_UDPPacketbuffer + DNSHEADER_SIZE, t);
+    r += t;
+    // copy Answer into reply
+    memcpy(G_DNSReplybuffer + r, G_DNSReplyanswer, DNSANSWER_SIZE);
+    r += DNSANSWER_SIZE;
+
+    // Send DSN UDP packet
+    G_UDPAP_DNS.beginPacket(G_APDNSclientip, G_DNSClientport); // reply DNSquestion
+    G_UDPAP_DNS.write(G_DNSReplybuffer, r);
+    G_UDPAP_DNS.endPacket();
+    G_DNSRqstcounter++;
+  }
+}
+
+/*
+ * Captive portal web server. Every client has a slot; a call of APWiFiClientCheck() accepts a new client, reads the
+ * bytes that are available (the request line, the header lines and a POST body, in a line buffer) and writes the
+ * response in chunks of up to AP_CHUNK bytes, for all clients, until there is nothing to do or AP_TIME_BUDGET_US is
+ * used. The pages are lists of parts: constant text (in flash) and a few generated parts (AP name, IP address, the
+ * networks of the scan), so a page is never built in RAM.
+ */
+typedef enum : uint8_t { AP_END, AP_TEXT, AP_NAME, AP_IP, AP_NETWORKS } ap_part_type_t;
+typedef struct {
+  ap_part_type_t type;
+  const char *text;
+} ap_part_t;
+
+static const char AP_HTTP_OK[] =
+  "HTTP/1.1 200 OK\r\n"
+  "Content-type:text/html\r\n"
+  "Connection: close\r\n"
+  "\r\n";
+static const char AP_HTML_TOP[] =
+  "<meta name=\"viewport\" content=\"width=device-width, initial-scale=1.0\">\r\n" // metaview
+  "<body style=\"background-color:SteelBlue\">\r\n"                                // set color CCS HTML5 style . I | I . I | I .
+  "<p style=\"font-family:verdana; color:GhostWhite\">&nbsp<font size=3> l </font><font size=4> l </font><font size=5> | </font><font size=4> l </font><font size=3> l </font><font size=4> l </font><font size=5> | </font><font size=4> l </font><font size=3> l </font> <br>"
+  "<font size=5>Arduino</font>  <br><font size=5>";
+static const char AP_HTML_LIST[] =
+  "</font>\r\n"
+  "<p style=\"font-family:verdana; color:Gainsboro\">";
+static const char AP_HTML_FORM[] =
+  "</font></p>\r\n"
+  "<p style=\"font-family:verdana; color:Gainsboro\">Enter Wifi-Ssid (Number or name) and Password:<br>"
+  "<form method=POST action=\"checkpass.php\">\r\n"
+  "<input type=text name=XXID><br>\r\n"     // XXID is a key word fo parsing the response
+  "<input type=password name=XXPS><br>\r\n" // XXPS is a key word for parsing
+  "<input type=submit name=action value=Submit>\r\n"
+  "</form></p>\r\n"
+  "<meta http-equiv=\"refresh\" content=\"30;url=http://";
+static const char AP_HTML_REFRESH_END[] =
+  "\">\r\n"
+  "\r\n";
+static const char AP_HTML_THANKS[] =
+  "</font></p>\r\n"
+  "<p style=\"font-family:verdana; color:DarkOrange\"><font size=5>Thank You.....</font><br>"
+  "<meta http-equiv=\"refresh\" content=\"6;url=/\" />\r\n"
+  "\r\n";
+static const char AP_HTML_REDIRECT[] =
+  "<meta http-equiv=\"refresh\" content=\"0;url=http://";
+
+static const ap_part_t AP_PAGE_FORM[] = {
+  {AP_TEXT, AP_HTTP_OK}, {AP_TEXT, AP_HTML_TOP}, {AP_NAME, NULL}, {AP_TEXT, AP_HTML_LIST}, {AP_NETWORKS, NULL},
+  {AP_TEXT, AP_HTML_FORM}, {AP_IP, NULL}, {AP_TEXT, AP_HTML_REFRESH_END}, {AP_END, NULL}};
+static const ap_part_t AP_PAGE_THANKS[] = {
+  {AP_TEXT, AP_HTTP_OK}, {AP_TEXT, AP_HTML_TOP}, {AP_NAME, NULL}, {AP_TEXT, AP_HTML_THANKS}, {AP_END, NULL}};
+static const ap_part_t AP_PAGE_REDIRECT[] = { // answer to the connectivity checks (generate_204 etc.)
+  {AP_TEXT, AP_HTTP_OK}, {AP_TEXT, AP_HTML_REDIRECT}, {AP_IP, NULL}, {AP_TEXT, AP_HTML_REFRESH_END}, {AP_END, NULL}};
+
+typedef enum : uint8_t { AP_CLIENT_FREE, AP_CLIENT_HEADER, AP_CLIENT_BODY, AP_CLIENT_SEND, AP_CLIENT_LINGER } ap_client_state_t;
+typedef struct {
+  WiFiClient client;
+  IPAddress ip;                     // remote address and port: identify the client when the server returns it again
+  uint16_t port;
+  ap_client_state_t state;
+  bool first, post;                 // reading the request line, the request is the form POST
+  int length;                       // bytes of the POST body still to read (Content-Length)
+  char line[AP_LINE_SIZE];          // request line, header line or POST body
+  uint8_t len;
+  const ap_part_t *page;            // response and the position in it
+  uint8_t part, item;
+  uint16_t pos, sent;
+  unsigned long start, last;        // millis() of the accept and the last activity
+} ap_client_t;
+
+static ap_client_t G_APClients[AP_MAX_CLIENTS];
+
+static uint8_t ap_part_items(const ap_part_t &p)
+{
+  return p.type == AP_NETWORKS ? G_ssidCounter : 1;
+}
+
+static const char *ap_part_text(const ap_part_t &p, uint8_t item, char *buf, size_t size)
+{
+  switch (p.type)
   {
-    G_APStatus = WiFi.beginAP(ACCESPOINTNAME, APCHANNEL); // setup AccessPoint
-    if (G_APStatus != WL_AP_LISTENING)
-    { // retry
-#ifdef DBGON
-      Serial.print(".");
-#endif
-      --tr;
-      // WiFi.disconnect();
-      WiFi.config(G_APip, G_APip, G_APip, IPAddress(255, 255, 255, 0));
+  case AP_TEXT:
+    return p.text;
+  case AP_NAME:
+    return ACCESPOINTNAME; // (WiFi.SSID() in AP mode, without a call to the module)
+  case AP_IP:
+    snprintf(buf, size, "%u.%u.%u.%u", G_APip[0], G_APip[1], G_APip[2], G_APip[3]);
+    return buf;
+  case AP_NETWORKS:
+    snprintf(buf, size, "%u. [%s]<br>", item, G_SSIDList[item]);
+    return buf;
+  default:
+    return "";
+  }
+}
+
+// copy the next bytes of the response to out, returns the number of bytes (0 at the end of the page)
+static size_t ap_fill(ap_client_t &c, uint8_t *out, size_t size)
+{
+  char buf[SSIDBUFFERSIZE + 16];
+  size_t n = 0;
+  while (n < size && c.page[c.part].type != AP_END)
+  {
+    const ap_part_t &p = c.page[c.part];
+    if (c.item >= ap_part_items(p))
+    {
+      c.part++;
+      c.item = 0;
+      c.pos = 0;
+      continue;
+    }
+    const char *text = ap_part_text(p, c.item, buf, sizeof(buf));
+    size_t len = strlen(text);
+    size_t k = min(len - c.pos, size - n);
+    memcpy(out + n, text + c.pos, k);
+    n += k;
+    c.pos += k;
+    if (c.pos >= len)
+    {
+      c.item++;
+      c.pos = 0;
     }
-    else
-      break; // break while loop when AP is connected
   }
-  if (tr == 0)
-  { // not possible to connect in 5 retries
-#ifdef DBGON
-    Serial.println("* Creating access point failed");
-#endif
+  return n;
+}
+
+static void ap_respond(ap_client_t &c, const ap_part_t *page)
+{
+  c.page = page;
+  c.part = c.item = 0;
+  c.pos = 0;
+  c.state = AP_CLIENT_SEND;
+}
+
+static void ap_free(ap_client_t &c)
+{
+  c.client.stop();
+  c.state = AP_CLIENT_FREE;
+}
+
+// a complete request or header line is in c.line
+static void ap_header_line(ap_client_t &c)
+{
+  if (c.first)
+  { // request line, e.g. "GET /generate_204 HTTP/1.1"
+    c.first = false;
+    c.post = strncmp(c.line, "POST /checkpass.php", 19) == 0;
+    c.page = (strstr(c.line, "/generate_204") || strstr(c.line, "/hotspot-detect") || strstr(c.line, "/connecttest"))
+             ? AP_PAGE_REDIRECT : AP_PAGE_FORM;
   }
-  else
-  {
-    delay(2000);
-    printWiFiStatus();          // you're connected now, so print out the status
-    G_UDPAP_DNS.begin(UDPPORT); // start the UDP server
-    G_APWebserver.begin();      // start the AP web server on port 80
+  else if (c.len == 0)
+  { // end of the header
+    if (c.post && c.length > 0)
+      c.state = AP_CLIENT_BODY;
+    else
+      ap_respond(c, c.page);
   }
+  else if (strncasecmp(c.line, "Content-Length:", 15) == 0)
+    c.length = atoi(c.line + 15);
 }
 
-/* DNS Routines via UDP, act on DSN requests on Port 53*/
-/* assume wifi UDP connection has been set up */
-void EasyWiFi::APDNSScan()
+// read the available bytes of a client (at most one buffer), returns true if there were any
+static bool ap_read(ap_client_t &c)
 {
-  int t = 0; // generic loop counter
-  int r, p;  // reply and packet counters
-  unsigned int packetSize = 0;
-  unsigned int replySize = 0;
-  byte G_DNSReplybuffer[UDP_PACKET_SIZE]; // buffer to hold the send DNS reply
+  uint8_t buf[64];
+  int available = c.client.available();
+  if (available <= 0)
+    return false;
+  int n = c.client.read(buf, min(available, (int)sizeof(buf)));
+  c.last = millis();
+  for (int i = 0; i < n && (c.state == AP_CLIENT_HEADER || c.state == AP_CLIENT_BODY); i++)
+  {
+    char ch = buf[i];
+    if (c.state == AP_CLIENT_BODY)
+    {
+      if (c.len < AP_LINE_SIZE - 1)
+        c.line[c.len++] = ch;
+      if (--c.length <= 0)
+        c.line[c.len] = 0; // complete, see APWiFiClientCheck()
+    }
+    else if (ch == '\n')
+    {
+      c.line[c.len] = 0;
+      ap_header_line(c);
+      c.len = 0;
+    }
+    else if (ch != '\r' && c.len < AP_LINE_SIZE - 1)
+      c.line[c.len++] = ch;
+  }
+  return n > 0;
+}
 
-  packetSize = G_UDPAP_DNS.parsePacket();
-  if (packetSize)
-  {                                                  // We've received a packet, read the data from it
-    G_UDPAP_DNS.read(G_UDPPacketbuffer, packetSize); // read the packet into the buffer
-    G_APDNSclientip = G_UDPAP_DNS.remoteIP();
-    G_DNSClientport = G_UDPAP_DNS.remotePort();
-    //  if ( (G_APDNSclientip != G_APip) && (G_DNSRqstcounter<=DNSMAXREQUESTS) )       // skip own requests - ie ntp-pool time requestfrom Wifi module
-    if ((G_APDNSclientip != G_APip)) // skip own requests - ie ntp-pool time requestfrom Wifi module
+// write the next chunk of the response, returns true if a chunk was written
+static bool ap_write(ap_client_t &c)
+{
+  uint8_t buf[AP_CHUNK];
+  uint8_t part = c.part, item = c.item;
+  uint16_t pos = c.pos;
+  size_t n = ap_fill(c, buf, sizeof(buf));
+  if (n == 0)
+  { // page complete
+    LOG(WIFI_AP_PAGE, (unsigned)c.sent, time_since(c.start));
+    if (c.page == AP_PAGE_THANKS)
+      c.state = AP_CLIENT_LINGER;
+    else
+      ap_free(c);
+    return false;
+  }
+  size_t written = c.client.write(buf, n);
+  if (written < n)
+  { // not (all) sent: the rest again in the next call
+    c.part = part;
+    c.item = item;
+    c.pos = pos;
+    if (written == 0)
+      return false;
+    ap_fill(c, buf, written); // skip the bytes that were sent
+  }
+  c.sent += written;
+  c.last = millis();
+  return true;
+}
 
+// URL decoding of a form value, in place ('+' and %xx)
+static void ap_url_decode(char *s)
+{
+  char *out = s;
+  for (; *s; s++)
+  {
+    if (*s == '+')
+      *out++ = ' ';
+    else if (*s == '%' && isxdigit(s[1]) && isxdigit(s[2]))
     {
-#ifdef DBGON_X
-      Serial.print("DNS-packets (");
-      Serial.print(packetSize);
-      Serial.print(") from ");
-      Serial.print(G_APDNSclientip);
-      Serial.print(" port ");
-      Serial.println(G_DNSClientport);
-      for (t = 0; t < packetSize; ++t)
-      {
-        Serial.print(G_UDPPacketbuffer[t], HEX);
-        Serial.print(":");
-      }
-      Serial.println(" ");
-      for (t = 0; t < packetSize; ++t)
-      {
-        Serial.print((char)G_UDPPacketbuffer[t]); // Serial.print("");
-      }
-      Serial.println("");
-#endif
-      // Copy Packet ID and IP into DNS header and DNS answer
-      G_DNSReplyheader[0] = G_UDPPacketbuffer[0];
-      G_DNSReplyheader[1] = G_UDPPacketbuffer[1]; // Copy ID of Packet offset 0 in Header
-      G_DNSReplyanswer[12] = G_APip[0];
-      G_DNSReplyanswer[13] = G_APip[1];
-      G_DNSReplyanswer[14] = G_APip[2];
-      G_DNSReplyanswer[15] = G_APip[3]; // copy AP Ip adress offset 12 in Answer
-      r = 0;                            // set reply buffer counter
-      p = 12;                           // set packetbuffer counter @ QUESTION QNAME section
-      // copy Header into reply
-      for (t = 0; t < DNSHEADER_SIZE; ++t)
-        G_DNSReplybuffer[r++] = G_DNSReplyheader[t];
-      // copy Qusetion into reply:  Name labels till octet=0x00
-      while (G_UDPPacketbuffer[p] != 0)
-        G_DNSReplybuffer[r++] = G_UDPPacketbuffer[p++];
-      // copy end of question plus Qtype and Qclass 5 octets
-      for (t = 0; t < 5; ++t)
-        G_DNSReplybuffer[r++] = G_UDPPacketbuffer[p++];
-      // copy Answer into reply
-      for (t = 0; t < DNSANSWER_SIZE; ++t)
-        G_DNSReplybuffer[r++] = G_DNSReplyanswer[t];
-      replySize = r;
-#ifdef DBGON_X
-      Serial.print("* DNS-Reply (");
-      Serial.print(replySize);
-      Serial.print(") from ");
-      Serial.print(G_APip);
-      Serial.print(" port ");
-      Serial.println(UDPPORT);
-      for (t = 0; t < replySize; ++t)
-      {
-        Serial.print(G_DNSReplybuffer[t], HEX);
-        Serial.print(":");
-      }
-      Serial.println(" ");
-      for (t = 0; t < replySize; ++t)
-      {
-        Serial.print((char)G_DNSReplybuffer[t]); // Serial.print("");
-      }
-      Serial.println("");
-#endif
-      // Send DSN UDP packet
-      G_UDPAP_DNS.beginPacket(G_APDNSclientip, G_DNSClientport); // reply DNSquestion
-      G_UDPAP_DNS.write(G_DNSReplybuffer, replySize);
-      G_UDPAP_DNS.endPacket();
-      G_DNSRqstcounter++;
-    } // end loop correct IP
-  } // end loop received packet
+      char hex[3] = {s[1], s[2], 0};
+      *out++ = (char)strtol(hex, NULL, 16);
+      s += 2;
+    }
+    else
+      *out++ = *s;
+  }
+  *out = 0;
 }
 
-// Check the AP wifi Client Responses and read the inputs on the main AP web-page.
-void EasyWiFi::APWiFiClientCheck()
+// the form POST body "XXID=<ssid or number>&XXPS=<password>&action=Submit": store the credentials
+bool EasyWiFi::APCredentials(char *body)
 {
-  String Postline = "";                          // make a String to hold incoming POST-Data
-  String currentLine = "";                       // make a String to hold incoming data from the client
-  char c;                                        // Character read buffer
-  int t, u, v, pos1, pos2;                       // loop counter
-  WiFiClient client = G_APWebserver.available(); // listen for incoming clients
-  if (client)
-  { // if you get a client,
-#ifdef DBGON
-    Serial.println("* New AP webclient"); // print a message out the serial port
-#endif
-    while (client.connected())
-    { // loop while the client's connected
-      if (client.available())
-      {                    // if there's bytes to read from the client,
-        c = client.read(); // read a byte, then
-#ifdef DBGONP
-        Serial.write(c); // print it out the serial monitor
-#endif
-        if (c == '\n')
-        { // if the byte is a newline character
-
-          // if the current line is blank, you got two newline characters in a row.
-          // that's the end of the client HTTP request, so send a response:
-          if (currentLine.length() == 0)
-          {
-            // HTTP headers always start with a response code (e.g. HTTP/1.1 200 OK)
-            // and a content-type so the client knows what's coming, then a blank line:
-            client.println("HTTP/1.1 200 OK");
-            client.println("Content-type:text/html");
-            client.println();
-            // the content of the HTTP response follows the header:
-            client.println("<meta name=\"viewport\" content=\"width=device-width, initial-scale=1.0\">"); // metaview
-            client.println("<body style=\"background-color:SteelBlue\">");                                // set color CCS HTML5 style . I | I . I | I .
-            client.print("<p style=\"font-family:verdana; color:GhostWhite\">&nbsp<font size=3> l </font><font size=4> l </font><font size=5> | </font><font size=4> l </font><font size=3> l </font><font size=4> l </font><font size=5> | </font><font size=4> l </font><font size=3> l </font> <br>");
-            client.print("<font size=5>Arduino</font>  <br><font size=5>");
-            client.print(WiFi.SSID());
-            client.println("</font>");
-            client.print("<p style=\"font-family:verdana; color:Gainsboro\">");
-            for (t = 0; t < G_ssidCounter; t++)
-            {
-              client.print(t);
-              client.print(". [");
-              client.print(G_SSIDList[t]);
-              client.print("]<br>");
-            }
-            client.println("</font></p>");
-            client.print("<p style=\"font-family:verdana; color:Gainsboro\">Enter Wifi-Ssid (Number or name) and Password:<br>");
-            client.println("<form method=POST action=\"checkpass.php\">");
-            client.println("<input type=text name=XXID><br>"); // XXID is a key word fo parsing the response
-            client.println("<form method=POST action=\"checkpass.php\">");
-            client.println("<input type=password name=XXPS><br>"); // XXPS is a key word for parsing
-            client.println("<input type=submit name=action value=Submit>");
-            client.println("</form></p>");
-            client.print("<meta http-equiv=\"refresh\" content=\"30;url=http://");
-            client.print(WiFi.localIP());
-            client.println("\">");
-            // The HTTP response ends with another blank line:
-            client.println();
-            // break out of the while loop:
-            break;
-          }
-          else
-          { // if you got a newline, then clear currentLine:
-            currentLine = "";
-          }
-        }
-        else if (c != '\r')
-        {                   // if you got anything else but a carriage return character,
-          currentLine += c; // add it to the end of the currentLine
-        }
-        // Check to see if the client request was a post on our checkpass.php
-        if (currentLine.endsWith("POST /checkpass.php"))
-        {
+  char *id = strstr(body, "XXID="), *ps = strstr(body, "&XXPS="), *end = strstr(body, "&action");
+  if (!id || !ps || !end || ps < id || end < ps)
+  {
 #ifdef DBGON
-          Serial.println("* Found APServer POST");
-#endif
-          currentLine = "";
-          while (client.connected())
-          { // loop while the client's connected
-            if (client.available())
-            {                    // if there's bytes to read from the client,
-              c = client.read(); // read a byte, then
-#ifdef DBGON_X
-              Serial.write(c); // print it out the serial monitor
+    Serial.print("* Invalid input from AP Client");
+    Serial.println(body);
 #endif
-              if (c == '\n')
-              { // if the byte is a newline character
-                // if (currentLine.length() == 0) break; // no lenght :  end of data request
-                currentLine = ""; // if you got a newline, then clear currentLine:
-              }
-              else if (c != '\r')
-                currentLine += c; // if you got anything else but a carriage return character, add to string
-              if (currentLine.endsWith("XXID="))
-                pos1 = currentLine.length();
-              if (currentLine.endsWith("&XXPS="))
-                pos2 = currentLine.length();
-              if (currentLine.endsWith("&action"))
-              { // Check read line on "data=" start that ends with "&action"
-                t = currentLine.length();
-                if (t < 78)
-                {
-                  if (pos2 - pos1 == 7)
-                  {
-                    u = (currentLine[pos1] - 48);
-                    if (u > G_ssidCounter)
-                      u = 0; // one digit - convert to max index
-                    for (v = 0; G_SSIDList[u][v] != 0; v++)
-                      G_ssid[v] = G_SSIDList[u][v];
-                    G_ssid[v] = 0; // copy list name to ssid
-                  }
-                  else
-                  {
-                    u = 0;
-                    for (v = pos1; v < (pos2 - 6); v++)
-                      G_ssid[u++] = currentLine[v];
-                    G_ssid[u] = 0;
-                  } // if not one digit, copy input name to ssid
-                  u = 0;
-                  for (v = pos2; v < (t - 7); v++)
-                    G_pass[u++] = currentLine[v];
-                  G_pass[u] = 0;
-                  Write_Credentials(G_ssid, sizeof(G_ssid), G_pass, sizeof(G_pass)); // write credentials to flash
-                }
-                else
-                {
+    return false;
+  }
+  *ps = 0;
+  *end = 0;
+  id += 5;
+  ps += 6;
+  ap_url_decode(id);
+  ap_url_decode(ps);
+  if (id[0] >= '0' && id[0] <= '9' && id[1] == 0)
+  { // one digit - the number of a network in the list
+    int u = id[0] - '0';
+    if (u >= G_ssidCounter)
+      u = 0; // convert to max index
+    strncpy(G_ssid, G_SSIDList[u], sizeof(G_ssid) - 1);
+  }
+  else
+    strncpy(G_ssid, id, sizeof(G_ssid) - 1); // if not one digit, copy input name to ssid
+  G_ssid[sizeof(G_ssid) - 1] = 0;
+  strncpy(G_pass, ps, sizeof(G_pass) - 1);
+  G_pass[sizeof(G_pass) - 1] = 0;
+  Write_Credentials(G_ssid, sizeof(G_ssid), G_pass, sizeof(G_pass)); // write credentials to flash
 #ifdef DBGON
-                  Serial.print("* Invalid input from AP Client");
-                  Serial.println(currentLine);
+  Serial.print("\n* AP client input found: ");
+  Serial.print(G_ssid);
+  Serial.print(",");
+  Serial.println("******");
 #endif
-                }
+  return true;
+}
+
+// Serve the AP web clients: accept, read the requests and write the responses, within AP_TIME_BUDGET_US
+void EasyWiFi::APWiFiClientCheck()
+{
+  unsigned long start = micros();
+  bool busy = true;
+  while (busy && usec_since(start) < AP_TIME_BUDGET_US)
+  {
+    busy = false;
+    for (int i = 0; i < AP_MAX_CLIENTS; i++)
+    {
+      ap_client_t &c = G_APClients[i];
+      if (c.state == AP_CLIENT_HEADER || c.state == AP_CLIENT_BODY)
+      {
+        busy |= ap_read(c);
+        if (c.state == AP_CLIENT_BODY && c.length <= 0) // POST body complete
+          ap_respond(c, APCredentials(c.line) ? AP_PAGE_THANKS : AP_PAGE_FORM);
+      }
+      if (c.state == AP_CLIENT_SEND)
+        busy |= ap_write(c);
+    }
+  }
+
+  // a new client (the server also returns a client that is already served when it has unread data)
+  WiFiClient client = G_APWebserver.available();
+  if (client)
+  {
+    IPAddress ip = client.remoteIP();
+    uint16_t port = client.remotePort();
+    int i, free = -1;
+    for (i = 0; i < AP_MAX_CLIENTS; i++)
+    {
+      if (G_APClients[i].state == AP_CLIENT_FREE)
+        free = (free < 0) ? i : free;
+      else if (G_APClients[i].ip == ip && G_APClients[i].port == port)
+        break;
+    }
+    if (i == AP_MAX_CLIENTS && free >= 0)
+    {
 #ifdef DBGON
-                Serial.print("\n* AP client input found: ");
-                Serial.print(G_ssid);
-                Serial.print(",");
-                Serial.println("******");
+      Serial.println("* New AP webclient"); // print a message out the serial port
 #endif
-                // copy inbpouts to G_ssid and G_pass
-                G_APInputflag = 1; // flag Ap input
-                break;
-              }
-            }
-          }
-          // delay(1000);
-          client.println("HTTP/1.1 200 OK");
-          client.println("Content-type:text/html");
-          client.println();
-          client.println("<meta name=\"viewport\" content=\"width=device-width, initial-scale=1.0\">"); // metaview
-          client.println("<body style=\"background-color:SteelBlue\">");                                // set color CCS HTML5 style
-          client.print("<p style=\"font-family:verdana; color:GhostWhite\">&nbsp<font size=3> l </font><font size=4> l </font><font size=5> | </font><font size=4> l </font><font size=3> l </font><font size=4> l </font><font size=5> | </font><font size=4> l </font><font size=3> l </font> <br>");
-          client.print("<font size=5>Arduino</font>  <br><font size=5>");
-          client.print(WiFi.SSID());
-          client.println("</font></p>");
-          client.print("<p style=\"font-family:verdana; color:DarkOrange\"><font size=5>Thank You.....</font><br>");
-          client.println("<meta http-equiv=\"refresh\" content=\"6;url=/\" />");
-          // The HTTP response ends with another blank line:
-          client.println();
-          // break out of the while loop:
-          delay(1000); // wait 2 seconds to show the message !
-          break;
-        } // end loop POST check
-
-        if (currentLine.endsWith("GET /generate_204"))
-        { // HTTP generate_204 HTTP/1.1
-          client.println("HTTP/1.1 200 OK");
-          client.println("Content-type:text/html");
-          client.println();
-          client.print("<meta http-equiv=\"refresh\" content=\"0;url=http://");
-          client.print(WiFi.localIP());
-          client.print("\">");
-          client.println();
-#ifdef DBGONP
-          Serial.println("**generate_204 replyied 200 OK");
-#endif
-          // The HTTP response ends with another blank line:
-          client.println();
-          // break out of the while loop:
-          break;
-        }
-
-        /*
-                if (currentLine.endsWith("GET /RESET")) {
-                    client.println("HTTP/1.1 200 OK");
-                    client.println("Content-type:text/html");
-                    client.println();
-                    client.println("<meta name=\"viewport\" content=\"width=device-width, initial-scale=1.0\">"); // metaview
-                    client.println("<body style=\"background-color:black\">"); // set color CCS HTML5 style
-                    client.print( "<h2 style=\"font-family:verdana; color:GoldenRod\">Access Router ");client.print(WiFi.SSID());client.println("</h2>");
-                    client.print("<p style=\"font-family:verdana; color:indianred\">Authentication failed<br>");
-                    client.print("<meta http-equiv=\"refresh\" content=\"4;url=/\" />");
-                    G_DNSRqstcounter=0;
-                    Serial.println("**Reset");
-                  break;
-                }
-
-                if (currentLine.endsWith("GET /connecttest")) {              // HTTP redirect for browsers with connect-test
-                    // client.println("HTTP/1.1 302 found");
-                    // client.print("Location: http://");client.print(WiFi.localIP());client.println("/");
-                     client.println("HTTP/1.1 200 OK");
-                     client.println("Content-type:text/html");
-                     client.println();
-                     client.print("<meta http-equiv=\"refresh\" content=\"1;url=/\" />");
-                     client.println();
-                     Serial.println("**generate_204 replyied 200 OK");
-                  break;
-                }
-        */
-
-      } // end loop client data avaialbe
-    } // end while loop client connected
-
-    // close the connection:
-    client.stop();
+      ap_client_t &c = G_APClients[free];
+      c.client = client;
+      c.ip = ip;
+      c.port = port;
+      c.state = AP_CLIENT_HEADER;
+      c.first = true;
+      c.post = false;
+      c.length = 0;
+      c.len = 0;
+      c.sent = 0;
+      c.page = AP_PAGE_FORM;
+      c.start = c.last = millis();
+    }
+    else if (i == AP_MAX_CLIENTS)
+      client.stop(); // all slots in use
+  }
+
+  // the thank-you page is shown before the AP closes, and idle clients are closed
+  for (int i = 0; i < AP_MAX_CLIENTS; i++)
+  {
+    ap_client_t &c = G_APClients[i];
+    if (c.state == AP_CLIENT_LINGER && time_since(c.last) >= AP_LINGER_MS)
+    {
+      ap_free(c);
+      G_APInputflag = 1; // flag Ap input
+    }
+    else if (c.state != AP_CLIENT_FREE && time_since(c.last) >= AP_CLIENT_TIMEOUT_MS)
+    {
 #ifdef DBGON
-    Serial.println("* AP webclient disconnected");
+      Serial.println("* AP webclient timeout");
 #endif
-  } // end If Client
+      ap_free(c);
+    }
+  }
+}
+
+// close all AP web clients
+void EasyWiFi::APClose()
+{
+  for (int i = 0; i < AP_MAX_CLIENTS; i++)
+    if (G_APClients[i].state != AP_CLIENT_FREE)
+      ap_free(G_APClients[i]);
 }
 
 
@@ -668,6 +952,7 @@ byte EasyWiFi::Read_Credentials(char *ssid, char *password)
     return 0;
   }
 
+  file.close();
   strncpy(ssid, cred.ssid, sizeof(cred.ssid));
   strncpy(password, cred.password, sizeof(cred.password));
 
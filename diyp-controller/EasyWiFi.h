@@ -3,6 +3,14 @@
  * Created by John V. - 2020 V 1.4.1
  *
  * Released into the public domain on github: https://github.com/javos65/EasyWifi-for-MKR1010
+ *
+ * diyPresso: start() no longer blocks. The connection is a state machine, run by the scheduler (control()):
+ * load the credentials, join the network (WiFi.begin() returns at once, the state polls the status), retry
+ * MAXCONNECT times, then scan and open the setup access point until credentials are entered, and join again.
+ * No state waits for the module: a run makes a few short requests (a status and an RSSI poll, a begin, or in state
+ * load the read of the credentials file), and the web server of the access point stops after AP_TIME_BUDGET_US.
+ * So the boiler, the PID and the brew process keep running while WiFi connects or the access point is open. The
+ * waits of the original (delay()) are state timeouts.
  */
 #ifndef EASYWIFI_H
 #define EASYWIFI_H
@@ -10,6 +18,8 @@
 #include "Arduino.h"
 #include <WiFiNINA.h>
 #include <WiFiUdp.h>
+#include "dp_fsm.h"
+#include "dp_wifi.h"
 
 // Define AP Wifi-Client parameters
 #define MAXSSID 10                         // MAX number of SSID's listed after search
@@ -21,6 +31,14 @@
 #define APNAME "EasyWiFi_AP"
 #define MAXCONNECT 4                       // Max number of wifi logon connects before opening AP
 #define ESCAPECONNECT 15                   // Max number of Total wifi logon retries-connects before escaping/stopping the Wifi start
+#define WIFI_JOIN_TIMEOUT 10.0             // max. time for one logon attempt [sec]
+#define WIFI_SCAN_TIMEOUT 20.0             // max. time for the network scan [sec]
+#define APTRIES 5                          // tries to open the AP
+#define WIFI_SUPERVISE_PERIOD 2.0          // link check (status and RSSI) while connected [sec]
+#define WIFI_RSSI_MIN -80                  // weaker signal than this [dBm] ...
+#define WIFI_RSSI_LOW_TIME 30000           // ... for this long [msec]: reconnect (maybe to a better access point)
+#define WIFI_RSSI_FILTER 0.1               // low-pass filter factor of the mean RSSI per sample
+#define WIFI_RETRY_WAIT 30.0               // after a lost link: wait between rounds of MAXCONNECT logon attempts [sec]
 
 // Define UDP settings for DNS
 #define UDP_PACKET_SIZE 1024          // UDP packet size time out, preventign too large packet reads
@@ -28,6 +46,16 @@
 #define DNSANSWER_SIZE 16             // DNS Answer = standard set with Packet Compression
 #define DNSMAXREQUESTS 32             // trigger first DNS requests, to redirect to own web-page
 #define UDPPORT  53                   // local port to listen for UDP packets
+#define AP_DNS_PACKETS 4              // max. DNS requests answered per run
+#define AP_DNS_QUESTION_SIZE 260      // max. size of a DNS question (name and type) [bytes]
+
+// Define the captive portal web server (see APWiFiClientCheck())
+#define AP_MAX_CLIENTS 3              // clients served at the same time
+#define AP_TIME_BUDGET_US 3000        // max. time of the web server per run [usec]
+#define AP_CHUNK 512                  // max. bytes per write to a client
+#define AP_LINE_SIZE 160              // request line, header line or POST body [bytes]
+#define AP_CLIENT_TIMEOUT_MS 5000     // a client without activity is closed [msec]
+#define AP_LINGER_MS 1000             // the thank-you page is shown this long before the AP closes [msec]
 
 // Define RGB values for NINALed
 #define RED 16,0,0
@@ -38,11 +66,39 @@
 #define CYAN 0,6,10
 #define BLACK 0,0,0
 
-class EasyWiFi
+// EasyWiFi states: S(name, timeout [sec], poll [sec], entry hook, exit hook)
+// (the state machine runs from the scheduler every WIFI_POLL_PERIOD_MS (dp_wifi.h), so the poll intervals are only for next_deadline())
+#define EASYWIFI_STATES(S) \
+  S(off,        0,                 0,    NULL, NULL) \
+  S(disconnect, 2.0,               0,    NULL, NULL) \
+  S(check,      0,                 0,    NULL, NULL) \
+  S(load,       0,                 0,    NULL, NULL) \
+  S(join,       0,                 0,    NULL, NULL) \
+  S(joining,    WIFI_JOIN_TIMEOUT, 0.1,  NULL, NULL) \
+  S(connected,  0,                 WIFI_SUPERVISE_PERIOD, NULL, NULL) \
+  S(retry,      WIFI_RETRY_WAIT,   0,    NULL, NULL) \
+  S(scan,       WIFI_SCAN_TIMEOUT, 0.5,  NULL, NULL) \
+  S(ap_start,   3.0,               0,    NULL, NULL) \
+  S(ap_begin,   0,                 0,    NULL, NULL) \
+  S(ap_wait,    2.0,               0.1,  NULL, NULL) \
+  S(ap,         0,                 0.05, NULL, NULL) \
+  S(ap_stop,    1.0,               0,    NULL, NULL)
+
+class EasyWiFi : public StateMachine<EasyWiFi, DP_FSM_COUNT(EASYWIFI_STATES)>
 {
   public:
+    DP_FSM_STATES(EASYWIFI_STATES)
+
     EasyWiFi();
-    void start();
+    void start();                   // start connecting (returns at once), see control()
+    void control();                 // run the state machine, from the scheduler
+    bool is_connected() { return state_id() == SID_state_connected; }
+    bool is_ap() { return state_id() >= SID_state_ap_start; } // the setup access point is (being) opened
+    unsigned long attempts() { return _attempts_total; } // logon attempts since start()
+    unsigned long connect_time() { return _connect_ms; } // time from start() to connected [msec]
+    unsigned long max_run_time() { return _max_run_us; } // longest run of the state machine [usec]
+    void reset_stats() { _max_run_us = 0; }
+    const wifi_link_t &link(); // link quality and reconnect statistics
     byte erase();
     byte apname(char * name);
     void seed(int value);
@@ -51,6 +107,30 @@ class EasyWiFi
     void NINAled(char r, char g, char b);
 
   private:
+    bool _enabled = false;
+    uint8_t _noconnect = 0, _totalconnect = 0; // logon attempts of this round, of all rounds
+    uint8_t _tries = 0;             // tries left to open the AP
+    unsigned long _attempts_total = 0, _start = 0, _connect_ms = 0, _max_run_us = 0;
+    bool _reconnecting = false;     // the link was lost: retry the stored credentials, no setup AP
+    unsigned long _link_up = 0, _sampled = 0, _low_since = 0, _lost = 0; // millis() of connect, last check, weak signal, link lost
+    wifi_link_t _link = {};
+    void state_off();
+    void state_disconnect();
+    void state_check();
+    void state_load();
+    void state_join();
+    void state_joining();
+    void state_connected();
+    void state_retry();
+    void state_scan();
+    void state_ap_start();
+    void state_ap_begin();
+    void state_ap_wait();
+    void state_ap();
+    void state_ap_stop();
+    void fail();
+    void supervise();
+    void lost(const char *reason);
     void SimpleDecypher(char * textin, char * textout);
     void SimpleCypher(char * textin, char * textout);
     byte Check_Credentials();
@@ -59,8 +139,9 @@ class EasyWiFi
     byte Read_Credentials(char * buf1,char * buf2);
     void APWiFiClientCheck();
     void APDNSScan();
-    void listNetworks();
-    void APSetup();
+    bool APCredentials(char * body);
+    void APClose();
+    void listNetworks(int numSsid);
     void printWiFiStatus();
 
 };
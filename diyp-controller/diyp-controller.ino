@@ -17,7 +17,7 @@
 
     Global Objects:
 
-    * settings - load and save settings to flash
+    * settings - load and save settings to flash (at the end of the flash, kept when a new firmware is uploaded: dp_flash.h)
     * menu - The menu system: logo(), main(), settings(), error()
     * screen - The 4x20 character display: init(), show(), logo()
       * lcd
@@ -29,11 +29,36 @@
     * boilerController - The boiler with heater and temp. sensor: on(), off(), setpoint(), actual(), power(), errors()
       * thermistor -- Adafruit MAX31865 PT1000 sensor, using MAX31865_NonBlocking libary for non-blocking continues read-out
       * heaterControl -- PWM Control of the heater output
+      * autotune -- relay auto-tune of the PID (PUT autotune), see server/boiler_sim.py for the simulator
+      * model -- online identification of the boiler (GET model), feed-forward of the PID in states ready and brew
+      * heat-up -- full power from a cold start until the switch point (learned thermal lag), then the PID
 
     * reservoir - The water reservoir with weight scale
       * weight(), tarre(), level(), empty()
       * hx711
 
+    * shotHistory - Record of every shot in flash: control(), commit(), for_each(), publish()
+    * shotTrace - 10 Hz trace of temperature, power and weight during a shot, published to MQTT: control()
+
+    * faultLog - Reset cause, errors and the state before a fault, kept across resets: begin(), control(), commit()
+
+    * MyEasyWiFi - WiFi connection state machine (credentials, logon retries, setup access point, link supervision): wifi_start(), wifi_control()
+
+    * mqttDevice - MQTT connection state machine (reconnects with backoff) and influxDB line messages: control(), write(), send()
+
+    * remoteControl - Settings, sleep and wake from the MQTT command topic <topic>/cmd (opt-in, not on the public broker): begin(), read()
+
+    * spool - The MQTT state samples of offline periods, sent with their time when the connection is back: store(), drain()
+
+    * windowStats - Min, max, mean and deviation of the fast telemetry fields per window, to MQTT: sample(), publish()
+
+    * streams - Subscribed streams of fields at a rate on serial or MQTT (SUB): subscribe(), control()
+    * telemetry - Binary telemetry frames on the serial port at up to 50 Hz: rate(), control()
+
+    * logger - Deferred logging: LOG() stores a message ID and arguments in RAM, a task formats and sends them
+
+    * scheduler - Periodic tasks and idle sleep of the main loop: add(), run(), wake_within(), idle()
+
 */
 
 #include <Arduino.h>
@@ -51,11 +76,31 @@
 #include "dp_brew.h"
 #include "dp_heater.h"
 #include "dp_pump.h"
+#include "dp_scheduler.h"
+#include "dp_shots.h"
+#include "dp_faults.h"
+#include "dp_flash.h"
+#include "dp_telemetry.h"
+#include "dp_streams.h"
+#include "dp_log.h"
 
 #include "dp_serial.h"
 #include "dp_wifi.h"
 #include "dp_mqtt.h"
-
+#include "dp_spool.h"
+#include "dp_stats.h"
+#include "dp_shot_trace.h"
+#include "dp_remote.h"
+
+void print_state();
+void send_state();
+#define STATE_PERIOD_MS 250         // send_state() period: max. delay of a state change on MQTT [msec]
+#define STATE_HEARTBEAT_MS 60000UL  // max. time between two publishes of a state field [msec]
+void transmit_log();
+void run_mqtt();
+void drain_spool();
+void sample_stats();
+void publish_stats();
 
 /**
  * @brief setup code
@@ -67,6 +112,7 @@ void setup()
   
   delay(1000);
   dpSerial.send(__DATE__ " " __TIME__);
+  faultLog.begin(); // before anything can reset the board again
   statusLed.color(ColorLed::WHITE);
 
   encoder.start();
@@ -77,6 +123,8 @@ void setup()
   {
     dpSerial.send("Failed to load settings, result=");
     dpSerial.send(result);
+    if (!persist_flash_ok())
+      dpSerial.send("The firmware image overlaps the settings area, settings are not saved (build with ld/flash_with_bootloader.ld)");
     Serial.print("Save default settings, result=");
     dpSerial.send(settings.save());
   }
@@ -113,80 +161,181 @@ void setup()
       settings.wifiMode(WIFI_MODE_ON);
       settings.save();
     }
-    menu_wifi("starting");
     wifi_setup();
-    wifi_loop();
-    delay(1000);
+    wifi_start(); // connects in the background (scheduler task "wifi")
   }
-  mqttDevice.init();
+  streams.begin(); // MQTT control topic, subscribed when connected
+  remoteControl.begin(); // MQTT command topic: settings, sleep and wake
+  if (settings.wifiMode() != WIFI_MODE_OFF)
+    mqttDevice.init(); // connects in the background (scheduler task "mqtt")
+  shotHistory.begin();
+
+  scheduler.add("print_state", print_state, 500);
+  scheduler.add("send_state", send_state, STATE_PERIOD_MS);
+  scheduler.add("log", transmit_log, LOG_TRANSMIT_PERIOD_MS);
+  scheduler.add("wifi", wifi_control, WIFI_POLL_PERIOD_MS);
+  scheduler.add("mqtt", run_mqtt, MQTT_POLL_PERIOD_MS);
+  scheduler.add("spool", drain_spool, SPOOL_DRAIN_PERIOD_MS);
+  scheduler.add("stats", sample_stats, STATS_SAMPLE_PERIOD_MS);
+  scheduler.add("stats_pub", publish_stats, STATS_WINDOW_MS);
+  scheduler.begin();
+}
+
+// Send the queued log messages (low priority: formatting and the serial port are kept out of the callers)
+void transmit_log()
+{
+  logger.transmit();
+}
+
+void run_mqtt()
+{
+  mqttDevice.control();
+}
+
+void drain_spool()
+{
+  spool.drain();
+}
+
+void sample_stats()
+{
+  windowStats.sample();
+}
+
+void publish_stats()
+{
+  windowStats.publish();
 }
 
-// Output the state to serial port
+// Output the state to serial port (not when binary telemetry is on: it has the same data, nor when no host has the port open)
 void print_state()
 {
-  static unsigned long prev_time = millis();
-  if (time_since(prev_time) > 500)
-  {
-    Serial.print("setpoint:");
-    Serial.print(boilerController.set_temp());
-    Serial.print(", power:");
-    Serial.print(heaterDevice.power());
-    Serial.print(", average:");
-    Serial.print(heaterDevice.average());
-    Serial.print(", act_temp:");
-    Serial.print(boilerController.act_temp());
-    Serial.print(", boiler-state:");
-    Serial.print(boilerController.get_state_name());
-    Serial.print(", boiler-error:");
-    Serial.print(boilerController.get_error_text());
-    Serial.print(", brew-state:");
-    Serial.print(brewProcess.get_state_name());
-    Serial.print(", weight:");
-    Serial.print(brewProcess.weight());
-    Serial.print(", end_weight:");
-    Serial.print(brewProcess.end_weight());
-    Serial.print(", reservoir_level:");
-    Serial.print(reservoir.level());
-    Serial.print(", reservoir_weight:");
-    Serial.print(reservoir.weight());
-
-    Serial.println("");
-    prev_time = millis();
-  }
+  if (telemetry.is_on() || !Serial.dtr()) // (not !Serial: that waits 10 msec)
+    return;
+  Serial.print("setpoint:");
+  Serial.print(boilerController.set_temp());
+  Serial.print(", power:");
+  Serial.print(heaterDevice.power());
+  Serial.print(", average:");
+  Serial.print(heaterDevice.average());
+  Serial.print(", act_temp:");
+  Serial.print(boilerController.act_temp());
+  Serial.print(", boiler-state:");
+  Serial.print(boilerController.get_state_name());
+  Serial.print(", boiler-error:");
+  Serial.print(boilerController.get_error_text());
+  Serial.print(", brew-state:");
+  Serial.print(brewProcess.get_state_name());
+  Serial.print(", weight:");
+  Serial.print(brewProcess.weight());
+  Serial.print(", end_weight:");
+  Serial.print(brewProcess.end_weight());
+  Serial.print(", reservoir_level:");
+  Serial.print(reservoir.level());
+  Serial.print(", reservoir_weight:");
+  Serial.print(reservoir.weight());
+
+  Serial.println("");
+}
+
+// Send the last transitions of the state machines (flight recorder) to MQTT
+// Separate messages, one per state machine, to stay within the MQTT client transmit buffer
+void send_trace()
+{
+  char buf[4 * DP_FSM_TRACE_TEXT];
+
+  boilerController.format_trace(buf, sizeof(buf), 4);
+  mqttDevice.measurement("trace");
+  mqttDevice.write("boil", buf);
+  mqttDevice.send();
+
+  brewProcess.format_trace(buf, sizeof(buf), 4);
+  mqttDevice.measurement("trace");
+  mqttDevice.write("brew", buf);
+  mqttDevice.send();
 }
 
-// Send the state to MQTT
+// Publish policies of the state fields: name, deadband, heartbeat [msec] (see mqtt_field_t)
+static mqtt_field_t state_t_set = { "t_set", 0.1, STATE_HEARTBEAT_MS };
+static mqtt_field_t state_t_act = { "t_act", 0.2, STATE_HEARTBEAT_MS };
+static mqtt_field_t state_h_pwr = { "h_pwr", 2.0, STATE_HEARTBEAT_MS };
+static mqtt_field_t state_h_avg = { "h_avg", 1.0, STATE_HEARTBEAT_MS };
+static mqtt_field_t state_r_lvl = { "r_lvl", 1.0, STATE_HEARTBEAT_MS };
+static mqtt_field_t state_r_wgt = { "r_wgt", 2.0, STATE_HEARTBEAT_MS };
+static mqtt_field_t state_w_cur = { "w_cur", 0.5, STATE_HEARTBEAT_MS };
+static mqtt_field_t state_w_end = { "w_end", 0.5, STATE_HEARTBEAT_MS };
+static mqtt_field_t state_shots = { "shots", 0, STATE_HEARTBEAT_MS };
+static mqtt_field_t state_boil = { "boil", 0, STATE_HEARTBEAT_MS };
+static mqtt_field_t state_boil_err = { "boil_err", 0, STATE_HEARTBEAT_MS };
+static mqtt_field_t state_brew = { "brew", 0, STATE_HEARTBEAT_MS };
+static mqtt_field_t state_brew_err = { "brew_err", 0, STATE_HEARTBEAT_MS };
+static mqtt_field_t state_res_err = { "res_err", 0, STATE_HEARTBEAT_MS };
+static mqtt_field_t state_m_rec = { "m_rec", 0, STATE_HEARTBEAT_MS };
+static mqtt_field_t state_hu_t = { "hu_t", 0, STATE_HEARTBEAT_MS };
+static mqtt_field_t state_hu_os = { "hu_os", 0, STATE_HEARTBEAT_MS };
+static mqtt_field_t state_w_rssi = { "w_rssi", 3, STATE_HEARTBEAT_MS };
+static mqtt_field_t state_w_up = { "w_up", MQTT_HEARTBEAT_ONLY, STATE_HEARTBEAT_MS };
+static mqtt_field_t state_w_drop = { "w_drop", 0, STATE_HEARTBEAT_MS };
+static mqtt_field_t state_w_rcl = { "w_rcl", 0, STATE_HEARTBEAT_MS };
+static mqtt_field_t state_spool = { "spool", 10, STATE_HEARTBEAT_MS };
+static mqtt_field_t state_msec = { "msec", MQTT_HEARTBEAT_ONLY, STATE_HEARTBEAT_MS };
+
+// Send the changes of the state to MQTT, with a sequence number (while offline: store the state, it is sent when
+// the connection is back). Runs often, so a state change is sent right away; without changes nothing is sent.
 void send_state()
 {
-  static unsigned long prev_time = millis();
-  if (time_since(prev_time) > 5000)
+  if (!mqttDevice.is_on())
+  {
+    if (mqttDevice.is_enabled())
+      spool.store();
+    return;
+  }
+  static unsigned long seq = 0;
+
+  mqttDevice.write(state_t_set, boilerController.set_temp());
+  mqttDevice.write(state_t_act, boilerController.act_temp());
+  mqttDevice.write(state_h_pwr, heaterDevice.power());
+  mqttDevice.write(state_h_avg, heaterDevice.average());
+  mqttDevice.write(state_r_lvl, reservoir.level());
+  mqttDevice.write(state_r_wgt, reservoir.last_weight());
+  mqttDevice.write(state_w_cur, brewProcess.weight());
+  mqttDevice.write(state_w_end, brewProcess.end_weight());
+  mqttDevice.write(state_shots, (long)settings.shotCounter());
+
+  mqttDevice.write(state_boil, boilerController.get_state_name(), boilerController.state_id());
+  mqttDevice.write(state_boil_err, boilerController.get_error_text(), boilerController.error());
+  mqttDevice.write(state_brew, brewProcess.get_state_name(), brewProcess.state_id());
+  mqttDevice.write(state_brew_err, brewProcess.get_error_text(), brewProcess.error());
+  mqttDevice.write(state_res_err, reservoir.get_error_text(), reservoir.error());
+
+  mqttDevice.write(state_hu_t, boilerController.heatup().time); // (of the last cold start)
+  mqttDevice.write(state_hu_os, boilerController.heatup().overshoot);
+  mqttDevice.write(state_m_rec, (long)mqttDevice.reconnects());
+  const wifi_link_t &link = wifi_link();
+  mqttDevice.write(state_w_rssi, link.rssi);
+  mqttDevice.write(state_w_up, (long)(link.up / 1000));
+  mqttDevice.write(state_w_drop, (long)link.drops);
+  mqttDevice.write(state_w_rcl, (long)link.reconnect_ms);
+  mqttDevice.write(state_spool, (long)spool.count());
+  mqttDevice.write(state_msec, (long)millis());
+  if (mqttDevice.pending())
   {
-    mqttDevice.write("t_set", boilerController.set_temp());
-    mqttDevice.write("t_act", boilerController.act_temp());
-    mqttDevice.write("h_pwr", heaterDevice.power());
-    mqttDevice.write("h_avg", heaterDevice.average());
-    mqttDevice.write("r_lvl", reservoir.level());
-    mqttDevice.write("r_wgt", reservoir.weight());
-    mqttDevice.write("w_cur", brewProcess.weight());
-    mqttDevice.write("w_end", brewProcess.end_weight());
-    mqttDevice.write("shots", (long)settings.shotCounter());
-
-    mqttDevice.write("boil", (char *)boilerController.get_state_name());
-    if (boilerController.is_error())
-      mqttDevice.write("boil_err", (char *)boilerController.get_error_text());
-
-    mqttDevice.write("brew", (char *)brewProcess.get_state_name());
-    if (brewProcess.is_error())
-      mqttDevice.write("brew_err", (char *)brewProcess.get_error_text());
-
-    if (reservoir.is_error())
-      mqttDevice.write("res_err", (char *)reservoir.get_error_text());
-
-    mqttDevice.write("msec", (long)millis());
+    mqttDevice.write("seq", (long)++seq);
     mqttDevice.send();
+  }
 
-    prev_time = millis();
+  // attach the flight recorder to the error report, once per error
+  static bool trace_sent = false;
+  if (boilerController.is_error() || brewProcess.is_error())
+  {
+    if (!trace_sent)
+      send_trace();
+    trace_sent = true;
   }
+  else
+    trace_sent = false;
+
+  shotHistory.publish(); // shots that are not yet sent
 }
 
 typedef enum
@@ -204,6 +353,8 @@ typedef enum
 
 
 
+#define UI_REFRESH_PERIOD_MS 20 // [msec] main loop period for the display and the encoder when awake
+
 // #define LOOP_COUNT_TEST
 // #define LOOP_TIMERS // To monitor the performance of the main loop
 
@@ -325,21 +476,25 @@ void loop()
   boilerController.control(); 
 
   brewProcess.run((button_pressed ? BrewProcess::MSG_BUTTON : BrewProcess::MSG_NONE));
+  shotHistory.control();
+  shotTrace.control();
+  faultLog.control();
+  telemetry.control();
+  streams.control();
   int menuSettings;
 
   dpSerial.receive(); // check for incoming serial commands
 
-  send_state();
-  mqttDevice.run();
+  scheduler.run(); // print_state(), send_state()
+  settings.commit(); // write saved settings to flash in the background, one flash operation per loop
+  shotHistory.commit(); // (waits until the settings are written)
+  faultLog.commit();
 
   #ifdef LOOP_TIMERS
     t1 = millis();
   #endif
   
 
-  if (true)
-    print_state();
-
 
   if (brewProcess.is_error())
     menu = ERROR; // error menu
@@ -481,6 +636,22 @@ void loop()
 
     dpSerial.send("loop: " + String(tend - tstart) + "ms, t0: " + String(t1 - tstart) + "ms, t1: " + String(t2 - t1) + "ms, t2: " + String(t3 - t2) + "ms, t3: " + String(t4 - t3) + "ms, t4: " + String(tend - t4) + "ms");
   #endif
+
+  // sleep until the next deadline (the encoder, the brew switch and serial data wake us up earlier)
+  scheduler.wake_within(boilerController.next_deadline());
+  scheduler.wake_within(brewProcess.next_deadline());
+  scheduler.wake_within(heaterDevice.next_edge());
+  scheduler.wake_within(settings.next_deadline());
+  scheduler.wake_within(shotHistory.next_deadline());
+  scheduler.wake_within(shotTrace.next_deadline());
+  scheduler.wake_within(faultLog.next_deadline());
+  scheduler.wake_within(telemetry.next_deadline());
+  scheduler.wake_within(streams.next_deadline());
+  if (brewProcess.is_awake() || encoder.button_state())
+    scheduler.wake_within(UI_REFRESH_PERIOD_MS); // menu refresh and button long press
+  else
+    scheduler.wake_within(SLEEP_SPINNER_REFRESH_RATE_MS);
+  scheduler.idle();
 }
 
 #ifdef TEST_CODE
@@ -8,6 +8,7 @@
 
 // #define SIMULATE // Define this to compile as SIMULATED device (no hardware)
 #define WATCHDOG_ENABLED // if not defined: Watchdog is disabled! ENABLE FOR PRODUCTION!!!!
+#define IDLE_SLEEP_ENABLED // if not defined: the main loop never sleeps (busy loop, as before)
 
 #define AUTOSLEEP_TIMEOUT (60 * 60.0)   // [sec] When longer than this time in idle, goto sleep
 #define SHUTDOWN_TIMEOUT (4 * 60 * 60.0) // [sec] When longer than this time in sleep, shutdown (4 hours)
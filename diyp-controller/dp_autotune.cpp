@@ -0,0 +1,93 @@
+/*
+  Relay auto-tuning of the boiler PID (Astrom-Hagglund)
+  (c) 2025 - diyPresso - CC-BY-NC
+*/
+#include "dp_autotune.h"
+#include "dp_time.h"
+#include "dp_log.h"
+
+void RelayAutotune::start(double setpoint, double bias, double amplitude, double max_power, double temp)
+{
+  _setpoint = setpoint;
+  _max_power = max_power;
+  _amplitude = amplitude;
+  _bias = constrain(bias, 0.0, max_power);
+  _high = temp < setpoint;
+  _power = _high ? min(_max_power, _bias + _amplitude) : max(0.0, _bias - _amplitude);
+  _time = millis();
+  _cycle_start = 0; // the first cycle starts at the first switch to high
+  _sum_tu = _sum_a = _sum_d = _sum_power = 0;
+  _measured = 0;
+  _result = {};
+  _status = AUTOTUNE_RUNNING;
+}
+
+double RelayAutotune::update(double temp)
+{
+  if (_status != AUTOTUNE_RUNNING)
+    return _power;
+  unsigned long now = millis();
+  _energy += _power * time_diff(now, _time) / 1000.0; // (the power of the previous interval)
+  _time = now;
+  _t_min = min(_t_min, temp);
+  _t_max = max(_t_max, temp);
+
+  if (_high && temp > _setpoint + AUTOTUNE_HYSTERESIS)
+  {
+    _high = false;
+    _switch_low = now;
+  }
+  else if (!_high && temp < _setpoint - AUTOTUNE_HYSTERESIS)
+  {
+    _high = true;
+    if (_cycle_start)
+      cycle(now);
+    _cycle_start = now;
+    _t_min = _t_max = temp;
+    _energy = 0;
+  }
+  _power = _high ? min(_max_power, _bias + _amplitude) : max(0.0, _bias - _amplitude);
+  return _power;
+}
+
+// a cycle (switch to high, switch to low, switch to high) is complete
+void RelayAutotune::cycle(unsigned long now)
+{
+  double tu = time_diff(now, _cycle_start) / 1000.0;
+  double t_high = time_diff(_switch_low, _cycle_start) / 1000.0;
+  double a = (_t_max - _t_min) / 2.0;
+  double d = (min(_max_power, _bias + _amplitude) - max(0.0, _bias - _amplitude)) / 2.0; // (bounded relay)
+  double power = _energy / tu;
+  _result.cycles++;
+  LOG(AUTOTUNE_CYCLE, (unsigned)_result.cycles, tu, a, power);
+  if (_result.cycles > AUTOTUNE_SKIP_CYCLES)
+  {
+    _sum_tu += tu;
+    _sum_a += a;
+    _sum_d += d;
+    _sum_power += power;
+    _measured++;
+  }
+  // symmetric oscillation: heating as long as cooling
+  _bias = constrain(_bias + d * (2.0 * t_high - tu) / tu, 0.0, _max_power);
+  if (_measured >= AUTOTUNE_CYCLES)
+    finish();
+}
+
+void RelayAutotune::finish()
+{
+  double a = _sum_a / _measured;
+  if (a <= AUTOTUNE_HYSTERESIS)
+  { // no oscillation above the noise
+    _status = AUTOTUNE_ABORTED;
+    return;
+  }
+  _result.amplitude = a;
+  _result.tu = _sum_tu / _measured;
+  _result.ku = 4.0 * (_sum_d / _measured) / (PI * sqrt(a * a - AUTOTUNE_HYSTERESIS * AUTOTUNE_HYSTERESIS));
+  _result.power = _sum_power / _measured;
+  _result.p = AUTOTUNE_KP * _result.ku;
+  _result.i = _result.p / (AUTOTUNE_TI * _result.tu);
+  _result.d = _result.p * AUTOTUNE_TD * _result.tu;
+  _status = AUTOTUNE_DONE;
+}
@@ -0,0 +1,71 @@
+/*
+  Relay auto-tuning of the boiler PID (Astrom-Hagglund)
+  (c) 2025 - diyPresso - CC-BY-NC
+
+  The heater is switched between bias + amplitude and bias - amplitude (bounded by 0 and AUTOTUNE_MAX_POWER) when the
+  temperature crosses the setpoint, with a small hysteresis against sensor noise. The boiler then oscillates around the
+  setpoint with the ultimate period Tu. From the oscillation amplitude a and the relay amplitude d the ultimate gain is
+
+    Ku = 4 d / (pi * sqrt(a^2 - h^2))     (h = hysteresis)
+
+  The bias is corrected every cycle so the heating and cooling halves have the same length: the mean power of the
+  measured cycles is then the power that holds the boiler at the setpoint (the feed-forward of state ready).
+
+  The PID coefficients follow the Ziegler-Nichols "some overshoot" rule (Kp = 0.33 Ku, Ti = Tu / 2, Td = Tu / 3),
+  converted to the terms of DpPID: I = Kp / Ti [%/(degC sec)], D = Kp * Td [%/(degC/sec)]. They are limited to the
+  ranges of the settings when they are saved (D is usually above its maximum of 100, which the simulator shows
+  to be the better choice: a larger D slows down the heat-up).
+
+  The first AUTOTUNE_SKIP_CYCLES cycles are not used (the start from the PID control is not periodic yet), the result
+  is the average of the next AUTOTUNE_CYCLES cycles. See BoilerStateMachine::state_autotune() and server/boiler_sim.py.
+*/
+#ifndef AUTOTUNE_H
+#define AUTOTUNE_H
+
+#include <Arduino.h>
+
+#define AUTOTUNE_AMPLITUDE 15.0   // relay amplitude d [%]
+#define AUTOTUNE_MAX_POWER 40.0   // max. heater power during the experiment [%]
+#define AUTOTUNE_HYSTERESIS 0.2   // relay hysteresis h [degC]
+#define AUTOTUNE_SKIP_CYCLES 1    // cycles before the measurement
+#define AUTOTUNE_CYCLES 3         // measured cycles
+#define AUTOTUNE_KP 0.33          // Kp = AUTOTUNE_KP * Ku
+#define AUTOTUNE_TI 0.5           // Ti = AUTOTUNE_TI * Tu
+#define AUTOTUNE_TD (1.0 / 3.0)   // Td = AUTOTUNE_TD * Tu
+
+typedef enum : uint8_t { AUTOTUNE_IDLE, AUTOTUNE_RUNNING, AUTOTUNE_DONE, AUTOTUNE_ABORTED } autotune_status_t;
+
+typedef struct {
+  double ku, tu;                  // ultimate gain [%/degC] and period [sec]
+  double amplitude;               // temperature amplitude of the oscillation [degC]
+  double power;                   // mean heater power at the setpoint [%]
+  double p, i, d;                 // PID coefficients (DpPID terms)
+  uint8_t cycles;                 // completed cycles
+} autotune_result_t;
+
+class RelayAutotune
+{
+  private:
+    autotune_status_t _status = AUTOTUNE_IDLE;
+    double _setpoint = 0, _bias = 0, _amplitude = 0, _max_power = 0, _power = 0;
+    bool _high = false;             // relay output
+    unsigned long _time = 0;        // millis() of the last update
+    unsigned long _cycle_start = 0, _switch_low = 0; // millis() of the last switches to high and to low
+    double _t_min = 0, _t_max = 0;  // temperature range of this cycle [degC]
+    double _energy = 0;             // power integral of this cycle [%*sec]
+    double _sum_tu = 0, _sum_a = 0, _sum_d = 0, _sum_power = 0; // sums of the measured cycles
+    uint8_t _measured = 0;
+    autotune_result_t _result = {};
+    void cycle(unsigned long now);
+    void finish();
+
+  public:
+    void start(double setpoint, double bias, double amplitude, double max_power, double temp);
+    double update(double temp);     // new temperature, returns the heater power [%]
+    void abort() { if (_status == AUTOTUNE_RUNNING) _status = AUTOTUNE_ABORTED; }
+    autotune_status_t status() { return _status; }
+    double power() { return _power; }
+    const autotune_result_t &result() { return _result; }
+};
+
+#endif // AUTOTUNE_H
@@ -9,6 +9,7 @@
 #include "dp_heater.h"
 #include "dp_settings.h"
 #include "dp_time.h"  // Include timing functions
+#include "dp_log.h"
 #include "dp_reservoir.h"  // For reservoir extern
 #include "dp_pump.h"      // For pumpDevice extern
 
@@ -18,20 +19,40 @@
 #include <wdt_samd21.h>
 #endif
 
+DP_FSM_STATE_TABLE(BoilerStateMachine, BOILER_STATES);
+
 BoilerStateMachine boilerController = BoilerStateMachine();
 
+// Key inputs stored with every state machine transition in the flight recorder (see dp_fsm.h)
+void fsm_trace_inputs(int16_t *temp, int16_t *weight)
+{
+  *temp = (int16_t)(boilerController.act_temp() * 10.0);
+  *weight = (int16_t)reservoir.last_weight();
+}
+
 void BoilerStateMachine::state_off()
 {
-  ;
   if (_on)
-    NEXT(state_heating);
+  {
+    if (_set_temp - _act_temp > HEATUP_MIN_RISE)
+    { // a cold start: measure the heat-up (see heatup_monitor())
+      _heatup_active = true;
+      _heatup_start = millis();
+      _heatup_reached = 0;
+      _heatup_max = _act_temp;
+    }
+    if (_heatup_active && _heat_lag > 0.0) // (heatLag 0: heat-up with the PID)
+      NEXT(state_boost);
+    else
+      NEXT(state_heating);
+  }
 }
 
 void BoilerStateMachine::state_heating()
 {
   ON_ENTRY()
   {
-    _pid.setFeedForward(_ff_heat);
+    feed_forward(_ff_heat);
   }
   if (!_on)
     NEXT(state_off);
@@ -39,26 +60,26 @@ void BoilerStateMachine::state_heating()
     NEXT(state_brew);
   if (abs(_set_temp - _act_temp) < TEMP_WINDOW)
     NEXT(state_ready);
-  ON_TIMEOUT_SEC(TIMEOUT_HEATING)
+  ON_STATE_TIMEOUT()
   goto_error(BOILER_ERROR_TIMEOUT_HEATING);
   ON_EXIT()
   {
-    _pid.setFeedForward(0);
+    feed_forward(0);
   }
 }
 
 void BoilerStateMachine::state_ready()
 {
-  ON_ENTRY()
-  {
-    _pid.setFeedForward(_ff_ready);
-  }
+  // the heat loss at the setpoint
+  feed_forward(_model.valid() ? _model.holding_power(_set_temp) : _ff_ready);
   if (!_on)
     NEXT(state_off);
   if (_brew)
     NEXT(state_brew);
   if (abs(_set_temp - _act_temp) > TEMP_WINDOW)
     NEXT(state_heating);
+  else if (_autotune_request)
+    NEXT(state_autotune);
   if (_force_state_recheck)
   {
     _force_state_recheck = false;
@@ -66,7 +87,7 @@ void BoilerStateMachine::state_ready()
     if (abs(_set_temp - _act_temp) > TEMP_WINDOW)
       NEXT(state_heating);
   }
-  ON_TIMEOUT_SEC(TIMEOUT_READY)
+  ON_STATE_TIMEOUT()
   goto_error(BOILER_ERROR_READY_TIMEOUT);
 }
 
@@ -76,21 +97,126 @@ void BoilerStateMachine::state_brew()
     NEXT(state_off);
   if (!_brew)
     NEXT(state_heating);
-  ON_ENTRY()
-  {
-    _pid.setFeedForward(_ff_brew);
-  }
+  // the heat loss and the heat of the cold water that replaces the drawn water
+  feed_forward(_model.valid() ? min(100.0, _model.holding_power(_set_temp) + _draw_ff) : _ff_brew);
 
   // if ( (_set_temp - _act_temp ) > TEMP_WINDOW) goto_error(BOILER_ERROR_UNDER_TEMP);
-  ON_TIMEOUT_SEC(TIMEOUT_BREW)
+  ON_STATE_TIMEOUT()
   goto_error(BOILER_ERROR_TIMEOUT_BREW);
   ON_EXIT()
   {
-    _pid.setFeedForward(0);
+    feed_forward(0);
     _brew = false;
+    if (_model.valid())
+      _pid.reset(); // (the integral made up for the drawn water during the shot, the feed-forward of the model does that)
   }
 }
 
+void BoilerStateMachine::state_autotune()
+{
+  ON_ENTRY()
+  {
+    _autotune.start(_set_temp, heaterDevice.average(), AUTOTUNE_AMPLITUDE, AUTOTUNE_MAX_POWER, _act_temp);
+    LOG(AUTOTUNE_START, _set_temp, heaterDevice.average());
+  }
+  if (!_on)
+    NEXT(state_off);
+  else if (_brew)
+    NEXT(state_brew);
+  else if (!_autotune_request)
+    NEXT(state_ready);
+  else if (abs(_set_temp - _act_temp) > TEMP_WINDOW)
+    NEXT(state_heating);
+  else
+  {
+    _autotune.update(_act_temp);
+    if (_autotune.status() != AUTOTUNE_RUNNING)
+      NEXT(state_ready);
+  }
+  ON_STATE_TIMEOUT()
+  NEXT(state_ready);
+  ON_EXIT()
+  {
+    _autotune_request = false;
+    _autotune.abort(); // (if it is not done)
+    const autotune_result_t &r = _autotune.result();
+    if (_autotune.status() == AUTOTUNE_DONE)
+    {
+      LOG(AUTOTUNE_DONE, r.ku, r.tu, r.amplitude, r.power);
+      LOG(AUTOTUNE_GAINS, r.p, r.i, r.d);
+    }
+    else
+      LOG(AUTOTUNE_ABORTED, (unsigned)r.cycles);
+    _pid.reset(); // (the integral of the PID is not valid after the experiment)
+  }
+}
+
+// Full power: the fastest heat-up. The heater is switched off when the temperature would reach the setpoint with the
+// heat that is still underway (element, boiler wall, sensor lag): the rise after switching off is about the rate at
+// that moment times the thermal lag.
+void BoilerStateMachine::state_boost()
+{
+  if (!_on)
+    NEXT(state_off);
+  else if (_brew)
+    NEXT(state_brew);
+  else if (_act_temp + _rate * _heat_lag >= _set_temp)
+    NEXT(state_coast);
+  ON_STATE_TIMEOUT()
+  goto_error(BOILER_ERROR_TIMEOUT_HEATING);
+  ON_EXIT()
+  {
+    LOG(HEATUP_SWITCH, _act_temp, _rate, _heat_lag);
+  }
+}
+
+// Heater off until the temperature stops rising. The measured rise corrects the thermal lag for the next heat-up,
+// and the PID takes over at the holding power (bumpless: the integral is preloaded, not wound up by the heat-up).
+void BoilerStateMachine::state_coast()
+{
+  ON_ENTRY()
+  {
+    _coast_temp = _coast_peak = _act_temp;
+    _coast_rate = _rate;
+    _coast_peaked = false;
+  }
+  _coast_peak = max(_coast_peak, _act_temp);
+  if (!_on)
+    NEXT(state_off);
+  else if (_brew)
+    NEXT(state_brew);
+  else if (_rate <= HEATUP_PEAK_RATE)
+  {
+    _coast_peaked = true;
+    if (abs(_set_temp - _act_temp) < TEMP_WINDOW)
+      NEXT(state_ready);
+    else
+      NEXT(state_heating);
+  }
+  ON_STATE_TIMEOUT()
+  NEXT(state_heating);
+  ON_EXIT()
+  {
+    if (_coast_peaked && _coast_rate > 0.0) // (after a timeout the peak is not known)
+    {
+      _heatup.lag = (_coast_peak - _coast_temp) / _coast_rate;
+      _heat_lag = settings.heatLag(_heat_lag + HEATUP_LAG_FILTER * (_heatup.lag - _heat_lag)); // (limited)
+      settings.save();
+    }
+    double hold = _model.valid() ? _model.holding_power(_set_temp) : _ff_ready;
+    feed_forward(hold);
+    _pid.preload(hold);
+  }
+}
+
+bool BoilerStateMachine::start_autotune()
+{
+  if (!is_ready() || _brew)
+    return false;
+  _autotune_request = true;
+  return true;
+}
+
 void BoilerStateMachine::state_error()
 {
   off();
@@ -100,6 +226,64 @@ void BoilerStateMachine::state_error()
     NEXT(state_off);
 }
 
+void BoilerStateMachine::feed_forward(double ff)
+{
+  _ff = ff;
+  _pid.setFeedForward(ff);
+}
+
+// The drawn water is replaced by cold water from the reservoir: the heat to bring it to the setpoint, FF_DRAW_SCALE of
+// it and at most FF_DRAW_MAX (the heat in the wall of the boiler reaches the water after the shot, full compensation
+// overshoots), with a lead-lag of FF_DRAW_LEAD times the dead time of the model (the heater reaches the water later
+// than the cold water).
+void BoilerStateMachine::draw_compensation()
+{
+  unsigned long now = millis();
+  double weight = reservoir.last_weight();
+  double dt = time_diff(now, _flow_time) / 1000.0;
+  if (dt <= 0.0)
+    return;
+  double flow = _brew ? max(0.0, (_flow_weight - weight) / dt) : 0.0;
+  _flow += (flow - _flow) * dt / (FF_FLOW_TAU + dt);
+  _flow_weight = weight;
+  _flow_time = now;
+
+  double ff = FF_DRAW_SCALE * _flow * FF_WATER_HEAT * max(0.0, _set_temp - MODEL_AMBIENT) / HEATER_POWER_W * 100.0;
+  _draw_lag += (ff - _draw_lag) * dt / (FF_DRAW_LAG + dt);
+  _draw_ff = constrain(_draw_lag + FF_DRAW_LEAD * _model.dead_time() / FF_DRAW_LAG * (ff - _draw_lag), 0.0, FF_DRAW_MAX);
+}
+
+// The temperature rate, and the time to ready and the overshoot of a cold start (reported once, HEATUP_WATCH after
+// the temperature reached the setpoint band; a brew or the boiler off before that cancels the measurement)
+void BoilerStateMachine::heatup_monitor()
+{
+  unsigned long now = millis();
+  double dt = time_diff(now, _rate_time) / 1000.0;
+  if (_rate_time && dt > 0.0)
+    _rate += ((_act_temp - _rate_temp) / dt - _rate) * dt / (HEATUP_RATE_TAU + dt);
+  _rate_temp = _act_temp;
+  _rate_time = now;
+
+  if (!_heatup_active)
+    return;
+  if (!_on || _brew || is_error())
+  {
+    _heatup_active = false;
+    return;
+  }
+  _heatup_max = max(_heatup_max, _act_temp);
+  if (!_heatup_reached && abs(_set_temp - _act_temp) <= HEATUP_BAND)
+    _heatup_reached = max(now, 1UL);
+  if (_heatup_reached && time_diff(now, _heatup_reached) >= HEATUP_WATCH * 1000UL)
+  {
+    _heatup.count++;
+    _heatup.time = time_diff(_heatup_reached, _heatup_start) / 1000.0;
+    _heatup.overshoot = max(0.0, _heatup_max - _set_temp);
+    LOG(HEATUP_DONE, _heatup.time, _heatup.overshoot, _heatup.lag);
+    _heatup_active = false;
+  }
+}
+
 void BoilerStateMachine::goto_error(boiler_error_t error)
 {
   _error = error;
@@ -172,12 +356,20 @@ void BoilerStateMachine::control(void)
     goto_error(BOILER_ERROR_CONTROL_TIMEOUT);
   _last_control_time = millis();
 
+  draw_compensation();
+  heatup_monitor();
   run();
 
   // Process boiler level checking
   process_boiler_level_check();
 
   _pid.compute();
+  if (is_autotune())
+    _power = _autotune.power(); // the relay instead of the PID
+  else if (_cur_state == &BoilerStateMachine::state_boost)
+    _power = 100.0;
+  else if (_cur_state == &BoilerStateMachine::state_coast)
+    _power = 0.0;
 
   // char buffer[10];
   // Serial.print("Diff: ");
@@ -209,6 +401,8 @@ void BoilerStateMachine::control(void)
   if (_act_temp > (TEMP_LIMIT_HIGH + 2.0))
     _power = 0;
   heaterDevice.power(_on ? _power : 0.0);
+  if (!_rtd_error)
+    _model.update(_act_temp, heaterDevice.power(), _brew || pumpDevice.is_on()); // (no samples while water is drawn)
 #ifdef WATCHDOG_ENABLED
   wdt_reset();
 #endif
@@ -286,17 +480,6 @@ void BoilerStateMachine::check_dry_boiler_safety()
   _last_temp_time = current_time;
 }
 
-const char *BoilerStateMachine::get_state_name()
-{
-  RETURN_STATE_NAME(off);
-  RETURN_STATE_NAME(heating);
-  RETURN_STATE_NAME(ready);
-  RETURN_STATE_NAME(brew);
-  RETURN_STATE_NAME(error);
-  RETURN_NONE_STATE_NAME()
-  RETURN_UNKNOWN_STATE_NAME();
-}
-
 // Boiler level checking implementation
 void BoilerStateMachine::request_boiler_check(boiler_check_reason_t reason)
 {
@@ -313,8 +496,7 @@ void BoilerStateMachine::start_boiler_level_check()
   _boiler_check_start_time = millis();
   pumpDevice.on();
   
-  Serial.print("Boiler check started: ");
-  Serial.println(get_check_reason_text(_pending_boiler_check));
+  LOG(BOILER_CHECK_START, get_check_reason_text(_pending_boiler_check));
 }
 
 void BoilerStateMachine::process_boiler_level_check()
@@ -326,9 +508,7 @@ void BoilerStateMachine::process_boiler_level_check()
   // Safety timeout - stop filling after maximum time
   if (elapsed >= BOILER_FILL_MAX_TIME_SEC * 1000) {
     pumpDevice.off();
-    Serial.print("Boiler fill timeout after ");
-    Serial.print(BOILER_FILL_MAX_TIME_SEC);
-    Serial.println(" seconds - stopping");
+    LOG(BOILER_CHECK_TIMEOUT, BOILER_FILL_MAX_TIME_SEC);
     handle_boiler_check_result(false);
     _boiler_check_in_progress = false;
     _pending_boiler_check = BOILER_CHECK_NONE;
@@ -342,10 +522,7 @@ void BoilerStateMachine::process_boiler_level_check()
     
     bool boiler_was_full = (weight_change < BOILER_FILL_THRESHOLD_G);
     
-    Serial.print("Boiler check completed: ");
-    Serial.print(get_check_reason_text(_pending_boiler_check));
-    Serial.print(" - ");
-    Serial.println(boiler_was_full ? "FULL" : "REFILLED");
+    LOG(BOILER_CHECK_DONE, get_check_reason_text(_pending_boiler_check), boiler_was_full ? "FULL" : "REFILLED");
     
     if (boiler_was_full) {
       // Boiler is full - we're done
@@ -354,7 +531,7 @@ void BoilerStateMachine::process_boiler_level_check()
       _pending_boiler_check = BOILER_CHECK_NONE;
     } else {
       // Boiler wasn't full - continue filling
-      Serial.println("Boiler not full yet - continuing to fill...");
+      LOG(BOILER_CHECK_CONTINUE);
       _boiler_check_start_weight = reservoir.weight();  // Reset baseline
       _boiler_check_start_time = millis();               // Reset timer
       pumpDevice.on();                                   // Keep pumping
@@ -367,26 +544,26 @@ void BoilerStateMachine::handle_boiler_check_result(bool was_full)
   switch (_pending_boiler_check) {
     case BOILER_CHECK_STARTUP:
       if (!was_full) {
-        Serial.println("Startup: Boiler was empty - refilled");
+        LOG(BOILER_CHECK_REFILLED, get_check_reason_text(_pending_boiler_check));
       }
       break;
       
     case BOILER_CHECK_PRESLEEP:
       if (!was_full) {
-        Serial.println("Pre-sleep: Boiler was empty - refilled");
+        LOG(BOILER_CHECK_REFILLED, get_check_reason_text(_pending_boiler_check));
       }
       // Now safe to proceed with sleep
       break;
       
     case BOILER_CHECK_POSTBREW:
       if (!was_full) {
-        Serial.println("Post-brew: Boiler was empty - refilled");
+        LOG(BOILER_CHECK_REFILLED, get_check_reason_text(_pending_boiler_check));
       }
       break;
       
     case BOILER_CHECK_EMERGENCY:
       if (!was_full) {
-        Serial.println("Emergency: Boiler was empty - refilled");
+        LOG(BOILER_CHECK_REFILLED, get_check_reason_text(_pending_boiler_check));
       }
       break;
       
@@ -10,6 +10,8 @@
 #include "dp_fsm.h"
 #include "dp_pid.h"
 #include "dp_heater.h"
+#include "dp_autotune.h"
+#include "dp_model.h"
 #include <Arduino.h>
 
 #include <MAX31865_NonBlocking.h> 
@@ -24,12 +26,32 @@
 #define WINDUP_LIMIT_MIN -7.0 // windup limits in %
 #define WINDUP_LIMIT_MAX 7.0  // 
 
-// Times in [msec]
+// Feed-forward from the plant model (see dp_model.h), the settings ff_ready and ff_brew until the model is valid
+#define FF_WATER_HEAT 4.186   // heat capacity of water [J/(gram degC)]
+#define FF_DRAW_SCALE 0.8     // part of the heat of the drawn water in the feed-forward of state brew
+#define FF_DRAW_LEAD 0.5      // lead of the brew feed-forward, times the dead time of the model
+#define FF_DRAW_LAG 5.0       // lag of the brew feed-forward [sec]
+#define FF_DRAW_MAX 50.0      // max. brew feed-forward on top of the holding power [%]
+#define FF_FLOW_TAU 2.0       // time constant of the flow filter [sec]
+
+// Heat-up from a cold start: full power until the temperature plus the rise after switching off (the rate times the
+// thermal lag, setting heatLag) reaches the setpoint, then the heater off until the temperature stops rising
+#define HEATUP_MIN_RISE 20.0  // full power when the boiler is on this far below the setpoint [degC]
+#define HEATUP_RATE_TAU 5.0   // time constant of the temperature rate filter [sec]
+#define HEATUP_PEAK_RATE 0.002 // the temperature stopped rising [degC/sec]
+#define HEATUP_LAG_FILTER 0.5 // part of the thermal lag measured at a heat-up that is learned
+#define HEATUP_BAND 0.5       // time to ready: until the temperature is in this band around the setpoint [degC]
+#define HEATUP_WATCH 300      // overshoot: the highest temperature up to this time after the band is reached [sec]
+
+// Times in [sec]
 #define TIMEOUT_HEATING (600)    // maximum heater on time: 10 minutes
 #define TIMEOUT_BREW (60 * 3)    // maximum brew on time: 3 minutes
 #define TIMEOUT_READY (60 * 120) // maximum time in state ready: 2 hour
+#define TIMEOUT_AUTOTUNE (60 * 40) // maximum time of the relay auto-tune (a cycle takes a few minutes): 40 minutes
+#define TIMEOUT_COAST (180)      // maximum time with the heater off after the full power heat-up: 3 minutes
 
 #define TIMEOUT_CONTROL_MSEC (1000 * 10)    // Max time between control updates [milliseconds]
+#define BOILER_CHECK_POLL_MSEC 100UL        // Control update interval during a boiler level check [milliseconds]
 #define TIMEOUT_HEATER_SSR_MSEC (1000 * 60) // maximum time the SSR is allowed to be ON [milliseconds]
 
 // Safety: Temperature rate monitoring for dry boiler detection
@@ -62,9 +84,30 @@ typedef enum
   BOILER_ERROR_UNKNOWN,
 } boiler_error_t;
 
-class BoilerStateMachine : public StateMachine<BoilerStateMachine>
+// Heat-up from a cold start
+typedef struct {
+  unsigned long count;    // cold starts since power-on
+  double time;            // time to ready of the last one: from the start until in the setpoint band [sec]
+  double overshoot;       // above the setpoint [degC]
+  double lag;             // thermal lag measured at the switch point [sec]
+} heatup_t;
+
+// Boiler states: S(name, timeout [sec], poll [sec], entry hook, exit hook)
+// All states poll the temperature at the PID sample rate
+#define BOILER_STATES(S) \
+  S(off,     0,               1.0, NULL, NULL) \
+  S(heating, TIMEOUT_HEATING, 1.0, NULL, NULL) \
+  S(ready,   TIMEOUT_READY,   1.0, NULL, NULL) \
+  S(brew,    TIMEOUT_BREW,    1.0, NULL, NULL) \
+  S(autotune, TIMEOUT_AUTOTUNE, 1.0, NULL, NULL) \
+  S(boost,   TIMEOUT_HEATING, 0.2, NULL, NULL) \
+  S(coast,   TIMEOUT_COAST,   1.0, NULL, NULL) \
+  S(error,   0,               1.0, NULL, NULL)
+
+class BoilerStateMachine : public StateMachine<BoilerStateMachine, DP_FSM_COUNT(BOILER_STATES)>
 {
 public:
+  DP_FSM_STATES(BOILER_STATES)
   BoilerStateMachine() : StateMachine(&BoilerStateMachine::state_off) {}; // moved intit() out of the constructor, because the arduino just bricked if called earlier. Not sure why though...
   int error() { return _error; }
   void clear_error() { _error = BOILER_ERROR_NONE; }
@@ -86,6 +129,15 @@ public:
   double set_ff_brew(double ff) { return _ff_brew = min(100.0, max(ff, 0.0)); }
   double get_ff_brew(void) { return _ff_brew; }
   void set_pid(double p, double i, double d) { _pid.setCoefficients(p, i, d); }
+  double set_heat_lag(double lag) { return _heat_lag = max(lag, 0.0); }
+  double get_heat_lag(void) { return _heat_lag; }
+  double pid_p() { return _pid.P(); } // PID terms of the last computation [%]
+  double pid_i() { return _pid.I(); }
+  double pid_d() { return _pid.D(); }
+  double feed_forward() { return _ff; } // feed-forward of the last control cycle [%]
+  double flow() { return _flow; }       // filtered flow from the reservoir during a brew [gram/sec]
+  PlantModel &model() { return _model; }
+  const heatup_t &heatup() { return _heatup; }
   void on() { _on = true; }
   void off()
   {
@@ -98,8 +150,14 @@ public:
   bool is_on() { return _on; }
   bool is_ready() { return _cur_state == &BoilerStateMachine::state_ready; }
   bool is_error() { return _cur_state == &BoilerStateMachine::state_error; }
+
+  // Relay auto-tune of the PID (see dp_autotune.h): only from state ready, the result is kept until the next start
+  bool start_autotune();
+  void stop_autotune() { _autotune_request = false; }
+  bool is_autotune() { return _cur_state == &BoilerStateMachine::state_autotune; }
+  autotune_status_t autotune_status() { return _autotune.status(); }
+  const autotune_result_t &autotune_result() { return _autotune.result(); }
   const char *get_error_text();
-  const char *get_state_name();
   void control();
   void begin();
   void init(); 
@@ -108,6 +166,9 @@ public:
   void request_boiler_check(boiler_check_reason_t reason);
   bool is_boiler_check_pending() { return _boiler_check_in_progress; }
   void process_boiler_level_check();
+
+  // time until control() needs to run again [msec]: the state machine deadline, or faster during a boiler level check
+  unsigned long next_deadline() { return min(StateMachine::next_deadline(), _boiler_check_in_progress ? BOILER_CHECK_POLL_MSEC : TIME_NEVER); }
   
 #ifdef SIMULATE
   // Public helpers for simulation
@@ -117,6 +178,22 @@ public:
 
 private:
   DpPID _pid;
+  RelayAutotune _autotune;
+  PlantModel _model;
+  double _ff = 0;                      // feed-forward [%]
+  double _flow = 0, _flow_weight = 0;  // filtered flow [gram/sec], reservoir weight of the last control cycle [gram]
+  double _draw_lag = 0, _draw_ff = 0;  // lag state and output of the brew feed-forward [%]
+  unsigned long _flow_time = 0;
+  double _rate = 0, _rate_temp = 0;    // filtered temperature rate [degC/sec], temperature of the last control cycle
+  unsigned long _rate_time = 0;
+  double _heat_lag = 0;                // thermal lag: the rise after switching off is the rate times the lag [sec]
+  double _coast_temp = 0, _coast_rate = 0, _coast_peak = 0; // at the switch point, highest temperature of the coast
+  bool _coast_peaked = false;          // the coast ended at the peak (not by the timeout, a brew or off): learn the lag
+  heatup_t _heatup = {};
+  bool _heatup_active = false;
+  unsigned long _heatup_start = 0, _heatup_reached = 0; // millis() of the start, and in the band (0: not yet)
+  double _heatup_max = 0;
+  bool _autotune_request = false;
   double _act_temp = 0, _set_temp = 0, _ff_heat = 0, _ff_ready = 0, _ff_brew = 0, _power = 0;
   bool _on = false, _brew = false;
   unsigned long _last_control_time = 0;
@@ -145,8 +222,14 @@ private:
   void state_heating(); // Temperature control, but not yet on target temperature
   void state_ready();   // temperature control, within range of target temperature
   void state_brew();    // temperature control in brewing mode with feed-forward active
+  void state_autotune(); // relay experiment around the setpoint with bounded heater power, back to ready when done
+  void state_boost();   // heat-up from a cold start at full power, until the predicted switch point
+  void state_coast();   // heater off until the temperature stops rising, then the PID takes over
   void state_error();   // heater is forced OFF, error code is set, set state to OFF to clear error
   void goto_error(boiler_error_t err);
+  void feed_forward(double ff);        // set the feed-forward of the PID
+  void draw_compensation();            // flow and brew feed-forward of this control cycle
+  void heatup_monitor();               // time to ready and overshoot of a cold start
   void check_dry_boiler_safety();
   void start_boiler_level_check();
   void handle_boiler_check_result(bool was_full);
@@ -13,6 +13,8 @@
 #include "dp_settings.h"
 #include "dp_brew.h"
 
+DP_FSM_STATE_TABLE(BrewProcess, BREW_STATES);
+
 BrewProcess brewProcess = BrewProcess();
 
 // Check common state transitions (commissioning, brewing, empty)
@@ -63,7 +65,7 @@ void BrewProcess::state_fill()
     pumpDevice.on();
   }
   statusLed.color(blink() ? ColorLed::YELLOW : ColorLed::BLACK);
-  ON_TIMEOUT_SEC(INITIAL_PUMP_TIME)
+  ON_STATE_TIMEOUT()
   {
     if (abs(_start_weight - reservoir.weight()) < FILL_WEIGHT_DROP_MINIMUM)
       goto_error(BREW_ERROR_FILL);
@@ -78,7 +80,7 @@ void BrewProcess::state_purge()
 {
   if (brewSwitch.up())
     NEXT(state_check);
-  ON_TIMEOUT_SEC(PURGE_TIMEOUT)
+  ON_STATE_TIMEOUT()
   goto_error(BREW_ERROR_PURGE);
   common_transitions();
 }
@@ -101,7 +103,7 @@ void BrewProcess::state_check()
       goto_error(BREW_ERROR_NO_WATER);
     }
   }
-  ON_TIMEOUT_SEC(PURGE_TIMEOUT)
+  ON_STATE_TIMEOUT()
   goto_error(BREW_ERROR_PURGE);
   common_transitions();
 }
@@ -115,7 +117,7 @@ void BrewProcess::state_done()
     settings.save();
     NEXT(state_idle);
   }
-  ON_TIMEOUT_SEC(PURGE_TIMEOUT)
+  ON_STATE_TIMEOUT()
   goto_error(BREW_ERROR_PURGE);
 }
 
@@ -144,9 +146,8 @@ void BrewProcess::state_sleep()
   }
   
   // Check for shutdown timeout (4 hours in sleep)
-  if (_brewTimer.read() > SHUTDOWN_TIMEOUT * 1000) {
-    NEXT(state_shutdown);
-  }
+  ON_STATE_TIMEOUT()
+  NEXT(state_shutdown);
   
   ON_MESSAGE(WAKEUP)
   NEXT(state_idle);
@@ -210,7 +211,7 @@ void BrewProcess::state_idle()
     else
       NEXT(state_pre_infuse);
   common_transitions();
-  ON_TIMEOUT_SEC(AUTOSLEEP_TIMEOUT)
+  ON_STATE_TIMEOUT()
   NEXT(state_sleep);
   if (!settings.commissioningDone())
     NEXT(state_init);
@@ -329,26 +330,6 @@ void BrewProcess::goto_error(brew_error_t error)
   NEXT(state_error);
 }
 
-const char *BrewProcess::get_state_name()
-{
-  RETURN_STATE_NAME(init);
-  RETURN_STATE_NAME(fill);
-  RETURN_STATE_NAME(purge);
-  RETURN_STATE_NAME(sleep);
-  RETURN_STATE_NAME(shutdown);
-  RETURN_STATE_NAME(empty);
-  RETURN_STATE_NAME(idle);
-  RETURN_STATE_NAME(check);
-  RETURN_STATE_NAME(done);
-  RETURN_STATE_NAME(warning_pre_brew);
-  RETURN_STATE_NAME(pre_infuse);
-  RETURN_STATE_NAME(infuse);
-  RETURN_STATE_NAME(extract);
-  RETURN_STATE_NAME(finished);
-  RETURN_STATE_NAME(error);
-  RETURN_UNKNOWN_STATE_NAME();
-}
-
 const char *BrewProcess::get_error_text()
 {
   switch (_error)
@@ -4,6 +4,7 @@
 #define BREW_MIN_TEMP 93
 #include <Arduino.h>
 #include <Timer.h>
+#include "dp.h"
 #include "dp_time.h"
 #include "dp_reservoir.h"
 
@@ -20,8 +21,31 @@ typedef enum
   BREW_ERROR_NO_WATER,
 } brew_error_t;
 
-class BrewProcess : public StateMachine<BrewProcess>
+// Brew process states: S(name, timeout [sec], poll [sec], entry hook, exit hook)
+// Note: the brew step times are settings, those timeouts are checked in the state functions
+// The poll interval is for the reservoir weight; the brew switch and the encoder button wake up the main loop themselves
+#define BREW_STATES(S) \
+  S(init,             0,                 0.1, NULL, NULL) \
+  S(fill,             INITIAL_PUMP_TIME, 0.1, NULL, NULL) \
+  S(purge,            PURGE_TIMEOUT,     0.1, NULL, NULL) \
+  S(sleep,            SHUTDOWN_TIMEOUT,  0,   NULL, NULL) \
+  S(shutdown,         0,                 0,   NULL, NULL) \
+  S(empty,            0,                 0.1, NULL, NULL) \
+  S(idle,             AUTOSLEEP_TIMEOUT, 0.1, NULL, NULL) \
+  S(check,            PURGE_TIMEOUT,     0.1, NULL, NULL) \
+  S(done,             PURGE_TIMEOUT,     0.1, NULL, NULL) \
+  S(warning_pre_brew, 0,                 0.1, NULL, NULL) \
+  S(pre_infuse,       0,                 0.1, NULL, NULL) \
+  S(infuse,           0,                 0.1, NULL, NULL) \
+  S(extract,          0,                 0.1, NULL, NULL) \
+  S(finished,         0,                 0.1, NULL, NULL) \
+  S(error,            0,                 0.1, NULL, NULL)
+
+class BrewProcess : public StateMachine<BrewProcess, DP_FSM_COUNT(BREW_STATES)>
 {
+public:
+  DP_FSM_STATES(BREW_STATES)
+
 private:
   typedef enum BrewProcessMessages
   {
@@ -43,6 +67,7 @@ public:
   void clear_error() { run(RESET); };
   bool is_awake() { return !IN_STATE(sleep); }
   bool is_error() { return IN_STATE(error); }
+  brew_error_t error() { return _error; }
   bool is_finished() { return IN_STATE(finished); }
   bool is_init() { return IN_STATE(init); }
   bool is_fill() { return IN_STATE(fill); }
@@ -55,7 +80,6 @@ public:
   double brew_time() { return _brewTimer.read() / 1000.0; }
   double weight() { return _start_weight - reservoir.weight(); }
   double end_weight() { return _end_weight; }
-  virtual const char *get_state_name();
   const char *get_error_text();
   typedef enum
   {
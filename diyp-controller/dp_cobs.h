@@ -0,0 +1,36 @@
+/*
+  COBS framing (Consistent Overhead Byte Stuffing)
+  Removes all zero bytes from a frame, at a cost of 1 byte per 254 bytes, so a zero byte can delimit frames.
+  (c) 2025 - diyPresso - CC-BY-NC
+*/
+#ifndef COBS_H
+#define COBS_H
+
+#include <Arduino.h>
+
+#define COBS_MAX_SIZE(n) ((n) + (n) / 254 + 1) // encoded size of n bytes (without the delimiter)
+
+// encode n bytes from src to dst (dst must hold COBS_MAX_SIZE(n) bytes), returns the encoded size
+inline size_t cobs_encode(uint8_t *dst, const uint8_t *src, size_t n)
+{
+  size_t code_pos = 0, out = 1;
+  uint8_t code = 1;
+  for (size_t i = 0; i < n; i++)
+  {
+    if (src[i])
+    {
+      dst[out++] = src[i];
+      code++;
+    }
+    if (!src[i] || code == 0xFF) // end of a block: write its length code
+    {
+      dst[code_pos] = code;
+      code_pos = out++;
+      code = 1;
+    }
+  }
+  dst[code_pos] = code;
+  return out;
+}
+
+#endif // COBS_H
@@ -0,0 +1,13 @@
+/*
+  CRC-32 (IEEE 802.3, the same as zlib), table driven
+  (c) 2025 - diyPresso - CC-BY-NC
+*/
+#ifndef CRC_H
+#define CRC_H
+
+#include <Arduino.h>
+
+// CRC-32 of a buffer. To continue a CRC over several buffers, pass the result of the previous call as `crc`
+uint32_t crc32(const void *data, size_t n, uint32_t crc = 0);
+
+#endif // CRC_H
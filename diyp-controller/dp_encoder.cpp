@@ -7,6 +7,7 @@
  */
 #include "dp_encoder.h"
 #include "dp_hardware.h"
+#include "dp_scheduler.h"
 #include "uTimerLib.h"
 
 Encoder encoder(PIN_ENC_A,  PIN_ENC_B, PIN_ENC_S);
@@ -33,6 +34,8 @@ void encoder_timer_function()
 
     if ( (enc_button) && (!enc_prev_button) ) // falling edge
       enc_button_count += 1;
+    if ( enc_button != enc_prev_button )
+      scheduler.wake(); // button pressed or released: run the main loop
     enc_prev_button = enc_button;
     if ( enc_button )
       enc_button_time += 1;
@@ -61,6 +64,7 @@ void encoder_timer_function()
     if ( ((prev & 1) == 1) && ((cur & 1) == 0)  )
     {
       enc_value += ( cur & 2 ? -1 : 1 );
+      scheduler.wake();
     }
     prev = cur;
 }
@@ -0,0 +1,241 @@
+/*
+  Fault log: reset cause, errors and the state before a fault, kept across resets
+  (c) 2025 - diyPresso - CC-BY-NC
+*/
+#include "dp_faults.h"
+#include "dp_crc.h"
+#include "dp_flash.h"
+#include "dp_boiler.h"
+#include "dp_brew.h"
+#include "dp_heater.h"
+#include "dp_reservoir.h"
+#include "dp_settings.h"
+#include "dp_shots.h"
+
+#define RCAUSE_POR 0x01   // PM->RCAUSE bits
+#define RCAUSE_BOD12 0x02
+#define RCAUSE_BOD33 0x04
+#define RCAUSE_EXT 0x10
+#define RCAUSE_WDT 0x20
+#define RCAUSE_SYST 0x40
+#define RCAUSE_WARM (RCAUSE_EXT | RCAUSE_WDT | RCAUSE_SYST) // resets that keep the RAM contents
+
+// the current session: not cleared by the startup code, so it survives a warm reset (checked with the CRC)
+// (.noinit is a NOLOAD section after .bss in ld/flash_with_bootloader.ld)
+__attribute__((section(".noinit"))) static fault_record_t fault_ram;
+
+// the flash log, at the end of the flash: it is kept when a new firmware is uploaded
+static_assert(FAULT_ROWS * FAULT_ROW_SIZE <= PERSIST_FAULTS_SIZE, "fault log larger than its flash area");
+static const uint8_t *const faults_area = (const uint8_t *)PERSIST_FAULTS;
+
+FaultLog faultLog;
+
+FaultLog::FaultLog() : _flash(faults_area, FAULT_ROWS * FAULT_ROW_SIZE)
+{
+  _area = faults_area;
+}
+
+bool FaultLog::is_valid(const fault_record_t *r)
+{
+  return r->seq != 0 && r->seq != 0xFFFFFFFF && r->error_count <= FAULT_ERRORS && r->sample_count <= FAULT_SAMPLES &&
+         crc32(r, offsetof(fault_record_t, crc)) == r->crc;
+}
+
+void FaultLog::begin()
+{
+  uint8_t rcause = PM->RCAUSE.reg;
+  uint16_t resets = 0;
+
+  _row = -1;
+  for (int8_t r = 0; persist_flash_ok() && r < FAULT_ROWS; r++)
+  {
+    const fault_record_t *rec = record(r);
+    if (is_valid(rec) && (_row < 0 || (int32_t)(rec->seq - _seq) > 0)) // newest record, wrap-around safe
+    {
+      _row = r;
+      _seq = rec->seq;
+    }
+  }
+
+  // after a warm reset: store the previous session, with the cause of the reset
+  if ((rcause & RCAUSE_WARM) && fault_ram.seq == FAULT_RAM_MAGIC && is_valid(&fault_ram))
+  {
+    _frozen = fault_ram;
+    _frozen.trigger = FAULT_TRIGGER_RESET;
+    _frozen.rcause = rcause;
+    _pending = true;
+    resets = fault_ram.resets + 1;
+  }
+
+  memset(&fault_ram, 0, sizeof(fault_ram));
+  fault_ram.seq = FAULT_RAM_MAGIC;
+  fault_ram.rcause = rcause;
+  fault_ram.resets = resets;
+  fault_ram.crc = crc32(&fault_ram, offsetof(fault_record_t, crc));
+  _last_sample = millis();
+}
+
+void FaultLog::sample()
+{
+  fault_sample_t *s = &fault_ram.samples[fault_ram.sample_head];
+  s->temp = constrain(lround(10.0 * boilerController.act_temp()), INT16_MIN, INT16_MAX);
+  s->weight = constrain(lround(reservoir.last_weight()), INT16_MIN, INT16_MAX);
+  s->power = constrain(lround(heaterDevice.power()), 0, 100);
+  s->state = brewProcess.state_id();
+  fault_ram.sample_head = (fault_ram.sample_head + 1) % FAULT_SAMPLES;
+  if (fault_ram.sample_count < FAULT_SAMPLES)
+    fault_ram.sample_count++;
+  fault_ram.crc = crc32(&fault_ram, offsetof(fault_record_t, crc));
+}
+
+void FaultLog::add_error(fault_module_t module, uint8_t code)
+{
+  fault_error_t *e = &fault_ram.errors[fault_ram.error_head];
+  e->time = fault_ram.uptime;
+  e->module = module;
+  e->code = code;
+  e->reserved = 0;
+  fault_ram.error_head = (fault_ram.error_head + 1) % FAULT_ERRORS;
+  if (fault_ram.error_count < FAULT_ERRORS)
+    fault_ram.error_count++;
+  fault_ram.crc = crc32(&fault_ram, offsetof(fault_record_t, crc));
+}
+
+// copy the session to the record for flash (a record that is being written is finished first)
+void FaultLog::freeze(fault_trigger_t trigger)
+{
+  if (_step != COMMIT_IDLE)
+  {
+    _retrigger = true;
+    return;
+  }
+  _frozen = fault_ram;
+  _frozen.trigger = trigger;
+  _pending = true;
+}
+
+void FaultLog::check_error(fault_module_t module, uint8_t code)
+{
+  if (code == _errors[module])
+    return;
+  _errors[module] = code;
+  if (code)
+  {
+    sample(); // the state at the error
+    add_error(module, code);
+    freeze(FAULT_TRIGGER_ERROR);
+  }
+}
+
+void FaultLog::control()
+{
+  unsigned long dt = time_since(_last_sample);
+
+  check_error(FAULT_BOILER, boilerController.error());
+  check_error(FAULT_BREW, brewProcess.error());
+  check_error(FAULT_RESERVOIR, reservoir.error());
+
+  if (dt >= FAULT_SAMPLE_PERIOD_MS)
+  {
+    _last_sample += dt;
+    _uptime_ms += dt;
+    fault_ram.uptime += _uptime_ms / 1000;
+    _uptime_ms %= 1000;
+    sample();
+  }
+}
+
+unsigned long FaultLog::next_deadline()
+{
+  if (_pending || is_writing())
+    return 0;
+  unsigned long dt = time_since(_last_sample);
+  return (dt >= FAULT_SAMPLE_PERIOD_MS) ? 0 : FAULT_SAMPLE_PERIOD_MS - dt;
+}
+
+void FaultLog::commit()
+{
+  if (_step == COMMIT_IDLE)
+  {
+    if (_retrigger)
+    {
+      _retrigger = false;
+      freeze(FAULT_TRIGGER_ERROR);
+    }
+    if (!_pending || settings.is_saving() || shotHistory.is_writing()) // one flash user at a time
+      return;
+    _pending = false;
+    if (!persist_flash_ok()) // the image overlaps the log (stock linker script): not stored
+      return;
+    _frozen.seq = (_seq + 1 == 0xFFFFFFFF) ? 1 : _seq + 1;
+    _frozen.crc = crc32(&_frozen, offsetof(fault_record_t, crc));
+    _step = COMMIT_ERASE;
+  }
+
+  switch (_step)
+  {
+  case COMMIT_ERASE: // the oldest record
+    _row = (_row + 1) % FAULT_ROWS;
+    _flash.erase(record(_row), FAULT_ROW_SIZE);
+    _written = 0;
+    _step = COMMIT_WRITE;
+    break;
+  case COMMIT_WRITE: // one flash page per call
+  {
+    uint16_t n = min(sizeof(fault_record_t) - _written, (size_t)FAULT_PAGE_SIZE);
+    _flash.write((const uint8_t *)record(_row) + _written, (const uint8_t *)&_frozen + _written, n);
+    _written += n;
+    if (_written >= sizeof(fault_record_t))
+    {
+      _seq = _frozen.seq;
+      _step = COMMIT_IDLE;
+    }
+    break;
+  }
+  default:
+    _step = COMMIT_IDLE;
+  }
+}
+
+const fault_record_t &FaultLog::session()
+{
+  return fault_ram;
+}
+
+uint8_t FaultLog::count()
+{
+  uint8_t n = 0;
+  for (uint8_t i = 0; i < FAULT_ROWS; i++)
+    if (get(i))
+      n++;
+  return n;
+}
+
+const fault_record_t *FaultLog::get(uint8_t i)
+{
+  if (_row < 0 || i >= FAULT_ROWS)
+    return NULL;
+  const fault_record_t *r = record((_row + 1 + i) % FAULT_ROWS); // the oldest record follows the newest one
+  return is_valid(r) ? r : NULL;
+}
+
+const char *FaultLog::rcause_text(uint8_t rcause)
+{
+  if (rcause & RCAUSE_SYST) return "SYSTEM";
+  if (rcause & RCAUSE_WDT) return "WATCHDOG";
+  if (rcause & RCAUSE_EXT) return "EXTERNAL";
+  if (rcause & (RCAUSE_BOD12 | RCAUSE_BOD33)) return "BROWN_OUT";
+  if (rcause & RCAUSE_POR) return "POWER_ON";
+  return "UNKNOWN";
+}
+
+const char *FaultLog::module_text(uint8_t module)
+{
+  switch (module)
+  {
+  case FAULT_BOILER: return "boiler";
+  case FAULT_BREW: return "brew";
+  case FAULT_RESERVOIR: return "reservoir";
+  default: return "unknown";
+  }
+}
@@ -0,0 +1,106 @@
+/*
+  Fault log: reset cause, errors and the state before a fault, kept across resets
+  (c) 2025 - diyPresso - CC-BY-NC
+
+  The current session is kept in a RAM section that is not cleared at startup (.noinit, defined in the project linker
+  script ld/flash_with_bootloader.ld): the uptime, the last errors of the boiler, brew and reservoir modules and the
+  last FAULT_SAMPLES samples of the temperature, heater power and reservoir weight. After a warm reset (watchdog,
+  system reset, reset button) the RAM is still valid: begin() then stores it in flash, with the reset cause
+  (PM->RCAUSE). A new error does the same while running, so the state before the error survives a power cycle too.
+
+  A fault record is one flash row, the flash log is a ring of FAULT_ROWS records at the end of the flash (dp_flash.h).
+  The record is frozen at the trigger and written in the background by commit(), one flash operation per call (when no
+  other flash write is busy).
+  `GET faults` dumps the log.
+*/
+#ifndef FAULTS_H
+#define FAULTS_H
+
+#include <Arduino.h>
+#include <FlashStorage.h>
+#include "dp_time.h"
+
+#define FAULT_ROWS 8                // flash records (one row of 256 bytes each)
+#define FAULT_ROW_SIZE 256          // [bytes]
+#define FAULT_PAGE_SIZE 64          // flash write unit [bytes]
+#define FAULT_ERRORS 8              // last errors per record
+#define FAULT_SAMPLES 24            // samples per record
+#define FAULT_SAMPLE_PERIOD_MS 250UL // [msec] FAULT_SAMPLES * FAULT_SAMPLE_PERIOD_MS = 6 seconds before the trigger
+#define FAULT_RAM_MAGIC 0x544C5546  // "FULT"
+
+typedef enum : uint8_t { FAULT_TRIGGER_RESET = 1, FAULT_TRIGGER_ERROR = 2 } fault_trigger_t;
+typedef enum : uint8_t { FAULT_BOILER = 1, FAULT_BREW = 2, FAULT_RESERVOIR = 3 } fault_module_t;
+
+typedef struct {
+  uint32_t time;                    // uptime [sec]
+  uint8_t module;                   // fault_module_t
+  uint8_t code;                     // error code of the module (boiler_error_t, brew_error_t, reservoir_error_t)
+  uint16_t reserved;
+} fault_error_t;
+
+typedef struct {
+  int16_t temp;                     // boiler temperature [0.1 degC]
+  int16_t weight;                   // reservoir weight [gram]
+  uint8_t power;                    // heater power [%]
+  uint8_t state;                    // brew state id
+} fault_sample_t;
+
+typedef struct {
+  uint32_t seq;                     // sequence number of the record (in RAM: FAULT_RAM_MAGIC)
+  uint32_t uptime;                  // [sec]
+  uint16_t resets;                  // warm resets since the last power on
+  uint8_t trigger;                  // fault_trigger_t (flash only)
+  uint8_t rcause;                   // PM->RCAUSE at the start of the session (trigger reset: of the reset that ended it)
+  uint8_t error_count;              // errors in the ring (max. FAULT_ERRORS)
+  uint8_t error_head;               // next write position in the errors ring
+  uint8_t sample_count;             // samples in the ring (max. FAULT_SAMPLES)
+  uint8_t sample_head;              // next write position in the samples ring
+  fault_error_t errors[FAULT_ERRORS];
+  fault_sample_t samples[FAULT_SAMPLES];
+  uint32_t crc;                     // CRC-32 of the fields above
+} fault_record_t;
+
+static_assert(sizeof(fault_record_t) <= FAULT_ROW_SIZE && sizeof(fault_record_t) % 4 == 0, "fault record size");
+
+class FaultLog
+{
+  private:
+    typedef enum { COMMIT_IDLE, COMMIT_ERASE, COMMIT_WRITE } commit_step_t;
+
+    FlashClass _flash;
+    const uint8_t *_area;
+    int8_t _row = -1;               // row of the newest record, -1 = none
+    uint32_t _seq = 0;              // sequence number of the newest record
+    fault_record_t _frozen;         // record waiting to be written
+    bool _pending = false;
+    bool _retrigger = false;        // an error while a record was being written
+    commit_step_t _step = COMMIT_IDLE;
+    uint16_t _written = 0;          // bytes of the record written so far
+    unsigned long _last_sample = 0, _uptime_ms = 0;
+    uint8_t _errors[4] = { 0 };     // last seen error code per module
+
+    const fault_record_t *record(int8_t r) { return (const fault_record_t *)(_area + r * FAULT_ROW_SIZE); }
+    bool is_valid(const fault_record_t *r);
+    void freeze(fault_trigger_t trigger);
+    void add_error(fault_module_t module, uint8_t code);
+    void check_error(fault_module_t module, uint8_t code);
+    void sample();
+
+  public:
+    FaultLog();
+    void begin();                   // check the reset cause, store the previous session after a warm reset
+    void control();                 // sample the state and watch the errors, call from the main loop
+    void commit();                  // background flash writer: at most one flash operation per call
+    bool is_writing() { return _step != COMMIT_IDLE; } // a record is being written
+    unsigned long next_deadline();  // [msec]
+
+    const fault_record_t &session(); // the current session (RAM)
+    uint8_t count();                // records in the flash log
+    const fault_record_t *get(uint8_t i); // record i of the flash log, oldest first (NULL if not valid)
+    static const char *rcause_text(uint8_t rcause);
+    static const char *module_text(uint8_t module);
+};
+
+extern FaultLog faultLog;
+
+#endif // FAULTS_H
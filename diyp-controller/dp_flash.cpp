@@ -0,0 +1,14 @@
+/*
+  Flash areas that survive a firmware upload
+  (c) 2025 - diyPresso - CC-BY-NC
+*/
+#include "dp_flash.h"
+
+// defined by the linker script: end of the code, start and end of the initialized data (stored after the code)
+extern "C" uint32_t __etext, __data_start__, __data_end__;
+
+bool persist_flash_ok()
+{
+  uint32_t end = (uint32_t)&__etext + ((uint32_t)&__data_end__ - (uint32_t)&__data_start__);
+  return end <= PERSIST_START;
+}
@@ -0,0 +1,36 @@
+/*
+  Flash areas that survive a firmware upload
+  (c) 2025 - diyPresso - CC-BY-NC
+
+  Data that must be kept when a new firmware is uploaded (the settings, the fault log, the shot history) lives in the last PERSIST_SIZE bytes of the
+  flash, outside the firmware image:
+
+  - the project linker script (ld/flash_with_bootloader.ld, board_build.ldscript in platformio.ini) takes this region
+    out of the FLASH memory, the link fails when the image would grow into it.
+  - the upload does not erase it: bossac is called without --erase (extra_scripts: keep_persist.py) and then only
+    erases the rows it writes.
+  - a build with the stock linker script (Arduino IDE) can place the image over the region: persist_flash_ok() checks
+    the end of the image (__etext + initialized data) at run time, the modules do not write to flash when it fails.
+
+  The layout is fixed: a firmware that moves an area loses its content (every area checks its own records).
+  Note: ArduinoOTA (InternalStorage) stages a new image at the middle of the sketch flash (0x21000), an image larger than
+  PERSIST_START - 0x21000 (112 kB) would overwrite the areas during an OTA update.
+*/
+#ifndef FLASH_H
+#define FLASH_H
+
+#include <Arduino.h>
+
+#define PERSIST_SIZE 0x3000                       // [bytes], keep in sync with PERSIST in ld/flash_with_bootloader.ld
+#define PERSIST_START (FLASH_SIZE - PERSIST_SIZE) // 0x3D000 on the SAMD21G18
+#define PERSIST_SETTINGS (PERSIST_START + 0x0000) // settings journal
+#define PERSIST_SETTINGS_SIZE 0x0800
+#define PERSIST_FAULTS (PERSIST_START + 0x0800)   // fault log
+#define PERSIST_FAULTS_SIZE 0x0800
+#define PERSIST_SHOTS (PERSIST_START + 0x1000)    // shot history
+#define PERSIST_SHOTS_SIZE 0x2000
+
+// true if the firmware image ends before the PERSIST areas
+bool persist_flash_ok();
+
+#endif // FLASH_H
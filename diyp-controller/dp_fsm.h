@@ -5,22 +5,36 @@
     Implements a FSM with class functions. Only allow valid state transitions by responding to messages to state machine.
     The state function can respond to entry and exit conditions, and request a new state to be set.
 
-    You can create a state-machine from this template class in this way:
+    Every state has a compile-time ID and an entry in a constant metadata table (name, timeout, poll interval, entry/exit hooks).
+    The states are declared once, as a list macro, from which the IDs, the state count and the table are generated:
 
-    class MyStateMachine : public StateMachine<MyStateMachine>
+    // S(name, timeout [sec], poll [sec], entry hook, exit hook)
+    #define MY_STATES(S) \
+        S(state1, 0,    0.1, NULL, NULL) \
+        S(state2, 10.0, 0,   NULL, NULL) \
+        S(state3, 0,    1.0, STATE(on_enter_state3), NULL)
+
+    class MyStateMachine : public StateMachine<MyStateMachine, DP_FSM_COUNT(MY_STATES)>
     {
+        public:
+            DP_FSM_STATES(MY_STATES)
         private:
-            void state1();
-            void state2();
-            void state3();
+            void state_state1();
+            void state_state2();
+            void state_state3();
     };
 
+    and in the .cpp file:
+
+    DP_FSM_STATE_TABLE(MyStateMachine, MY_STATES);
+
 
     // a prototype state handler function
     MyStateMachine::state_function()
     {
         if ( on_entry() ) ON_ENTRY_CODE ...  // Executed once, if we enter this state
         if ( on_timeout(10.0) ) next(error_state_function); // Executed when we are longer in this state than timeout [seconds]
+        ON_STATE_TIMEOUT() NEXT(error_state_function); // Executed when we are longer in this state than the timeout in the state table
         if ( on_message(MSG_A) ) next(state_function1); // Executed when we receive a message
         else if ( on_message(MSG_B) ) next(state_function2); // Note: only 1 message per handler execution is received
         if ( on_exit() ) ON_EXIT_CODE ... // use as last statement in function, executed once if we leave this state
@@ -33,6 +47,18 @@
         error("Unhandled message [msg] in state [state]");
     }
 
+    The entry and exit hooks of the table are called by run() when the transition is made (exit hook of the old state first).
+    They should not request a new state. The time spent in each state is accumulated, see state_total_time().
+
+    Flight recorder: the last DP_FSM_TRACE_SIZE transitions are kept in a RAM ring, with a timestamp, the message passed to
+    run() and the key inputs (boiler temperature, reservoir weight) at the moment of the transition. See trace() and
+    fsm_trace_inputs(). The ring has a fixed size and recording is a handful of stores, so it is always on.
+
+    Next deadline: while a state function runs, every pending timeout (on_timeout(), ON_TIMEOUT_SEC(), ON_STATE_TIMEOUT())
+    is noted. next_deadline() returns the time until the state machine needs to run again: the earliest pending timeout,
+    the poll interval of the state (for inputs that are polled by the state function) or zero after a transition.
+    A poll interval of 0 means the state only reacts to timeouts and messages (which wake up the main loop by themselves).
+
 */
 
 #ifndef _DP_FSM_H
@@ -40,21 +66,66 @@
 
 #include "dp_time.h"  // Include timing functions for template
 
+#ifndef DP_FSM_TRACE_SIZE
+#define DP_FSM_TRACE_SIZE 16 // number of transitions in the flight recorder of each state machine (power of 2)
+#endif
+#define DP_FSM_TRACE_TEXT 64 // buffer size for one formatted flight recorder entry (and its separator)
+
+static_assert((DP_FSM_TRACE_SIZE & (DP_FSM_TRACE_SIZE - 1)) == 0, "DP_FSM_TRACE_SIZE must be a power of 2");
+
+// One flight recorder entry (12 bytes)
+typedef struct {
+    unsigned long time; // millis() of the transition
+    uint8_t from, to;   // state IDs
+    uint8_t message;    // message passed to run() when the transition was made
+    int16_t temp;       // boiler temperature [0.1 degC]
+    int16_t weight;     // reservoir weight [gram]
+} fsm_trace_t;
+
+// Fill in the key inputs of a flight recorder entry (implemented in dp_boiler.cpp)
+extern void fsm_trace_inputs(int16_t *temp, int16_t *weight);
 
-template<typename T>
+
+template<typename T, uint8_t N>
 class StateMachine
 {
     public:
+        typedef T fsm_t;
         typedef void (T::*state_function_ptr)();
+        typedef uint8_t state_id_t;
+        typedef struct {
+            state_function_ptr state; // state handler function
+            const char *name;         // state name, without the "state_" prefix
+            unsigned long timeout;    // maximum time in this state [msec], 0 = no limit
+            unsigned long poll;       // maximum time between runs in this state [msec], 0 = only on timeouts and messages
+            state_function_ptr entry; // called once when the state is entered (or NULL)
+            state_function_ptr exit;  // called once when the state is left (or NULL)
+        } state_info_t;
+        static const state_id_t STATE_NONE = N; // ID of the 'none' state (before the first run), or of a state that is not in the table
 
     protected:
         state_function_ptr _cur_state, _next_state, _prev_state;
+        state_id_t _cur_id, _next_id, _prev_id;
         int _message = 0;
         unsigned long _state_time = 0;
-        void next(state_function_ptr state) { _next_state = state; };
+        unsigned long _run_time = 0, _wake_in = 0; // time of the last run() and the time from then until the next deadline [msec]
+        unsigned long _state_total[N] = {0}; // accumulated time in each state, excluding the current visit [msec]
+        unsigned long _transitions = 0;
+        fsm_trace_t _trace[DP_FSM_TRACE_SIZE]; // flight recorder ring, _transitions is the write index
+        void next(state_function_ptr state, state_id_t id) { _next_state = state; _next_id = id; }
+        void next(state_function_ptr state) { next(state, find_state(state)); } // slower: lookup of the state ID in the table
         bool on_entry() { return _cur_state != _prev_state; }
         bool on_exit() { return _cur_state != _next_state; }
-        bool on_timeout( unsigned long duration ) { return time_since(_state_time) >= duration; }
+        bool on_timeout( unsigned long duration )
+        {
+            unsigned long elapsed = time_since(_state_time);
+            if ( elapsed >= duration )
+                return true;
+            if ( duration - elapsed < _wake_in ) // pending: note the deadline
+                _wake_in = duration - elapsed;
+            return false;
+        }
+        bool on_state_timeout() { return _cur_id < N && T::STATE_TABLE[_cur_id].timeout && on_timeout(T::STATE_TABLE[_cur_id].timeout); }
         bool on_message(int msg) { if ( msg == _message) { _message = 0; return true; } return false; }
         bool no_message() { return _message == 0; }
         bool is_prev_state(state_function_ptr state) { return _prev_state == state; }
@@ -62,31 +133,123 @@ class StateMachine
         bool is_in_state(state_function_ptr state) { return _cur_state == state; }
         void state_none() { }
 
+        static state_id_t find_state(state_function_ptr state)
+        {
+            for (state_id_t id = 0; id < N; id++)
+                if (T::STATE_TABLE[id].state == state)
+                    return id;
+            return STATE_NONE;
+        }
+
+        void call_hook(state_function_ptr hook) { if ( hook ) (((T*)this)->*hook)(); }
+
     public:
         StateMachine(state_function_ptr initial_state)
         {
             _cur_state = initial_state;
             _next_state = initial_state;
+            _cur_id = _next_id = find_state(initial_state);
             _prev_state = &StateMachine::state_none;
+            _prev_id = STATE_NONE;
         }
         bool in_state(state_function_ptr state) { return _cur_state == state; }
-        bool run() { run(0); }
+        bool run() { return run(0); }
         bool run(int msg)
         {
             _message = msg;
+            _run_time = millis();
+            _wake_in = (_cur_id < N && T::STATE_TABLE[_cur_id].poll) ? T::STATE_TABLE[_cur_id].poll : TIME_NEVER;
             (((T*)this)->*_cur_state)();
             _prev_state = _cur_state;
+            _prev_id = _cur_id;
             if ( _next_state != _cur_state )
             {
+                unsigned long now = millis();
+                if ( _cur_id < N )
+                {
+                    _state_total[_cur_id] += time_diff(now, _state_time);
+                    call_hook(T::STATE_TABLE[_cur_id].exit);
+                }
+                fsm_trace_t *t = &_trace[_transitions & (DP_FSM_TRACE_SIZE - 1)];
+                t->time = now;
+                t->from = _cur_id;
+                t->to = _next_id;
+                t->message = msg;
+                fsm_trace_inputs(&t->temp, &t->weight);
+
                 _cur_state = _next_state;
+                _cur_id = _next_id;
                 _next_state = _cur_state;
-                _state_time = millis();
+                _state_time = now;
+                _transitions++;
+                _wake_in = 0; // run the new state as soon as possible
+                if ( _cur_id < N )
+                    call_hook(T::STATE_TABLE[_cur_id].entry);
             }
             return !no_message();
         }
         double state_time() { return time_since(_state_time) / 1000.0; }
 
-        virtual const char *get_state_name() { return "<undefined>"; }
+        // time until the state machine needs to run again [msec], TIME_NEVER if it only waits for messages
+        unsigned long next_deadline()
+        {
+            if ( _wake_in == TIME_NEVER )
+                return TIME_NEVER;
+            unsigned long elapsed = time_since(_run_time);
+            return elapsed >= _wake_in ? 0 : _wake_in - elapsed;
+        }
+
+        state_id_t state_id() { return _cur_id; }
+        static uint8_t state_count() { return N; }
+        static const char *state_name(state_id_t id) { return id < N ? T::STATE_TABLE[id].name : "<none>"; }
+        const char *get_state_name() { return state_name(_cur_id); }
+        unsigned long transitions() { return _transitions; }
+
+        // total time spent in state `id`, including the current visit [sec]
+        double state_total_time(state_id_t id)
+        {
+            if ( id >= N )
+                return 0.0;
+            unsigned long t = _state_total[id];
+            if ( id == _cur_id )
+                t += time_since(_state_time);
+            return t / 1000.0;
+        }
+
+        // number of entries in the flight recorder
+        uint8_t trace_count() { return _transitions < DP_FSM_TRACE_SIZE ? _transitions : DP_FSM_TRACE_SIZE; }
+
+        // flight recorder entry, 0 is the oldest
+        const fsm_trace_t &trace(uint8_t i) { return _trace[(_transitions - trace_count() + i) & (DP_FSM_TRACE_SIZE - 1)]; }
+
+        // format a flight recorder entry as text, e.g. "123456 heating>error m0 98.5C 1200g"
+        static int format_trace(char *buf, size_t len, const fsm_trace_t &t)
+        {
+            return snprintf(buf, len, "%lu %s>%s m%u %d.%dC %dg", t.time, state_name(t.from), state_name(t.to),
+                            t.message, t.temp / 10, abs(t.temp % 10), t.weight);
+        }
+
+        // format the last `n` flight recorder entries, oldest first and separated by ';'
+        // only whole entries: the output ends before the first entry that does not fit (n * DP_FSM_TRACE_TEXT fits all)
+        void format_trace(char *buf, size_t len, uint8_t n)
+        {
+            uint8_t count = trace_count();
+            size_t pos = 0;
+            buf[0] = 0;
+            for (uint8_t i = count > n ? count - n : 0; i < count; i++)
+            {
+                size_t start = pos;
+                if ( pos )
+                    buf[pos++] = ';';
+                int l = (pos < len) ? format_trace(buf + pos, len - pos, trace(i)) : -1;
+                if ( l < 0 || pos + l >= len )
+                {
+                    buf[start] = 0;
+                    break;
+                }
+                pos += l;
+            }
+        }
 };
 
 #endif // _DP_FSM_H
@@ -95,14 +258,21 @@ class StateMachine
 #define STATE(state) (&_DP_FSM_TYPE::state)
 #define IN_STATE(state) (in_state(STATE(state_ ##state)))
 
-#define NEXT(state) next(STATE(state))
+#define NEXT(state) next(STATE(state), SID_ ##state)
 #define ON_ENTRY() if ( on_entry() )
 #define ON_EXIT() if ( on_exit() )
 #define ON_TIMEOUT(t) if ( on_timeout(t) )
 #define ON_TIMEOUT_SEC(t) if ( on_timeout((1000*t)) )
+#define ON_STATE_TIMEOUT() if ( on_state_timeout() )
 #define ON_MESSAGE(m) if ( on_message(m) )
 
-// Handy macro to be used in get_state_name() implementation
-#define RETURN_STATE_NAME(state) if (IN_STATE(state)) return #state;
-#define RETURN_NONE_STATE_NAME() if (IN_STATE(none)) return "<none>";
-#define RETURN_UNKNOWN_STATE_NAME() return  "<unknown>";
\ No newline at end of file
+// State list helpers: generate the state count, the state IDs (SID_state_<name>) and the state table from a state list macro
+#define DP_FSM_COUNT_ONE(name, timeout, poll, entry, exit) +1
+#define DP_FSM_COUNT(list) (0 list(DP_FSM_COUNT_ONE))
+#define DP_FSM_STATE_ID(name, timeout, poll, entry, exit) SID_state_ ##name,
+#define DP_FSM_STATE_INFO(name, timeout, poll, entry, exit) \
+    { &fsm_t::state_ ##name, #name, (unsigned long)(1000.0 * (timeout)), (unsigned long)(1000.0 * (poll)), entry, exit },
+#define DP_FSM_STATES(list) \
+    enum : uint8_t { list(DP_FSM_STATE_ID) }; \
+    static const state_info_t STATE_TABLE[];
+#define DP_FSM_STATE_TABLE(type, list) const type::state_info_t type::STATE_TABLE[] = { list(DP_FSM_STATE_INFO) }
@@ -35,3 +35,17 @@ void HeaterDevice::control(void)
   if ( delta ) // update time if not zero
     _time = micros();
 }
+
+/* Time until the PWM output switches, so the main loop can sleep until then.
+   Rounded up, so we are woken up just after the edge and not just before it.
+*/
+unsigned long HeaterDevice::next_edge(void)
+{
+  unsigned long on_period = (_power/100.0) * _pwm_period;
+  if ( on_period == 0 || on_period >= _pwm_period )
+    return TIME_NEVER;
+
+  unsigned long pos = (_period + usec_since(_time)) % _pwm_period;
+  unsigned long edge = pos < on_period ? on_period : _pwm_period;
+  return (edge - pos) / 1000 + 1;
+}
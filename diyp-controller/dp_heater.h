@@ -8,6 +8,8 @@
 #include "dp_hardware.h"
 #include "dp_led.h"
 
+#define HEATER_POWER_W 1300.0 // heater element at 100% [W]
+
 class HeaterDevice
 {
     private:
@@ -25,6 +27,7 @@ class HeaterDevice
         double average() { return _average; }
         bool is_on(void) { return _on; }
         double pwm_period() { return _pwm_period / 1E6; } // actual PWM period in [sec]
+        unsigned long next_edge(void); // time until the next PWM transition [msec], TIME_NEVER at 0% or 100% power
 };
 
 extern HeaterDevice heaterDevice;
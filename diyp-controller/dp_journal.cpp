@@ -0,0 +1,165 @@
+/*
+  Log-structured key/value journal in flash
+  (c) 2025 - diyPresso - CC-BY-NC
+*/
+#include "dp_journal.h"
+#include "dp_crc.h"
+
+#define JOURNAL_HEADER 0x4A // 'J'
+#define JOURNAL_DATA 0x44   // 'D'
+
+FlashJournal::FlashJournal(const void *area, uint32_t size, uint8_t format) : _flash(area, size)
+{
+  _format = format;
+  _area = (const uint8_t *)area;
+  _bank_size = size / 2;
+  _slots = _bank_size / sizeof(journal_record_t);
+}
+
+bool FlashJournal::is_valid(const journal_record_t *r)
+{
+  return (r->type == JOURNAL_HEADER || r->type == JOURNAL_DATA) && r->len <= JOURNAL_DATA_SIZE &&
+         crc32(r, offsetof(journal_record_t, crc)) == r->crc;
+}
+
+bool FlashJournal::is_free(const journal_record_t *r)
+{
+  const uint32_t *p = (const uint32_t *)r;
+  for (uint8_t i = 0; i < sizeof(journal_record_t) / 4; i++)
+    if (p[i] != 0xFFFFFFFF)
+      return false;
+  return true;
+}
+
+void FlashJournal::write(const journal_record_t *r)
+{
+  _flash.write(slot(_wbank, _wpos), r, sizeof(journal_record_t));
+  _wpos++;
+  _writes++;
+}
+
+int FlashJournal::begin()
+{
+  _bank = -1;
+  for (int8_t bank = 0; bank < 2; bank++)
+  {
+    const journal_record_t *h = slot(bank, 0);
+    if (h->type != JOURNAL_HEADER || h->key != _format || !is_valid(h))
+      continue;
+    uint32_t seq;
+    memcpy(&seq, h->data, sizeof(seq));
+    if (_bank < 0 || (int32_t)(seq - _sequence) > 0) // newest bank, wrap-around safe
+    {
+      _bank = bank;
+      _sequence = seq;
+    }
+  }
+  if (_bank < 0)
+  {
+    _wbank = -1;
+    return -1;
+  }
+
+  // find the first free slot, bounded by the bank size
+  _wbank = _bank;
+  for (_wpos = 1; _wpos < _slots && !is_free(slot(_bank, _wpos)); _wpos++)
+    ;
+  return 0;
+}
+
+int FlashJournal::replay(journal_apply_t apply)
+{
+  int count = 0;
+  uint16_t first = 0; // first record of the current transaction, 0 = none
+  if (_bank < 0)
+    return 0;
+  for (uint16_t pos = 1; pos < _slots; pos++)
+  {
+    const journal_record_t *r = slot(_bank, pos);
+    if (is_free(r))
+      break;
+    if (r->type != JOURNAL_DATA || !is_valid(r))
+    {
+      _bad_records++;
+      continue;
+    }
+    if (r->flags & JOURNAL_FIRST) // (a transaction without a last record is dropped)
+      first = pos;
+    if ((r->flags & JOURNAL_LAST) && first)
+    {
+      for (uint16_t p = first; p <= pos; p++) // complete: apply the records of the transaction
+      {
+        const journal_record_t *t = slot(_bank, p);
+        if (t->type == JOURNAL_DATA && is_valid(t))
+        {
+          apply(t->key, t->data, t->len);
+          count++;
+        }
+      }
+      first = 0;
+    }
+  }
+  return count;
+}
+
+uint16_t FlashJournal::space()
+{
+  return (_wbank < 0) ? 0 : _slots - _wpos;
+}
+
+bool FlashJournal::append(uint8_t key, const void *data, uint8_t len, uint8_t flags)
+{
+  if (_wbank < 0 || _wpos >= _slots || len > JOURNAL_DATA_SIZE)
+    return false;
+
+  journal_record_t r;
+  memset(&r, 0xFF, sizeof(r));
+  r.type = JOURNAL_DATA;
+  r.key = key;
+  r.len = len;
+  r.flags = flags;
+  memcpy(r.data, data, len);
+  r.crc = crc32(&r, offsetof(journal_record_t, crc));
+  write(&r);
+  return true;
+}
+
+void FlashJournal::compact_begin()
+{
+  _wbank = (_bank < 0) ? 0 : 1 - _bank;
+  _wpos = _slots; // nothing can be appended until the bank is erased
+  _erase_row = 0;
+}
+
+bool FlashJournal::compact_erase()
+{
+  if (_erase_row < _bank_size / JOURNAL_ROW_SIZE)
+  {
+    _flash.erase(_area + _wbank * _bank_size + _erase_row * JOURNAL_ROW_SIZE, JOURNAL_ROW_SIZE);
+    _erase_row++;
+    _erases++;
+    return false;
+  }
+  _wpos = 1; // the header is written last
+  return true;
+}
+
+void FlashJournal::compact_end()
+{
+  uint16_t pos = _wpos;
+  journal_record_t h;
+  memset(&h, 0xFF, sizeof(h));
+  h.type = JOURNAL_HEADER;
+  h.key = _format;
+  h.len = sizeof(uint32_t);
+  h.flags = 0;
+  _sequence = (_bank < 0) ? 1 : _sequence + 1;
+  memcpy(h.data, &_sequence, sizeof(_sequence));
+  h.crc = crc32(&h, offsetof(journal_record_t, crc));
+  _wpos = 0;
+  write(&h);
+
+  _bank = _wbank;
+  _wpos = pos;
+  _compactions++;
+}
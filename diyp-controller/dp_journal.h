@@ -0,0 +1,88 @@
+/*
+  Log-structured key/value journal in flash
+  (c) 2025 - diyPresso - CC-BY-NC
+
+  The journal area is split in two banks. Each bank starts with a header record (with a sequence number), followed by
+  data records that are appended in erased flash. A data record holds a key and up to JOURNAL_DATA_SIZE bytes of data,
+  the last record of a key is the valid one. Every record has its own CRC, so a record that was not completely written
+  (power loss) is skipped.
+
+  Records are grouped in transactions: the first record of a transaction has the JOURNAL_FIRST flag, the last one the
+  JOURNAL_LAST flag. replay() only applies complete transactions, so a power loss in the middle of a save leaves the
+  previous values of all keys of that save.
+
+  When the active bank is full, it is compacted: the other bank is erased, the caller writes the complete state to it
+  and then the header is written. Only then the new bank is valid and the old bank is discarded, so a power loss
+  during the compaction leaves the old bank in use.
+
+  Every function does at most one flash operation (one row erase or one page write), so a caller can spread a save over
+  several main loop iterations: erase the other bank with compact_erase() until it returns true, then append().
+
+  Records are 16 bytes and aligned, so a record never crosses a flash page (64 bytes). A slot that is all 0xFF is free.
+  An area that was never written (erased, or zeros) has no valid bank: begin() reports it.
+*/
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <Arduino.h>
+#include <FlashStorage.h>
+
+#define JOURNAL_DATA_SIZE 8     // max. data bytes per record
+#define JOURNAL_ROW_SIZE 256    // flash erase unit [bytes]
+
+#define JOURNAL_FIRST 0x01      // record flags: first and last record of a transaction
+#define JOURNAL_LAST 0x02
+
+typedef struct {
+  uint8_t type;                 // JOURNAL_HEADER or JOURNAL_DATA (0xFF = free slot)
+  uint8_t key;
+  uint8_t len;                  // data length [bytes]
+  uint8_t flags;                // JOURNAL_FIRST, JOURNAL_LAST
+  uint8_t data[JOURNAL_DATA_SIZE];
+  uint32_t crc;                 // CRC-32 of the fields above
+} journal_record_t;
+
+// apply a data record to the state of the caller
+typedef void (*journal_apply_t)(uint8_t key, const uint8_t *data, uint8_t len);
+
+class FlashJournal
+{
+  private:
+    FlashClass _flash;
+    const uint8_t *_area;
+    uint32_t _bank_size;        // [bytes]
+    uint8_t _format;            // format of the records (defined by the user), a bank of another format is not valid
+    uint16_t _slots;            // records per bank, including the header
+    int8_t _bank = -1;          // active bank, -1 = none
+    uint32_t _sequence = 0;     // sequence number of the active bank
+    int8_t _wbank = -1;         // bank that is written to (the other bank during a compaction)
+    uint16_t _wpos = 0;         // next free slot in the written bank
+    uint8_t _erase_row = 0;     // next row to erase during a compaction
+
+    // statistics
+    unsigned long _erases = 0, _writes = 0, _compactions = 0, _bad_records = 0;
+
+    const journal_record_t *slot(int8_t bank, uint16_t pos) { return (const journal_record_t *)(_area + bank * _bank_size) + pos; }
+    bool is_valid(const journal_record_t *r);
+    bool is_free(const journal_record_t *r);
+    void write(const journal_record_t *r);
+
+  public:
+    FlashJournal(const void *area, uint32_t size, uint8_t format); // size = both banks [bytes], a multiple of 2 rows
+
+    int begin();                // find the active bank: 0 = OK, -1 = no valid bank
+    int replay(journal_apply_t apply); // apply the records of all complete transactions in order, returns the number of records
+    uint16_t space();           // free data slots in the active bank
+
+    bool append(uint8_t key, const void *data, uint8_t len, uint8_t flags); // append a data record, false if the bank is full
+    void compact_begin();       // select the other bank for erasing and direct append() to it
+    bool compact_erase();       // erase the next row of the other bank, true when the bank is erased
+    void compact_end();         // write the header of the new bank and make it the active bank
+
+    unsigned long erases() { return _erases; } // number of erased rows
+    unsigned long writes() { return _writes; } // number of written records
+    unsigned long compactions() { return _compactions; }
+    unsigned long bad_records() { return _bad_records; } // records skipped by replay() due to an invalid CRC
+};
+
+#endif // JOURNAL_H
@@ -0,0 +1,122 @@
+/*
+  Deferred logging
+  (c) 2025 - diyPresso - CC-BY-NC
+*/
+#include "dp_log.h"
+#include "dp_telemetry.h"
+
+#define LOG_FORMAT_OF(name, level, format) format,
+static const char *const LOG_FORMATS[] = { LOG_MESSAGES(LOG_FORMAT_OF) };
+
+#define LOG_LINE_SIZE 96 // max. length of a text message [bytes]
+
+Logger logger;
+
+const char *Logger::level_text(uint8_t level)
+{
+  switch (level)
+  {
+  case 0: return "OFF";
+  case LOG_LEVEL_ERROR: return "ERROR";
+  case LOG_LEVEL_WARNING: return "WARNING";
+  case LOG_LEVEL_INFO: return "INFO";
+  case LOG_LEVEL_DEBUG: return "DEBUG";
+  default: return "-";
+  }
+}
+
+static float as_float(uint32_t arg)
+{
+  float f;
+  memcpy(&f, &arg, sizeof(f));
+  return f;
+}
+
+// copy a string argument in RAM into the text of the entry (truncated), returns the argument that points to the copy
+uint32_t Logger::copy_text(log_entry_t *e, uint8_t &used, uint32_t arg)
+{
+  if (used >= LOG_TEXT_SIZE)
+    return log_arg("");
+  const char *s = (const char *)(uintptr_t)arg;
+  char *t = e->text + used;
+  uint8_t n = 0;
+  while (s[n] && used + n < LOG_TEXT_SIZE - 1)
+  {
+    t[n] = s[n];
+    n++;
+  }
+  t[n] = 0;
+  used += n + 1;
+  return log_arg(t);
+}
+
+bool Logger::send_text(const log_entry_t &e)
+{
+  TextLine<LOG_LINE_SIZE> line;
+  line.print('[');
+  line.print(e.time);
+  line.print("] ");
+  line.print(level_text(LOG_LEVELS[e.id]));
+  line.print(": ");
+  uint8_t arg = 0;
+  for (const char *f = LOG_FORMATS[e.id]; *f; f++)
+  {
+    if (*f != '%' || !f[1] || arg >= e.count)
+    {
+      line.print(*f);
+      continue;
+    }
+    uint32_t a = e.args[arg++];
+    switch (*++f)
+    {
+    case 'd': line.print((long)a); break;
+    case 'u': line.print((unsigned long)a); break;
+    case 'f': line.print(as_float(a), 2); break;
+    case 's': line.print((const char *)(uintptr_t)a); break;
+    default: line.print(*f);
+    }
+  }
+  line.println();
+  return line.send();
+}
+
+// payload: time, message ID, the arguments (4 bytes, strings inline and zero terminated)
+bool Logger::send_binary(const log_entry_t &e)
+{
+  uint8_t buf[TELEMETRY_MAX_PAYLOAD];
+  size_t n = 0;
+  memcpy(buf, &e.time, sizeof(e.time));
+  n += sizeof(e.time);
+  buf[n++] = e.id;
+  uint8_t arg = 0;
+  for (const char *f = LOG_FORMATS[e.id]; *f && arg < e.count && n < sizeof(buf); f++)
+  {
+    if (*f != '%' || !f[1])
+      continue;
+    uint32_t a = e.args[arg++];
+    if (*++f == 's')
+    {
+      const char *s = (const char *)(uintptr_t)a;
+      size_t len = min(strlen(s), sizeof(buf) - n - 1);
+      memcpy(buf + n, s, len);
+      n += len;
+      buf[n++] = 0;
+    }
+    else if (n + sizeof(a) <= sizeof(buf))
+    {
+      memcpy(buf + n, &a, sizeof(a));
+      n += sizeof(a);
+    }
+  }
+  return telemetry.send(TELEMETRY_LOG, buf, n);
+}
+
+void Logger::transmit()
+{
+  while (_tail != _head)
+  {
+    if (!(_binary ? send_binary(_ring[_tail]) : send_text(_ring[_tail])))
+      return; // not sent (no host, or paused): try again in the next period
+    _tail = (_tail + 1) & (LOG_RING_SIZE - 1);
+  }
+}
@@ -0,0 +1,162 @@
+/*
+  Deferred logging: log messages are stored as a message ID plus raw arguments in a RAM ring, and formatted and sent
+  later by a low priority task (transmit()), when the serial port takes them (see Telemetry::write()).
+  (c) 2025 - diyPresso - CC-BY-NC
+
+  A call site is cheap (copy a few words to the ring, no formatting, never blocks):
+
+    LOG(BOILER_CHECK_START, get_check_reason_text(reason));
+
+  The messages are defined in LOG_MESSAGES: M(name, level, format). The format has the placeholders %d (int), %u
+  (unsigned), %f (float, 2 decimals) and %s (a string). Of a string in flash (a literal or a table entry) only the
+  pointer is stored, a string in RAM (a buffer that can change before the message is sent) is copied into the entry:
+  the first LOG_TEXT_SIZE - 1 characters of all string arguments in RAM of a message together.
+  Messages above LOG_COMPILE_LEVEL are removed by the compiler, messages above the runtime level (`PUT log <level>`)
+  are skipped at the call site. When the ring is full, a message is dropped and counted (see `GET perf`).
+
+  Output is text ("[time] level: message") or binary: a telemetry frame (see dp_telemetry.h) of type TELEMETRY_LOG
+  with the time, the message ID and the arguments (strings inline, zero terminated), decoded by server/telemetry.py
+  using the message table in this file. A text message is formatted into a buffer and sent with one write().
+
+  Note: not interrupt safe, log from the main loop only.
+*/
+#ifndef LOG_H
+#define LOG_H
+
+#include <Arduino.h>
+
+#define LOG_LEVEL_ERROR 1
+#define LOG_LEVEL_WARNING 2
+#define LOG_LEVEL_INFO 3
+#define LOG_LEVEL_DEBUG 4
+
+#ifndef LOG_COMPILE_LEVEL
+#define LOG_COMPILE_LEVEL LOG_LEVEL_DEBUG // messages above this level are not compiled in
+#endif
+#define LOG_DEFAULT_LEVEL LOG_LEVEL_INFO  // runtime level after reset
+
+#define LOG_RING_SIZE 32                  // messages (power of 2)
+#define LOG_MAX_ARGS 4
+#define LOG_TEXT_SIZE 20                  // bytes per message for copies of strings in RAM
+#define LOG_RAM_START 0x20000000UL        // start of the RAM: a string below it is in flash
+#define LOG_TRANSMIT_PERIOD_MS 50UL       // [msec] period of the transmit task
+
+// M(name, level, format)
+#define LOG_MESSAGES(M) \
+  M(RESERVOIR_DEGLITCH,    LOG_LEVEL_DEBUG,   "reservoir: deglitched reading %f, previous %f, count %d") \
+  M(BOILER_CHECK_START,    LOG_LEVEL_INFO,    "boiler check started: %s") \
+  M(BOILER_CHECK_TIMEOUT,  LOG_LEVEL_WARNING, "boiler fill timeout after %d seconds - stopping") \
+  M(BOILER_CHECK_DONE,     LOG_LEVEL_INFO,    "boiler check completed: %s - %s") \
+  M(BOILER_CHECK_CONTINUE, LOG_LEVEL_INFO,    "boiler not full yet - continuing to fill") \
+  M(BOILER_CHECK_REFILLED, LOG_LEVEL_WARNING, "%s: boiler was empty - refilled") \
+  M(AUTOTUNE_START,        LOG_LEVEL_INFO,    "autotune: started at %f degC, bias %f") \
+  M(AUTOTUNE_CYCLE,        LOG_LEVEL_DEBUG,   "autotune: cycle %u, period %f sec, amplitude %f degC, power %f") \
+  M(AUTOTUNE_DONE,         LOG_LEVEL_INFO,    "autotune: Ku %f, Tu %f sec, amplitude %f degC, holding power %f") \
+  M(AUTOTUNE_GAINS,        LOG_LEVEL_INFO,    "autotune: P %f, I %f, D %f (PUT autotune save)") \
+  M(AUTOTUNE_ABORTED,      LOG_LEVEL_WARNING, "autotune: aborted after %u cycles") \
+  M(MODEL_VALID,           LOG_LEVEL_INFO,    "model: time constant %f sec, gain %f degC/pct, dead time %f sec") \
+  M(HEATUP_SWITCH,         LOG_LEVEL_DEBUG,   "heat-up: heater off at %f degC, rate %f degC/sec, lag %f sec") \
+  M(HEATUP_DONE,           LOG_LEVEL_INFO,    "heat-up: ready in %f sec, overshoot %f degC, thermal lag %f sec") \
+  M(MODEL_INVALID,         LOG_LEVEL_WARNING, "model: not plausible after %u samples, feed-forward from the settings") \
+  M(SETTINGS_SET,          LOG_LEVEL_DEBUG,   "settings: %s=%f") \
+  M(SETTINGS_UNKNOWN_KEY,  LOG_LEVEL_WARNING, "settings: unknown key %s") \
+  M(MENU_DELTA,            LOG_LEVEL_DEBUG,   "menu: setting %d delta %f") \
+  M(TIME_TEST_START,       LOG_LEVEL_INFO,    "=== TESTING MILLIS() OVERFLOW PROTECTION ===") \
+  M(TIME_TEST_RESULT,      LOG_LEVEL_INFO,    "test %d - %s: elapsed=%u %s") \
+  M(TIME_TEST_DONE,        LOG_LEVEL_INFO,    "=== OVERFLOW TEST COMPLETE ===") \
+  M(MQTT_CONNECTED,        LOG_LEVEL_INFO,    "mqtt: connected to %s:%u") \
+  M(MQTT_RETRY,            LOG_LEVEL_WARNING, "mqtt: %s failed (error %d), retry in %u msec") \
+  M(MQTT_LOST,             LOG_LEVEL_WARNING, "mqtt: connection to %s lost") \
+  M(WIFI_CONNECTED,        LOG_LEVEL_INFO,    "wifi: connected to %s, %u attempts, %u msec") \
+  M(WIFI_LINK_LOST,        LOG_LEVEL_WARNING, "wifi: %s (rssi %d dBm) after %u sec, reconnecting") \
+  M(WIFI_RECONNECTED,      LOG_LEVEL_INFO,    "wifi: reconnected to %s in %u msec") \
+  M(WIFI_FAILED,           LOG_LEVEL_WARNING, "wifi: no connection after %u attempts, stopped") \
+  M(WIFI_AP_OPEN,          LOG_LEVEL_INFO,    "wifi: setup access point %s open") \
+  M(WIFI_AP_PAGE,          LOG_LEVEL_DEBUG,   "wifi: portal page sent, %u bytes in %u msec") \
+  M(WIFI_AP_FAILED,        LOG_LEVEL_ERROR,   "wifi: setup access point failed, stopped") \
+  M(MQTT_COMMAND,          LOG_LEVEL_INFO,    "mqtt: command with %u settings, result %d") \
+  M(SHOT_TRACE,            LOG_LEVEL_INFO,    "shot %u: trace of %u samples, %u bytes")
+
+#define LOG_ID(name, level, format) LOG_##name,
+#define LOG_LEVEL_OF(name, level, format) level,
+
+typedef enum : uint8_t { LOG_MESSAGES(LOG_ID) LOG_COUNT } log_id_t;
+constexpr uint8_t LOG_LEVELS[] = { LOG_MESSAGES(LOG_LEVEL_OF) };
+
+typedef struct {
+  uint32_t time;                          // millis()
+  uint8_t id;                             // log_id_t
+  uint8_t count;                          // number of arguments
+  uint32_t args[LOG_MAX_ARGS];
+  char text[LOG_TEXT_SIZE];               // copies of the string arguments in RAM, zero terminated
+} log_entry_t;
+
+// arguments are stored as 32 bit words
+inline uint32_t log_arg(int v) { return (uint32_t)v; }
+inline uint32_t log_arg(unsigned int v) { return v; }
+inline uint32_t log_arg(long v) { return (uint32_t)v; }
+inline uint32_t log_arg(unsigned long v) { return v; }
+inline uint32_t log_arg(double v) { float f = v; uint32_t u; memcpy(&u, &f, sizeof(u)); return u; }
+inline uint32_t log_arg(const char *s) { return (uint32_t)(uintptr_t)s; }
+template <typename T> inline bool log_is_text(T) { return false; }
+inline bool log_is_text(const char *) { return true; }
+inline bool log_is_text(char *) { return true; }
+
+class Logger
+{
+  private:
+    log_entry_t _ring[LOG_RING_SIZE];
+    uint8_t _head = 0, _tail = 0;         // write and read index
+    uint8_t _level = LOG_DEFAULT_LEVEL;
+    bool _binary = false;
+    unsigned long _written = 0, _dropped = 0;
+
+    void push(uint8_t id, const uint32_t *args, const bool *text, uint8_t count)
+    {
+      uint8_t next = (_head + 1) & (LOG_RING_SIZE - 1);
+      if (next == _tail)
+      {
+        _dropped++;
+        return;
+      }
+      log_entry_t *e = &_ring[_head];
+      e->time = millis();
+      e->id = id;
+      e->count = count;
+      uint8_t used = 0;
+      for (uint8_t i = 0; i < count; i++)
+        e->args[i] = (text[i] && args[i] >= LOG_RAM_START) ? copy_text(e, used, args[i]) : args[i];
+      _head = next;
+      _written++;
+    }
+    uint32_t copy_text(log_entry_t *e, uint8_t &used, uint32_t arg);
+    bool send_text(const log_entry_t &e);
+    bool send_binary(const log_entry_t &e);
+
+  public:
+    template <typename... A> void write(log_id_t id, A... args)
+    {
+      static_assert(sizeof...(A) <= LOG_MAX_ARGS, "too many log arguments");
+      const uint32_t a[] = { log_arg(args)..., 0 };
+      const bool text[] = { log_is_text(args)..., false };
+      push(id, a, text, sizeof...(A));
+    }
+    uint8_t level() { return _level; }
+    void level(uint8_t level) { _level = level; }
+    bool binary() { return _binary; }
+    void binary(bool binary) { _binary = binary; }
+    void transmit();                      // format and send the messages while the serial port takes them (low priority task)
+    unsigned long written() { return _written; }
+    unsigned long dropped() { return _dropped; } // messages lost because the ring was full
+    static const char *level_text(uint8_t level);
+};
+
+extern Logger logger;
+
+#define LOG(name, ...) \
+  do { \
+    if (LOG_LEVELS[LOG_##name] <= LOG_COMPILE_LEVEL && LOG_LEVELS[LOG_##name] <= logger.level()) \
+      logger.write(LOG_##name, ##__VA_ARGS__); \
+  } while (0)
+
+#endif // LOG_H
@@ -13,8 +13,7 @@
 #include "dp_pump.h"
 #include "dp_settings.h"
 #include "dp_time.h"  // Include timing functions
-
-double settings_vals[32];
+#include "dp_log.h"
 
 // the increment setting has some special values:
 #define READ_ONLY 0         // only display value, cannot modify
@@ -28,30 +27,30 @@ double settings_vals[32];
 #define FUNCTION_DEFAULTS 4
 #define FUNCTION_EXIT 5
 
-// "text", "unit", pointer, increment, decimals
+// "text", "unit", settings field, increment, decimals (the range of a setting is in the settings field table)
 const setting_t settings_list[] =
     {
-        {"Temperature", "\337C", &settings_vals[0], 0.5, 2},
-        {"Pre-infusion time", "sec", &settings_vals[1], 0.1, 2},
-        {"Infusion time", "sec", &settings_vals[2], 0.1, 2},
-        {"Extraction time", "sec", &settings_vals[3], 0.5, 2},
-        {"Extraction weight", "gram", &settings_vals[4], 0.5, 2},
-        {"P-Gain", "%/\337C", &settings_vals[5], 0.2, 1},
-        {"I-Gain", "%/\337C/s", &settings_vals[6], 0.01, 2},
-        {"D-Gain", "%s", &settings_vals[7], 0.2, 1},
-        {"FF-heat Value", "%", &settings_vals[8], 0.2, 1},
-        {"FF-ready Value", "%", &settings_vals[9], 0.2, 1},
-        {"FF-brew Value", "%", &settings_vals[10], 0.2, 1},
-        {"Shot counter", "shots", &settings_vals[11], READ_ONLY, 0},
-        {"WIFI Mode", "OFF\0ON\0CONFIG-AP\0", &settings_vals[12], SELECT_ITEM, 1},
-        {"Weight trim", "%", &settings_vals[13], 0.05, 2},
-        {"Commissioning done", "NO\0YES\0", &settings_vals[14], SELECT_ITEM, 1},
-        {"Sleep min temp", "\337C", &settings_vals[15], 1.0, 0},
-        {"   <Tare Weight>", "FULL", &settings_vals[31], EXECUTE_FUNCTION, FUNCTION_TARE},
-        {"   <Zero Counter>", "", &settings_vals[31], EXECUTE_FUNCTION, FUNCTION_ZERO},
-        {"<Reset to defaults>", "", &settings_vals[31], EXECUTE_FUNCTION, FUNCTION_DEFAULTS},
-        {"       <EXIT>", "", &settings_vals[31], EXECUTE_FUNCTION, FUNCTION_EXIT},
-        {"       <SAVE>", "", &settings_vals[31], EXECUTE_FUNCTION, FUNCTION_SAVE}};
+        {"Temperature", "\337C", SETTING_temperature, 0.5, 2},
+        {"Pre-infusion time", "sec", SETTING_preInfusionTime, 0.1, 2},
+        {"Infusion time", "sec", SETTING_infusionTime, 0.1, 2},
+        {"Extraction time", "sec", SETTING_extractionTime, 0.5, 2},
+        {"Extraction weight", "gram", SETTING_extractionWeight, 0.5, 2},
+        {"P-Gain", "%/\337C", SETTING_p, 0.2, 1},
+        {"I-Gain", "%/\337C/s", SETTING_i, 0.01, 2},
+        {"D-Gain", "%s", SETTING_d, 0.2, 1},
+        {"FF-heat Value", "%", SETTING_ff_heat, 0.2, 1},
+        {"FF-ready Value", "%", SETTING_ff_ready, 0.2, 1},
+        {"FF-brew Value", "%", SETTING_ff_brew, 0.2, 1},
+        {"Shot counter", "shots", SETTING_shotCounter, READ_ONLY, 0},
+        {"WIFI Mode", "OFF\0ON\0CONFIG-AP\0", SETTING_wifiMode, SELECT_ITEM, 1},
+        {"Weight trim", "%", SETTING_trimWeight, 0.05, 2},
+        {"Commissioning done", "NO\0YES\0", SETTING_commissioningDone, SELECT_ITEM, 1},
+        {"Sleep min temp", "\337C", SETTING_sleepMinTemp, 1.0, 0},
+        {"   <Tare Weight>", "FULL", -1, EXECUTE_FUNCTION, FUNCTION_TARE},
+        {"   <Zero Counter>", "", -1, EXECUTE_FUNCTION, FUNCTION_ZERO},
+        {"<Reset to defaults>", "", -1, EXECUTE_FUNCTION, FUNCTION_DEFAULTS},
+        {"       <EXIT>", "", -1, EXECUTE_FUNCTION, FUNCTION_EXIT},
+        {"       <SAVE>", "", -1, EXECUTE_FUNCTION, FUNCTION_SAVE}};
 
 const int num_settings = sizeof(settings_list) / sizeof(setting_t);
 
@@ -373,49 +372,17 @@ int menu_settings(bool button_pressed)
 // add a value to a setting
 double add_value(int n, double delta)
 {
-  double result;
+  const setting_t &set = settings_list[n];
   if (delta != 0)
-    Serial.print("delta:");
-  Serial.print(delta);
-
-  switch (n)
-  {
-  case 0:
-    return settings.temperature(settings.temperature() + delta);
-  case 1:
-    return settings.preInfusionTime(settings.preInfusionTime() + delta);
-  case 2:
-    return settings.infusionTime(settings.infusionTime() + delta);
-  case 3:
-    return settings.extractionTime(settings.extractionTime() + delta);
-  case 4:
-    return settings.extractionWeight(settings.extractionWeight() + delta);
-  case 5:
-    return settings.P(settings.P() + delta);
-  case 6:
-    return settings.I(settings.I() + delta);
-  case 7:
-    return settings.D(settings.D() + delta);
-  case 8:
-    return settings.ff_heat(settings.ff_heat() + delta);
-  case 9:
-    return settings.ff_ready(settings.ff_ready() + delta);
-  case 10:
-    return settings.ff_brew(settings.ff_brew() + delta);
-  case 11:
-    return settings.shotCounter();
-  case 12:
-    return settings.wifiMode(settings.wifiMode() - (delta / 2.0));
-  case 13:
-    return settings.trimWeight(settings.trimWeight() + delta);
-  case 14:
-    return settings.commissioningDone(settings.commissioningDone() + (delta / 2.0));
-  case 15:
-    return settings.sleepMinTemp(settings.sleepMinTemp() + delta);
-
-  default:
-    return 0;
-  }
+    LOG(MENU_DELTA, n, delta);
+
+  if (set.field < 0)
+    return 0; // a function
+  if (set.delta == READ_ONLY)
+    return settings.value(set.field);
+  if (set.delta == SELECT_ITEM) // one item per encoder step (the WiFi mode turns the other way)
+    delta = (set.field == SETTING_wifiMode) ? -(delta / 2.0) : delta / 2.0;
+  return settings.value(set.field, settings.value(set.field) + delta);
 }
 
 bool menu_commissioning()
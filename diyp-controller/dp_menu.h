@@ -42,7 +42,7 @@ typedef struct setting
 {
   char *name;
   char *unit;
-  double *val;
+  int field;    // index in the settings field table (SETTING_<name>), -1 for a function
   double delta;
   int decimals;
 } setting_t;
@@ -0,0 +1,113 @@
+/*
+  Online identification of the boiler (first order plus dead time)
+  (c) 2025 - diyPresso - CC-BY-NC
+*/
+#include "dp_model.h"
+#include "dp_time.h"
+#include "dp_log.h"
+
+void PlantModel::reset()
+{
+  for (int d = 0; d < MODEL_DELAYS; d++)
+  {
+    _rls[d] = {{0.0, 0.0}, {{MODEL_P0, 0.0}, {0.0, MODEL_P0}}, -1.0};
+    _u[d] = 0;
+  }
+  _first = true;
+  _valid = _stable = false;
+  _hold = 0;
+  _best = 0;
+  _samples = 0;
+}
+
+void PlantModel::update(double temp, double power, bool disturbed)
+{
+  unsigned long now = millis();
+  if (disturbed)
+    _disturbed = now;
+  if (_first)
+  {
+    _first = false;
+    _start = _last = now;
+    _temp = temp;
+    _energy = 0;
+    _disturbed = disturbed ? now : now - MODEL_HOLDOFF_MS;
+    return;
+  }
+  _energy += power * time_diff(now, _last); // (the power of this interval is applied until the next update)
+  _last = now;
+  unsigned long dt = time_diff(now, _start);
+  if (dt < MODEL_SAMPLE_MS)
+    return;
+
+  for (int d = MODEL_DELAYS - 1; d > 0; d--) // _u[d] = u[k - d], this sample is k
+    _u[d] = _u[d - 1];
+  _u[0] = _energy / dt;
+  if (time_diff(now, _disturbed) >= MODEL_HOLDOFF_MS && dt < 2 * MODEL_SAMPLE_MS) // (skip a late sample)
+  {
+    double y = temp - _temp;
+    for (int d = 0; d < MODEL_DELAYS; d++)
+    {
+      double x[2] = {(_temp - MODEL_AMBIENT) / 100.0, _u[d] / 100.0};
+      fit(_rls[d], x, y);
+      if (_rls[d].error < _rls[_best].error)
+        _best = d;
+    }
+    _samples++;
+    if (_samples % MODEL_STABLE_SAMPLES == 0)
+    {
+      double hold = holding_power(MODEL_AMBIENT + 80.0);
+      _stable = abs(hold - _hold) < MODEL_STABLE;
+      _hold = hold;
+    }
+    bool valid = _stable && check();
+    if (valid && !_valid)
+      LOG(MODEL_VALID, time_constant(), gain(), dead_time());
+    else if (!valid && _valid)
+      LOG(MODEL_INVALID, (unsigned)_samples);
+    _valid = valid;
+  }
+  _temp = temp;
+  _energy = 0;
+  _start = now;
+}
+
+// one step of recursive least squares with forgetting
+void PlantModel::fit(model_rls_t &r, const double x[2], double y)
+{
+  double px[2] = {r.p[0][0] * x[0] + r.p[0][1] * x[1], r.p[1][0] * x[0] + r.p[1][1] * x[1]};
+  double lambda = (r.p[0][0] + r.p[1][1] < MODEL_TRACE_MAX) ? MODEL_FORGET : 1.0;
+  double den = lambda + x[0] * px[0] + x[1] * px[1];
+  double e = y - r.theta[0] * x[0] - r.theta[1] * x[1];
+  r.error = (r.error < 0) ? e * e : r.error + MODEL_ERROR_FILTER * (e * e - r.error);
+  double k[2] = {px[0] / den, px[1] / den};
+  r.theta[0] += k[0] * e;
+  r.theta[1] += k[1] * e;
+  for (int i = 0; i < 2; i++)
+    for (int j = 0; j < 2; j++)
+      r.p[i][j] = (r.p[i][j] - k[i] * px[j]) / lambda;
+}
+
+// plausible parameters: a stable, heating plant with a small heat loss
+bool PlantModel::check()
+{
+  if (_samples < MODEL_MIN_SAMPLES || a() >= 0.0 || a() <= -1.0 || b() <= 0.0)
+    return false;
+  double u = holding_power(MODEL_AMBIENT + 80.0);
+  return u > 0.0 && u < MODEL_MAX_HOLD;
+}
+
+double PlantModel::gain()
+{
+  return (a() < 0.0) ? -b() / a() : 0.0;
+}
+
+double PlantModel::time_constant()
+{
+  return (a() < 0.0 && a() > -1.0) ? -(MODEL_SAMPLE_MS / 1000.0) / log(1.0 + a()) : 0.0;
+}
+
+double PlantModel::holding_power(double temp)
+{
+  return (b() > 0.0) ? -a() * (temp - MODEL_AMBIENT) / b() : 0.0;
+}
@@ -0,0 +1,87 @@
+/*
+  Online identification of the boiler (first order plus dead time)
+  (c) 2025 - diyPresso - CC-BY-NC
+
+  Every MODEL_SAMPLE_MS the change of the temperature over the sample is fitted to
+
+    T[k+1] - T[k] = a * (T[k] - MODEL_AMBIENT) + b * u[k - d]
+
+  (u the mean heater power of a sample [%], d the dead time in samples) with recursive least squares and a forgetting
+  factor. The dead time is not linear in the model: there is an estimator for each dead time of 0 .. MODEL_DELAYS - 1
+  samples, the one with the smallest (filtered) prediction error wins. From a and b follow
+
+    time constant  tau = -Ts / ln(1 + a)      [sec]
+    gain           K = -b / a                 [degC/%]
+    holding power  u = -a * (T - ambient) / b [%]   (the heat loss at temperature T)
+
+  The ambient temperature is fixed: a third parameter for the offset makes the estimate ill-conditioned (the boiler
+  stays near one temperature most of the time), and an error in the room temperature only moves the holding power a
+  little (the loss is proportional to T - ambient, about 80 degC at the setpoint).
+
+  Water drawn from the boiler is not in the model, the samples during a brew (or a boiler refill) and for
+  MODEL_HOLDOFF_MS after it are skipped. The forgetting stops while the covariance is large (no excitation,
+  e.g. hours in state ready), to prevent wind-up of the estimator.
+
+  The model is valid after MODEL_MIN_SAMPLES samples with a plausible result that has settled: the holding power
+  changed less than MODEL_STABLE over the last MODEL_STABLE_SAMPLES samples (the heat-up fits the model less well
+  than the hours at the setpoint, the estimate moves for some time after it). BoilerStateMachine uses it for the
+  feed-forward of the PID (see dp_boiler.cpp); server/boiler_sim.py has the same code for tests on the host.
+*/
+#ifndef MODEL_H
+#define MODEL_H
+
+#include <Arduino.h>
+
+#define MODEL_SAMPLE_MS 5000UL     // sample period Ts [msec]
+#define MODEL_DELAYS 8             // dead times 0 .. 7 samples (35 sec)
+#define MODEL_AMBIENT 20.0         // ambient temperature [degC]
+#define MODEL_FORGET 0.999         // forgetting factor per sample (time constant 5000 samples, 7 hours)
+#define MODEL_TRACE_MAX 1.0e4      // no forgetting above this trace of the covariance
+#define MODEL_P0 100.0             // initial covariance
+#define MODEL_ERROR_FILTER 0.01    // low-pass filter factor of the squared prediction error
+#define MODEL_HOLDOFF_MS 60000UL   // no samples during and after a brew [msec]
+#define MODEL_MIN_SAMPLES 100      // samples before the model is valid
+#define MODEL_MAX_HOLD 30.0        // max. plausible holding power [%]
+#define MODEL_STABLE_SAMPLES 60    // samples between the checks of the holding power (5 minutes)
+#define MODEL_STABLE 0.5           // max. change of the holding power between the checks [%]
+
+typedef struct {
+  double theta[2];                 // a, b (scaled by 100, the regressors are divided by 100)
+  double p[2][2];                  // covariance
+  double error;                    // filtered squared prediction error [degC^2]
+} model_rls_t;
+
+class PlantModel
+{
+  private:
+    model_rls_t _rls[MODEL_DELAYS];
+    double _u[MODEL_DELAYS] = {};  // mean heater power of the last samples, newest first [%]
+    double _temp = 0;              // temperature at the start of this sample [degC]
+    double _energy = 0;            // power integral of this sample [%*msec]
+    unsigned long _start = 0;      // millis() of the start of this sample
+    unsigned long _last = 0;       // millis() of the last update
+    unsigned long _disturbed = 0;  // millis() of the last brew or refill
+    bool _first = true;
+    bool _valid = false;           // valid() of the last sample
+    bool _stable = false;          // the holding power settled at the last check
+    double _hold = 0;              // holding power at the last check [%]
+    uint8_t _best = 0;             // estimator with the smallest error
+    unsigned long _samples = 0;
+    void fit(model_rls_t &r, const double x[2], double y);
+    bool check();
+    double a() { return _rls[_best].theta[0] / 100.0; }
+    double b() { return _rls[_best].theta[1] / 100.0; }
+
+  public:
+    PlantModel() { reset(); }
+    void reset();
+    void update(double temp, double power, bool disturbed); // every control cycle: temperature, applied heater power
+    bool valid() { return _valid; }
+    unsigned long samples() { return _samples; }
+    double gain();                 // [degC/%]
+    double time_constant();        // [sec]
+    double dead_time() { return _best * (MODEL_SAMPLE_MS / 1000.0); } // [sec]
+    double holding_power(double temp); // heater power that holds the boiler at temp [%]
+};
+
+#endif // MODEL_H
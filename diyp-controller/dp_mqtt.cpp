@@ -1,6 +1,13 @@
 #include "dp_mqtt.h"
+#include "dp_time.h"
+#include "dp_log.h"
 #include <WiFiNINA.h>
 
+#undef _DP_FSM_TYPE
+#define _DP_FSM_TYPE MqttDevice // used for the state machine macro NEXT()
+
+
+DP_FSM_STATE_TABLE(MqttDevice, MQTT_STATES);
 
 MqttDevice mqttDevice;
 
@@ -9,13 +16,20 @@ WiFiClient wifiClient;
 MqttClient mqttClient(wifiClient);
 
 
-const char broker[] = "test.mosquitto.org";
-int port = 1883;
 char topic[64]  = "";
 
-const long interval = 4000;
-unsigned long previousMillis = 0;
-int count = 0;
+static struct {
+    const char *subtopic;
+    mqtt_handler_t handler;
+    mqtt_reader_t reader;
+    mqtt_allowed_t allowed;
+} subscriptions[MQTT_MAX_SUBSCRIPTIONS];
+static int subscription_count = 0;
+
+static bool subscription_allowed(int i)
+{
+    return !subscriptions[i].allowed || subscriptions[i].allowed();
+}
 
 
 void mac_to_hex(char *hex, byte *mac)
@@ -24,71 +38,194 @@ void mac_to_hex(char *hex, byte *mac)
     for(int i=0; i<6; i++)
     {
         hex[2*i+0] = hexchar[ (mac[i] >> 4) ];
-        hex[2*i+1] = hexchar[ (mac[1] & 15) ];
+        hex[2*i+1] = hexchar[ (mac[i] & 15) ];
     }
-    hex[13] = 0;
+    hex[12] = 0;
 }
 
 void MqttDevice::init()
 {
   byte mac[6]; // Wifi MAC address
 
-  Serial.print("Attempting to connect to the MQTT broker: ");
-  Serial.println(broker);
   WiFi.macAddress(mac);
-  char topic_buf[64];
   strcpy(topic, "diyPressoOne/");
   mac_to_hex(topic+strlen(topic), mac);
+  randomSeed(micros() ^ ((unsigned long)mac[3] << 16 | mac[4] << 8 | mac[5])); // backoff jitter differs per device
+
+  mqttClient.onMessage(receive);
+  mqttClient.setConnectionTimeout(MQTT_CONNECT_TIMEOUT);
+  _enabled = true;
 
-  if (!mqttClient.connect(broker, port)) {
-    Serial.print("MQTT connection failed! Error code = ");
-    Serial.println(mqttClient.connectError());
-  }
-  on();
-  
-  Serial.println("You're connected to the MQTT broker! Subscribe using mosquitto with this command:");
-  
-  Serial.print("mosquitto_sub -h ");
-  Serial.print(broker);
+  Serial.print("MQTT broker: ");
+  Serial.print(_broker);
+  Serial.print(", subscribe using mosquitto with this command: mosquitto_sub -h ");
+  Serial.print(_broker);
   Serial.print(" -t ");
   Serial.println(topic);
 }
 
+void MqttDevice::broker(const char *host, uint16_t port)
+{
+    strncpy(_broker, host, sizeof(_broker) - 1);
+    _broker[sizeof(_broker) - 1] = 0;
+    _port = port;
+    _resolved = false;
+    _failures = 0;
+    _backoff = 0;       // (when waiting: retry now)
+    mqttClient.stop();  // (when connected: the state machine sees the closed connection and reconnects)
+}
+
+// a step failed or the connection was lost: retry after the backoff
+void MqttDevice::fail()
+{
+    mqttClient.stop();
+    _backoff = MQTT_BACKOFF_MIN << min(_failures, (uint8_t)16);
+    _backoff = min(_backoff, MQTT_BACKOFF_MAX);
+    _backoff += random(-(long)_backoff / 4, _backoff / 4 + 1);
+    _failures++;
+    LOG(MQTT_RETRY, _broker, mqttClient.connectError(), _backoff);
+    NEXT(state_backoff);
+}
+
+// wait for WiFi
+void MqttDevice::state_off()
+{
+    if (_enabled && WiFi.status() == WL_CONNECTED)
+        NEXT(state_resolve);
+}
 
-void MqttDevice::run() 
+void MqttDevice::state_resolve()
 {
-    static int count = 0;
-    unsigned long currentMillis = millis();
-    if ( !is_on() )
+    if (_resolved || _ip.fromString(_broker) || WiFi.hostByName(_broker, _ip) == 1)
+    {
+        _resolved = true;
+        NEXT(state_connect);
+    }
+    else
+        fail();
+}
+
+void MqttDevice::state_connect()
+{
+    if (!mqttClient.connect(_ip, _port))
+    {
+        _resolved = false; // the address may have changed
+        fail();
         return;
+    }
+    if (_connects++)
+        _reconnects++;
+    _epoch++; // the broker may have missed messages: send all fields
+    _failures = 0;
+    _subscribed = 0;
+    LOG(MQTT_CONNECTED, _broker, (unsigned)_port);
+    NEXT(state_subscribe);
+}
 
-    // call poll() regularly to allow the library to send MQTT keep alive which avoids being disconnected by the broker
+// one topic per run
+void MqttDevice::state_subscribe()
+{
+    if (_subscribed >= subscription_count)
+    {
+        NEXT(state_connected);
+        return;
+    }
+    if (!subscription_allowed(_subscribed)) // (checked again on the next connect, e.g. after PUT mqtt)
+    {
+        _subscribed++;
+        return;
+    }
+    char name[96];
+    snprintf(name, sizeof(name), "%s/%s", topic, subscriptions[_subscribed].subtopic);
+    if (mqttClient.subscribe(name))
+        _subscribed++;
+    else
+        fail();
+}
+
+void MqttDevice::state_connected()
+{
+    // poll() sends the keep alive, which avoids being disconnected by the broker, and receives the messages
     mqttClient.poll();
+    if (!mqttClient.connected())
+    {
+        LOG(MQTT_LOST, _broker);
+        fail();
+    }
+    else if (_subscribed < subscription_count) // subscribe() while connected
+        NEXT(state_subscribe);
+}
+
+void MqttDevice::state_backoff()
+{
+    if (WiFi.status() != WL_CONNECTED)
+        NEXT(state_off);
+    else
+        ON_TIMEOUT(_backoff) NEXT(state_resolve);
+}
 
-    /* if (currentMillis - previousMillis >= interval) 
+void MqttDevice::append(char c)
+{
+    if (_length < sizeof(_buf))
+        _buf[_length++] = c;
+    else
+        _overflow = true;
+}
+
+void MqttDevice::append(const char *s)
+{
+    while (*s)
+        append(*s++);
+}
+
+void MqttDevice::append(unsigned long value)
+{
+    char digits[10];
+    int n = 0;
+    do {
+        digits[n++] = '0' + value % 10;
+        value /= 10;
+    } while (value);
+    while (n)
+        append(digits[--n]);
+}
+
+// fixed point, rounded (same output as Print::print(double, digits), without its float multiplications per digit)
+void MqttDevice::append(double value, int digits)
+{
+    if (isnan(value)) { append("nan"); return; }
+    if (isinf(value)) { append("inf"); return; }
+    if (value < 0.0)
     {
-        previousMillis = currentMillis;
-        Serial.print("Sending message to topic: ");
-        Serial.println(topic);
-        Serial.println(count++);
-        mqttClient.beginMessage(topic);
-        mqttClient.print("counter count=");
-        mqttClient.print(count);
-        mqttClient.endMessage();
-    } */
+        append('-');
+        value = -value;
+    }
+    unsigned long scale = 1;
+    for (int i = 0; i < digits; i++)
+        scale *= 10;
+    if (value * scale > 4294967040.0) { append("ovf"); return; }
+    unsigned long fixed = (unsigned long)(value * scale + 0.5);
+    append(fixed / scale);
+    if (!digits)
+        return;
+    append('.');
+    for (unsigned long d = scale / 10, frac = fixed % scale; d; d /= 10)
+        append((char)('0' + (frac / d) % 10));
 }
 
 void MqttDevice::prepare(char *measurement)
 {
     if (_state == MSG_START)
     {
-        mqttClient.beginMessage(topic);
-        mqttClient.print("measurement ");
+        _length = 0;
+        _overflow = false;
+        append(_measurement);
+        append(' ');
     }
     if (_state == MSG_NEXT)
-        mqttClient.print(",");
-    mqttClient.print(measurement);
-    mqttClient.print("=");
+        append(',');
+    append(measurement);
+    append('=');
     _state = MSG_NEXT;
 }
 
@@ -96,27 +233,159 @@ void MqttDevice::write(char *measurement, double value)
 {
     if ( !is_on() )  return;
     prepare(measurement);
-    mqttClient.print(value);
+    append(value, 2);
 }
 
 void MqttDevice::write(char *measurement, char *value)
 {
     if ( !is_on() ) return;
     prepare(measurement);
-    mqttClient.print("\"");
-    mqttClient.print(value);
-    mqttClient.print("\"");
+    append('"');
+    for (const char *c = value; *c; c++)
+    {
+        if (*c == '"' || *c == '\\') // (escaped in influxDB string fields)
+            append('\\');
+        append(*c);
+    }
+    append('"');
 }
 
 void MqttDevice::write(char *measurement, long value)
 {
     if ( !is_on() ) return;
     prepare(measurement);
-    mqttClient.print(value);
+    if (value < 0)
+        append('-');
+    append(value < 0 ? 0UL - (unsigned long)value : (unsigned long)value);
+}
+
+bool MqttDevice::due(mqtt_field_t &f, double value)
+{
+    if (!is_on())
+        return false;
+    bool changed = (float)value != f.last && fabs(value - f.last) >= f.deadband;
+    if (f.epoch != _epoch || changed || time_since(f.time) >= f.heartbeat)
+    {
+        f.last = value;
+        f.time = millis();
+        f.epoch = _epoch;
+        return true;
+    }
+    _suppressed++;
+    return false;
+}
+
+void MqttDevice::write(mqtt_field_t &f, double value)
+{
+    if (due(f, value))
+        write((char *)f.name, value);
+}
+
+void MqttDevice::write(mqtt_field_t &f, long value)
+{
+    if (due(f, value))
+        write((char *)f.name, value);
+}
+
+void MqttDevice::write(mqtt_field_t &f, const char *text, long id)
+{
+    if (due(f, id))
+        write((char *)f.name, (char *)text);
 }
 
-void MqttDevice::send()
+size_t MqttDevice::send()
 {
-    mqttClient.endMessage();
+    size_t n = 0;
+    if (is_on() && _state == MSG_NEXT)
+    {
+        if (_timestamp)
+        {
+            append(' ');
+            append(_timestamp);
+            append("000000000"); // [nsec]
+        }
+        if (_overflow)
+        {
+            _overflows++;
+            _epoch++; // the changed fields of this message were not sent: send all fields next time
+        }
+        else
+        {
+            unsigned long start = micros();
+            mqttClient.beginMessage(topic, (unsigned long)_length); // size known: the client streams it, no copy
+            mqttClient.write((const uint8_t *)_buf, _length);
+            if (mqttClient.endMessage())
+                n = _length;
+            else
+                _epoch++;
+            _send_us = usec_since(start);
+            _max_send_us = max(_max_send_us, _send_us);
+            _messages++;
+        }
+    }
     _state = MSG_START;
-}
\ No newline at end of file
+    _measurement = "measurement";
+    _timestamp = 0;
+    return n;
+}
+
+bool MqttDevice::subscribe(const char *subtopic, mqtt_handler_t handler, mqtt_allowed_t allowed)
+{
+    if (subscription_count >= MQTT_MAX_SUBSCRIPTIONS)
+        return false;
+    subscriptions[subscription_count].subtopic = subtopic;
+    subscriptions[subscription_count].handler = handler;
+    subscriptions[subscription_count].reader = NULL;
+    subscriptions[subscription_count].allowed = allowed;
+    subscription_count++; // (subscribed by the state machine, now or after the next connect)
+    return true;
+}
+
+bool MqttDevice::subscribe(const char *subtopic, mqtt_reader_t reader, mqtt_allowed_t allowed)
+{
+    if (!subscribe(subtopic, (mqtt_handler_t)NULL, allowed))
+        return false;
+    subscriptions[subscription_count - 1].reader = reader;
+    return true;
+}
+
+// called by mqttClient.poll() when a message arrives
+void MqttDevice::receive(int size)
+{
+    static char payload[MQTT_RX_SIZE];
+    String name = mqttClient.messageTopic(); // (the client only gives a copy of the topic)
+    size_t n = strlen(topic);
+    int i = 0;
+    if (strncmp(name.c_str(), topic, n) == 0 && name[n] == '/')
+        while (i < subscription_count && strcmp(name.c_str() + n + 1, subscriptions[i].subtopic) != 0)
+            i++;
+    else
+        i = subscription_count;
+    if (i < subscription_count && !subscription_allowed(i)) // (subscribed before it was disallowed)
+        i = subscription_count;
+
+    if (i < subscription_count && subscriptions[i].reader)
+        subscriptions[i].reader(mqttClient, size);
+
+    size_t len = 0;
+    while (mqttClient.available()) // (the rest of the message, or all of it)
+    {
+        int c = mqttClient.read();
+        if (len < sizeof(payload) - 1)
+            payload[len++] = c;
+    }
+    payload[len] = 0;
+    if (i < subscription_count && subscriptions[i].handler)
+        subscriptions[i].handler(payload, len);
+}
+
+bool MqttDevice::publish(const char *subtopic, const uint8_t *data, size_t len)
+{
+    if ( !is_on() ) return false;
+    char name[96];
+    snprintf(name, sizeof(name), "%s/%s", topic, subtopic);
+    mqttClient.beginMessage(name, (unsigned long)len);
+    mqttClient.write(data, len);
+    _messages++;
+    return mqttClient.endMessage();
+}
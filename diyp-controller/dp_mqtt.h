@@ -1,31 +1,145 @@
 /*
  * MQTT client (using ArduinoMqttClient) with message formatting in influxDB line format
  * This allows easy forwarding of measurements to influxDB, using telegraf or another client.
+ *
+ * write() appends a field to a message buffer (no client calls), send() hands the complete line to the client with
+ * one write() instead of one per field (see sendTime in `GET perf` for the time it takes).
+ * A message that does not fit in the buffer is dropped (counted in overflows()).
+ *
+ * The connection is a state machine, run by the scheduler (control()): resolve the broker name, connect, subscribe the
+ * topics (one per run) and poll the client (keep alive, received messages). When a step fails or the connection is
+ * lost, it waits with an exponential backoff (MQTT_BACKOFF_MIN .. MQTT_BACKOFF_MAX, +/- 25% random, so a fleet does
+ * not reconnect in step) and starts again; while WiFi is down it waits in state off. Messages are only formatted and
+ * sent in state connected (is_on()).
+ * Note: the WiFiNINA calls themselves block (DNS lookup, TCP connect up to the module timeout, MQTT CONNACK up to
+ * MQTT_CONNECT_TIMEOUT), but each state does at most one of them per run, and a broker IP address skips the lookup.
+ *
+ * The broker is MQTT_BROKER:MQTT_PORT, or set at run time with `PUT mqtt <host> [port]`. To test against a local
+ * broker: run `mosquitto -v` on the development machine, build with -DMQTT_BROKER=\"<its address>\" (or use PUT mqtt)
+ * and watch with `mosquitto_sub -h <its address> -t 'diyPressoOne/#' -v`.
  */
 #ifndef DP_MQTT_H
 #define DP_MQTT_H
 
 #include "dp.h"
+#include "dp_fsm.h"
 #include <ArduinoMqttClient.h>
 
-class MqttDevice
+#ifndef MQTT_BROKER
+#define MQTT_BROKER "test.mosquitto.org"
+#endif
+#define MQTT_PUBLIC_BROKER "test.mosquitto.org" // anyone can publish here: no command topics (see dp_remote.h)
+#ifndef MQTT_PORT
+#define MQTT_PORT 1883
+#endif
+#define MQTT_POLL_PERIOD_MS 50          // scheduler period of control(): keep alive and received messages [msec]
+#define MQTT_CONNECT_TIMEOUT 2000       // max. wait for the broker to accept the connection [msec]
+#define MQTT_BACKOFF_MIN 1000           // first retry delay [msec], doubled after every failure
+#define MQTT_BACKOFF_MAX (5 * 60000UL)  // max. retry delay [msec]
+
+#define MQTT_MAX_SUBSCRIPTIONS 4
+#define MQTT_RX_SIZE 128 // max. size of a received message [bytes], longer messages are cut off
+#define MQTT_TX_SIZE 384 // max. size of a message [bytes]
+
+typedef void (*mqtt_handler_t)(const char *payload, size_t len); // payload is zero terminated
+typedef void (*mqtt_reader_t)(Stream &message, int size); // reads the payload from the client itself (any size)
+typedef bool (*mqtt_allowed_t)(); // a subscription is only made, and its messages handled, while this returns true
+
+// Publish policy and state of a field that is only sent when it changed (see write(mqtt_field_t &, ...)):
+// when it moved by the deadband or more since it was last sent, when its heartbeat is due, and after a reconnect.
+// A receiver reconstructs the state by holding the last value of each field (influxDB: fill(previous)); a gap in
+// the message sequence number means changes were lost, the state is complete again after the longest heartbeat.
+typedef struct {
+  const char *name;
+  float deadband;                 // 0: any change (counters, state ids), MQTT_HEARTBEAT_ONLY: never on a change
+  unsigned long heartbeat;        // max. time between two publishes [msec]
+  float last;                     // last sent value (or state id)
+  unsigned long time;             // millis() of the last send
+  unsigned long epoch;            // connection/resync epoch of the last send
+} mqtt_field_t;
+
+#define MQTT_HEARTBEAT_ONLY 3.0e38f
+
+// MQTT connection states: S(name, timeout [sec], poll [sec], entry hook, exit hook)
+// (the device runs from the scheduler every MQTT_POLL_PERIOD_MS, so the poll intervals are only for next_deadline())
+#define MQTT_STATES(S) \
+  S(off,       0, 1.0, NULL, NULL) \
+  S(resolve,   0, 0,   NULL, NULL) \
+  S(connect,   0, 0,   NULL, NULL) \
+  S(subscribe, 0, 0,   NULL, NULL) \
+  S(connected, 0, 0.05, NULL, NULL) \
+  S(backoff,   0, 0,   NULL, NULL)
+
+class MqttDevice : public StateMachine<MqttDevice, DP_FSM_COUNT(MQTT_STATES)>
 {
+    public:
+      DP_FSM_STATES(MQTT_STATES)
+
     private:
-      bool _on=false;
+      bool _enabled = false;
+      char _broker[64] = MQTT_BROKER;
+      uint16_t _port = MQTT_PORT;
+      IPAddress _ip;
+      bool _resolved = false;       // _ip is the address of _broker
+      uint8_t _subscribed = 0;      // topics subscribed on this connection
+      uint8_t _failures = 0;        // consecutive failures, for the backoff
+      unsigned long _backoff = 0;   // delay of this backoff [msec]
+      unsigned long _connects = 0, _reconnects = 0; // connections made, connections after the first one
+      void state_off();
+      void state_resolve();
+      void state_connect();
+      void state_subscribe();
+      void state_connected();
+      void state_backoff();
+      void fail();
       typedef enum  mqtt_state_t { MSG_START, MSG_NEXT };
       mqtt_state_t _state = MSG_START;
+      const char *_measurement = "measurement"; // influxDB measurement name of the message being written
+      char _buf[MQTT_TX_SIZE];      // message being written
+      size_t _length = 0;
+      bool _overflow = false;       // the message does not fit in the buffer
+      unsigned long _timestamp = 0; // unix time of the message [sec], 0 = none (the time of arrival)
+      unsigned long _epoch = 1;     // changed on every connect and failed send: all fields are sent again
+      unsigned long _suppressed = 0; // fields not sent because they did not change
+      bool due(mqtt_field_t &f, double value);
+      unsigned long _messages = 0, _overflows = 0; // statistics
+      unsigned long _send_us = 0, _max_send_us = 0; // time to hand the last message to the client, longest [usec]
       void prepare(char *measurement);
+      void append(char c);
+      void append(const char *s);
+      void append(unsigned long value);
+      void append(double value, int digits);
+      static void receive(int size);
     public:
-      MqttDevice() { off(); }
-      void on(void) { _on=true;  }
-      void off() { _on = false; }
-      bool is_on(void) { return _on; }
-      void init();
-      void run();
+      MqttDevice() : StateMachine(&MqttDevice::state_off) {}
+      bool is_on(void) { return state_id() == SID_state_connected; } // connected to the broker
+      bool is_enabled(void) { return _enabled; } // init() was called: connected, or will be when the network is back
+      void init();                  // topic name, start connecting (when WiFi is up)
+      void control() { run(); }     // run the connection state machine, from the scheduler
+      void broker(const char *host, uint16_t port); // (re)connect to this broker
+      const char *broker() { return _broker; }
+      bool public_broker() { return strcasecmp(_broker, MQTT_PUBLIC_BROKER) == 0; }
+      uint16_t port() { return _port; }
+      unsigned long reconnects() { return _reconnects; }
+      void measurement(const char *name) { _measurement = name; } // measurement name of the next message (reset after send())
+      void timestamp(unsigned long unix_time) { _timestamp = unix_time; } // time of the next message [sec] (reset after send())
       void write(char *measurement, long value);
       void write(char *measurement, double value);
       void write(char *measurement, char *value);
-      void send();
+      void write(mqtt_field_t &f, double value); // only when due (changed by the deadband, heartbeat, reconnect)
+      void write(mqtt_field_t &f, long value);
+      void write(mqtt_field_t &f, const char *text, long id); // text, due when the id changes (state names)
+      bool pending() { return _state == MSG_NEXT; } // a field was written since the last send()
+      size_t send();                // returns the message size (0 if MQTT is off or the message did not fit)
+      bool subscribe(const char *subtopic, mqtt_handler_t handler, mqtt_allowed_t allowed = NULL); // messages to <topic>/<subtopic>
+      bool subscribe(const char *subtopic, mqtt_reader_t reader, mqtt_allowed_t allowed = NULL); // (parsed while it is read, no message buffer)
+      bool publish(const char *subtopic, const uint8_t *data, size_t len); // raw message to <topic>/<subtopic>, false if not sent
+      unsigned long messages() { return _messages; }
+      unsigned long overflows() { return _overflows; }
+      unsigned long suppressed() { return _suppressed; }
+      unsigned long send_time() { return _send_us; }
+      unsigned long max_send_time() { return _max_send_us; }
+      void reset_stats() { _max_send_us = 0; }
 
 };
 
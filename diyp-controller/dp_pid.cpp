@@ -46,6 +46,14 @@ void DpPID::reset()
     curSampleTimeMs = 0;
 }
 
+/// @brief Bumpless transfer: reset, and set the integral term so the output at the current input is `output`
+/// @param output the output to continue with (e.g. the heater power that holds the setpoint)
+void DpPID::preload(const double &output)
+{
+    reset();
+    termI = constrain(output - feedForward - Kp * (*setpoint - *input), windUpMin, windUpMax);
+}
+
 void DpPID::compute()
 {
     unsigned long now = millis();
@@ -21,6 +21,7 @@ public:
 
     void start();
     void reset();
+    void preload(const double& output);
     void compute();
     void setOutputLimits(const double& min, const double& max);
     void setWindUpLimits(const double& min, const double& max);
@@ -0,0 +1,121 @@
+/*
+  Remote control over MQTT: settings and sleep/wake from the command topic
+  (c) 2025 - diyPresso - CC-BY-NC
+*/
+#include "dp_remote.h"
+#include "dp_mqtt.h"
+#include "dp_settings.h"
+#include "dp_brew.h"
+#include "dp_log.h"
+
+RemoteControl remoteControl;
+
+void RemoteControl::token()
+{
+  _token[_len] = 0;
+  if (!_len)
+    return; // (empty or trailing separator)
+  if (_result != CMD_OK)
+    return; // only the first error is reported
+
+  const char *equal = strchr(_token, '=');
+  if (_overflow)
+    _result = CMD_TOO_LONG;
+  else if (strcmp(_token, "sleep") == 0)
+    _action = ACTION_SLEEP;
+  else if (strcmp(_token, "wake") == 0)
+    _action = ACTION_WAKE;
+  else if (!equal)
+    _result = CMD_SYNTAX;
+  else if (settings.assign(_token, equal - _token, equal + 1) < 0)
+    _result = CMD_UNKNOWN_KEY;
+  else
+    _settings++;
+  if (_result != CMD_OK)
+    strcpy(_bad, _token);
+}
+
+void RemoteControl::read(Stream &message, int size)
+{
+  _len = 0;
+  _overflow = false;
+  _settings = 0;
+  _action = ACTION_NONE;
+  _result = CMD_OK;
+  _bad[0] = 0;
+  _received++;
+  bool saved = false;
+  settings.checkpoint();
+
+  while (message.available())
+  {
+    char c = message.read();
+    if (c == ',' || c == '\n' || c == '\r')
+    {
+      token();
+      _len = 0;
+      _overflow = false;
+    }
+    else if (_len < REMOTE_TOKEN_SIZE - 1)
+      _token[_len++] = c;
+    else
+      _overflow = true;
+  }
+  token();
+
+  if (_result != CMD_OK)
+  {
+    if (_settings)
+      settings.rollback(); // discard the settings of the message
+    _rejected++;
+  }
+  else
+  {
+    saved = _settings && settings.save() == 1;
+    if (saved)
+      settings.apply();
+    if (_action == ACTION_SLEEP)
+      brewProcess.sleep();
+    else if (_action == ACTION_WAKE)
+      brewProcess.wakeup();
+  }
+  LOG(MQTT_COMMAND, (unsigned)_settings, (int)_result);
+  reply(saved);
+}
+
+void RemoteControl::reply(bool saved)
+{
+  char text[32 + REMOTE_TOKEN_SIZE];
+  switch (_result)
+  {
+  case CMD_OK:
+    snprintf(text, sizeof(text), "cmd OK, settings=%u%s%s", _settings, saved ? " saved" : "",
+             _action == ACTION_SLEEP ? ", sleep" : _action == ACTION_WAKE ? ", wake" : "");
+    break;
+  case CMD_UNKNOWN_KEY:
+    snprintf(text, sizeof(text), "cmd NOK, unknown key: %s", _bad);
+    break;
+  case CMD_TOO_LONG:
+    snprintf(text, sizeof(text), "cmd NOK, too long: %s", _bad);
+    break;
+  default:
+    snprintf(text, sizeof(text), "cmd NOK, syntax error: %s", _bad);
+  }
+  mqttDevice.publish("cmd/reply", (const uint8_t *)text, strlen(text));
+}
+
+static void on_command(Stream &message, int size)
+{
+  remoteControl.read(message, size);
+}
+
+// opt-in, and not on the public broker (see dp_remote.h)
+static bool remote_allowed()
+{
+  return settings.remoteControl() && !mqttDevice.public_broker();
+}
+
+void RemoteControl::begin()
+{
+  mqttDevice.subscribe("cmd", on_command, remote_allowed);
+}
@@ -0,0 +1,58 @@
+/*
+  Remote control over MQTT: settings and sleep/wake from the command topic <topic>/cmd
+  (c) 2025 - diyPresso - CC-BY-NC
+
+  A command message is a comma (or newline) separated list of settings in the format of `PUT settings`
+  (see DpSettings::deserialize()) and the actions `sleep` and `wake`:
+
+    mosquitto_pub -h <broker> -t diyPressoOne/<mac>/cmd -m "temperature=95.0,preInfusionTime=4"
+    mosquitto_pub -h <broker> -t diyPressoOne/<mac>/cmd -m "wake"
+
+  The message is parsed while it is read from the client (a token at a time, no message buffer or String), so its
+  length is not limited by MQTT_RX_SIZE. A message is applied as a whole: all its settings are saved with one
+  settings.save() (one flash commit), or, when a token is wrong, nothing is changed. The result is published to
+  <topic>/cmd/reply, e.g. "cmd OK, settings=2 saved" or "cmd NOK, unknown key: temprature".
+
+  The broker does not authenticate the sender: anyone who can publish to the topic controls the machine. So the
+  command topic is off by default (setting remoteControl=0, enable it with `PUT settings remoteControl=1`), and it is
+  never subscribed on the public broker MQTT_PUBLIC_BROKER, only on an own broker (build with -DMQTT_BROKER or
+  `PUT mqtt`). The check is made on every connect; when it fails while subscribed, the messages are ignored.
+  The stream control topic <topic>/sub takes the same opt-in (see dp_streams.h).
+*/
+#ifndef REMOTE_H
+#define REMOTE_H
+
+#include <Arduino.h>
+
+#define REMOTE_TOKEN_SIZE 40 // max. length of one "key=value" or action [bytes]
+
+class RemoteControl
+{
+  private:
+    typedef enum : uint8_t { ACTION_NONE, ACTION_SLEEP, ACTION_WAKE } action_t;
+    typedef enum : int8_t { CMD_OK = 0, CMD_SYNTAX = -1, CMD_UNKNOWN_KEY = -2, CMD_TOO_LONG = -3 } result_t;
+
+    // the message being read
+    char _token[REMOTE_TOKEN_SIZE];
+    uint8_t _len;
+    bool _overflow;
+    uint8_t _settings;                // settings in the message
+    action_t _action;
+    result_t _result;
+    char _bad[REMOTE_TOKEN_SIZE];     // the first wrong token
+
+    unsigned long _received = 0, _rejected = 0; // statistics
+
+    void token();                     // handle the token in _token
+    void reply(bool saved);
+
+  public:
+    void begin();                     // subscribe to the command topic (before mqttDevice.init())
+    void read(Stream &message, int size); // parse and apply a command message (from the MQTT client)
+    unsigned long received() { return _received; }
+    unsigned long rejected() { return _rejected; }
+};
+
+extern RemoteControl remoteControl;
+
+#endif // REMOTE_H
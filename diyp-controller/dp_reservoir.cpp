@@ -4,6 +4,7 @@
 #include "dp.h"
 #include "dp_hardware.h"
 #include "dp_reservoir.h"
+#include "dp_log.h"
 #include "HX711.h"
 
 
@@ -43,14 +44,7 @@ void Reservoir::read()
     if  (abs(new_gross_weight - _weight_gross) > _glitch_limit && _deglitched < 3 && _deglitched > -1 )
     {
       _deglitched += 1;  
-      Serial.print("!!!! Deglitched reservoir reading. New: "); // TODO: disable debug
-      Serial.print(new_gross_weight);
-      Serial.print(" old: ");
-      Serial.print(_weight_gross);
-      Serial.print(" diff: ");
-      Serial.print(abs(new_gross_weight - _weight_gross));
-      Serial.print(" deglitched count: ");
-      Serial.println(_deglitched);
+      LOG(RESERVOIR_DEGLITCH, new_gross_weight, _weight_gross, _deglitched);
     }
     else
     {
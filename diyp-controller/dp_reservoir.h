@@ -33,6 +33,7 @@ class Reservoir
       Reservoir();
       double level() { return max(0, min(100.0 * ( weight() / RESERVOIR_CAPACITY), 100.0)); } // level [in %]
       double weight() { read(); return _weight_net; } // net weight
+      double last_weight() { return _weight_net; } // net weight of the last reading, without reading the sensor
       double get_tare() { return _tare; }
       void set_tare(double t) { _tare = t; clear_error(); }
       void set_trim(double t) { _trim = t; }
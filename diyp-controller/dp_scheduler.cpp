@@ -0,0 +1,117 @@
+/*
+  Main loop scheduler: periodic tasks and idle sleep
+  (c) 2025 - diyPresso - CC-BY-NC
+*/
+#include "dp_scheduler.h"
+#include "dp_hardware.h"
+#include "dp_time.h"
+
+Scheduler scheduler;
+
+static void brew_switch_interrupt()
+{
+  scheduler.wake();
+}
+
+void Scheduler::begin()
+{
+  attachInterrupt(digitalPinToInterrupt(PIN_BREW_SWITCH), brew_switch_interrupt, CHANGE);
+  _loop_start = micros();
+}
+
+bool Scheduler::add(const char *name, task_function_t function, unsigned long period)
+{
+  if (_task_count >= SCHEDULER_MAX_TASKS)
+    return false;
+  task_t *t = &_tasks[_task_count++];
+  t->name = name;
+  t->function = function;
+  t->period = period;
+  t->last = millis();
+  t->runs = 0;
+  t->max_us = 0;
+  return true;
+}
+
+void Scheduler::run()
+{
+  for (uint8_t i = 0; i < _task_count; i++)
+  {
+    task_t *t = &_tasks[i];
+    unsigned long elapsed = time_since(t->last);
+    if (elapsed >= t->period)
+    {
+      unsigned long start = micros();
+      t->last = millis();
+      t->function();
+      t->runs++;
+      t->max_us = max(t->max_us, usec_since(start));
+      elapsed = 0;
+    }
+    wake_within(t->period - elapsed);
+  }
+}
+
+void Scheduler::wake_within(unsigned long ms)
+{
+  if (ms < _wake_in)
+    _wake_in = ms;
+}
+
+void Scheduler::wake()
+{
+  if (!_event)
+    _event_us = micros();
+  _event = true;
+}
+
+void Scheduler::idle()
+{
+  unsigned long start = micros();
+  unsigned long busy = start - _loop_start;
+  _busy_us += busy;
+  _max_loop_us = max(_max_loop_us, busy);
+  _loops++;
+
+#ifdef IDLE_SLEEP_ENABLED
+  if (_wake_in > 0 && !_event)
+  {
+    unsigned long t0 = millis();
+    PM->SLEEP.reg = PM_SLEEP_IDLE_CPU; // only stop the CPU clock, all peripherals keep running
+    while (!_event && !Serial.available() && (_wake_in == TIME_NEVER || time_since(t0) < _wake_in))
+    {
+      // no wake() between the check and the WFI: a pending interrupt ends the WFI immediately
+      __disable_irq();
+      if (!_event)
+      {
+        __DSB();
+        __WFI();
+      }
+      __enable_irq();
+    }
+  }
+#endif
+
+  if (_event)
+  {
+    _latency_us = micros() - _event_us;
+    _max_latency_us = max(_max_latency_us, _latency_us);
+    _wakeups++;
+    _event = false;
+  }
+
+  _wake_in = TIME_NEVER;
+  _loop_start = micros();
+  _idle_us += _loop_start - start;
+}
+
+void Scheduler::reset_stats()
+{
+  _busy_us = _idle_us = _loops = 0;
+  _max_loop_us = _wakeups = _latency_us = _max_latency_us = 0;
+  for (uint8_t i = 0; i < _task_count; i++)
+  {
+    _tasks[i].runs = 0;
+    _tasks[i].max_us = 0;
+  }
+}
@@ -0,0 +1,73 @@
+/*
+  Main loop scheduler: periodic tasks and idle sleep
+  (c) 2025 - diyPresso - CC-BY-NC
+
+  The main loop runs all modules, then asks the scheduler to idle until the next deadline. The modules report their
+  next deadline with wake_within() (e.g. the state machines with next_deadline(), the heater with next_edge()).
+  Periodic tasks are registered with add() and run by run() when their period has elapsed.
+
+  In idle the CPU is put in the IDLE sleep mode (WFI). Interrupts keep running, and every interrupt wakes up the CPU
+  to check if we are done: the deadline, a wake() event (encoder, brew switch) or received serial data.
+  Note: STANDBY is not used: it would stop the clocks of the USB serial port, the encoder timer and millis().
+
+  The busy/idle time, the loop time and the wake-up latency (from a wake() event to the loop running) are measured,
+  see `GET perf`.
+*/
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <Arduino.h>
+#include "dp.h"
+
+#define SCHEDULER_MAX_TASKS 12
+
+typedef void (*task_function_t)(void);
+
+typedef struct {
+  const char *name;
+  task_function_t function;
+  unsigned long period;   // [msec]
+  unsigned long last;     // millis() of the last run
+  unsigned long runs;     // number of runs
+  unsigned long max_us;   // maximum execution time [usec]
+} task_t;
+
+class Scheduler
+{
+  private:
+    task_t _tasks[SCHEDULER_MAX_TASKS];
+    uint8_t _task_count = 0;
+    unsigned long _wake_in = 0;           // time until the next deadline of this loop [msec]
+    volatile bool _event = false;         // set by wake()
+    volatile unsigned long _event_us = 0; // micros() of the first wake() event since the last loop
+
+    // statistics
+    unsigned long _loop_start = 0;        // micros() at the start of the loop
+    uint64_t _busy_us = 0, _idle_us = 0;  // 32 bit [usec] overflows in 71 minutes
+    unsigned long _loops = 0;
+    unsigned long _max_loop_us = 0;
+    unsigned long _wakeups = 0, _latency_us = 0, _max_latency_us = 0;
+
+  public:
+    void begin();
+    bool add(const char *name, task_function_t function, unsigned long period); // period in [msec]
+    void run();                          // run all tasks that are due
+    void wake_within(unsigned long ms);  // the next deadline of a module [msec], TIME_NEVER for none
+    void wake();                         // wake up the main loop (safe to call from an interrupt)
+    void idle();                         // end of the main loop: sleep until the next deadline or event
+
+    // statistics
+    double duty_cycle() { return (_busy_us + _idle_us) ? (100.0 * _busy_us) / (double)(_busy_us + _idle_us) : 100.0; } // [%]
+    unsigned long loops() { return _loops; }
+    unsigned long max_loop_us() { return _max_loop_us; }
+    unsigned long wakeups() { return _wakeups; }
+    unsigned long latency_us() { return _latency_us; }
+    unsigned long max_latency_us() { return _max_latency_us; }
+    uint8_t task_count() { return _task_count; }
+    const task_t &task(uint8_t i) { return _tasks[i]; }
+    void reset_stats();
+};
+
+extern Scheduler scheduler;
+
+#endif // SCHEDULER_H
@@ -9,9 +9,45 @@
     screen /dev/tty.usbmodem11301 115200
     (exit with ctrl + a, ctrl + \)
 
+    Commands are read without blocking: receive() assembles a line in a fixed buffer from the bytes that are available,
+    and runs the command when the line is complete (one command per call). The commands are in a table (COMMANDS),
+    the handlers print their output directly (no String, no heap).
+
     supported commands:
     - GET info
     - GET settings
+    - GET states (accumulated time [sec] in each state of the boiler and brew state machines)
+    - GET trace (flight recorder: the last state transitions of the boiler and brew state machines)
+    - GET perf (one key=value line per counter, by group, in this order):
+        loop:    duty [%], loops, maxLoop, wakeups, latency, maxLatency [usec], task.<name>=runs,longest run [usec]
+        flash:   settings.saves, erases, saveTime [msec], flashTime, maxStall [usec], shots.maxStall [usec]
+        trace:   trace.samples, sampleTime, maxSampleTime [usec], size [bytes], published, dropped (the shot trace)
+        heatup:  heatup.count (cold starts), time to ready [sec], overshoot [degC] and lag [sec] of the last one,
+                 heatLag (the learned thermal lag [sec])
+        remote:  cmd.received, cmd.rejected (MQTT commands), telemetry.frames, dropped, pauses, log.written, dropped
+        wifi:    wifi.state, attempts, connectTime [msec], maxRunTime [usec], rssi, rssiMin, rssiMax, rssiMean [dBm],
+                 linkUp, linkUptime [sec], drops, reconnectTime, maxReconnectTime [msec], maxCheckTime [usec]
+        mqtt:    mqtt.state, reconnects, messages, overflows, suppressed (unchanged fields not sent), sendTime,
+                 maxSendTime [usec]
+        spool:   spool.count, stored, dropped, drained (offline samples), drainRate [1/sec], maxBatchTime [usec]
+        stats:   stats.<field>=min,max,mean,standard deviation of the fast fields in the last window, published
+        streams: streams.snapshots, snapshotTime [usec], stream.<id>=samples,bytes,longest sample [usec]
+      GET perf resets the loop group, wifi.maxRunTime (reset by reading it) and mqtt.maxSendTime, so these cover the
+      time since the last GET perf; all other counters run from the start.
+    - GET faults (reset cause, uptime and errors of this session, and the fault log: the errors and the samples of
+      temperature [degC], heater power [%], reservoir weight [gram] and brew state before each fault or warm reset)
+    - GET shots [n] (the last n shots of the shot history, oldest first, default 10)
+    - PUT telemetry <rate> (binary telemetry frames at <rate> [Hz], max. 50, 0 = off; see dp_telemetry.h)
+    - PUT mqtt <host> [port] (MQTT broker, until the next reset; default MQTT_BROKER, see dp_mqtt.h)
+    - PUT log <level> [text|binary] (log level: 0 = off, 1 = error, 2 = warning, 3 = info, 4 = debug; output format)
+    - GET streams (the subscribed streams: fields, rate, format, sink, samples, bytes and the longest sample [usec])
+    - SUB <fields|*> <rate> [text|binary] (subscribe to a stream of fields at <rate> [Hz], see dp_streams.h)
+    - UNSUB <id|*> (end a stream, or all serial streams)
+    - GET autotune (relay auto-tune of the boiler PID: status, cycles, ultimate gain [%/degC] and period [sec],
+      amplitude [degC], holding power [%] and the computed P, I, D; see dp_autotune.h)
+    - PUT autotune start|stop|save (start from state ready, stop, or save the result as P, I, D, ff_heat and ff_ready)
+    - GET model (identified boiler model: valid, samples, time constant [sec], gain [degC/%], dead time [sec], holding
+      power at the setpoint [%] and heat loss [W], and the feed-forward [%] and brew flow [gram/sec]; see dp_model.h)
     - PUT settings temperature=98.50,P=7.00,I=0.30,D=80.00,ff_heat=3.00,ff_ready=10.00,ff_brew=80.00,tareWeight=0.00,trimWeight=0.00,preInfusionTime=3.00,infuseTime=1.00,extractTime=25.00,extractionWeight=0.00,commissioningDone=1,shotCounter=5,wifiMode=0
     or e.g. PUT settings temperature=98.00,commissioningDone=1
 
@@ -23,6 +59,18 @@
 #include "dp_brew.h"
 #include "dp_boiler.h"
 #include "dp_reservoir.h"
+#include "dp_scheduler.h"
+#include "dp_shots.h"
+#include "dp_faults.h"
+#include "dp_telemetry.h"
+#include "dp_log.h"
+#include "dp_streams.h"
+#include "dp_mqtt.h"
+#include "dp_spool.h"
+#include "dp_stats.h"
+#include "dp_shot_trace.h"
+#include "dp_remote.h"
+#include "dp_wifi.h"
 
 //initialize the class
 DpSerial dpSerial(115200);
@@ -68,80 +116,473 @@ void DpSerial::send(const char* data) {
     Serial.println(data);
 }
 
-/* receives commands from serial bus and prasses them
+/* Key-value output, without heap allocation
+*/
+void DpSerial::send_value(const char *key, const char *value) {
+    Serial.print(key);
+    Serial.print('=');
+    Serial.println(value);
+}
+
+void DpSerial::send_value(const char *key, unsigned long value) {
+    Serial.print(key);
+    Serial.print('=');
+    Serial.println(value);
+}
 
+void DpSerial::send_value(const char *key, double value, int digits) {
+    Serial.print(key);
+    Serial.print('=');
+    Serial.println(value, digits);
+}
+
+const DpSerial::command_t DpSerial::COMMANDS[] = {
+    {"GET info", &DpSerial::send_info},
+    {"GET settings", &DpSerial::send_settings},
+    {"GET states", &DpSerial::send_states},
+    {"GET trace", &DpSerial::send_trace},
+    {"GET perf", &DpSerial::send_perf},
+    {"GET faults", &DpSerial::send_faults},
+    {"GET shots", &DpSerial::send_shots},
+    {"GET streams", &DpSerial::send_streams},
+    {"GET autotune", &DpSerial::send_autotune},
+    {"GET model", &DpSerial::send_model},
+    {"SUB", &DpSerial::subscribe},
+    {"UNSUB", &DpSerial::unsubscribe},
+    {"PUT telemetry", &DpSerial::put_telemetry},
+    {"PUT log", &DpSerial::put_log},
+    {"PUT mqtt", &DpSerial::put_mqtt},
+    {"PUT settings", &DpSerial::put_settings},
+    {"PUT autotune", &DpSerial::put_autotune},
+    {"TEST overflow", &DpSerial::test_overflow},
+};
+
+/* Receives commands from the serial bus: reads the available bytes (never waits for the rest of a line),
+   and executes the command when the line is complete.
 */
 void DpSerial::receive() {
-    String receivedData = "";
-    if (Serial.available() <= 0) {
-        return;
+    int available = Serial.available();
+    while (available-- > 0) {
+        char c = Serial.read();
+        if (c == '\n') {
+            if (_length && _line[_length - 1] == '\r')
+                _length--;
+            _line[_length] = 0;
+            if (_overflow)
+                send("NOK, command line too long");
+            else
+                execute(_line);
+            _length = 0;
+            _overflow = false;
+            return; // one command per call: the rest is read in the next loop
+        }
+        if (_length < SERIAL_LINE_SIZE - 1)
+            _line[_length++] = c;
+        else
+            _overflow = true;
     }
+}
 
-    receivedData = Serial.readStringUntil('\n');
-
-    //GET info
-    if (receivedData.startsWith("GET info")) {
-        send_info();
-    } else if (receivedData.startsWith("GET settings")) {
-        send_settings();
-    } else if (receivedData.startsWith("PUT settings "))
-    {
-        put_settings(receivedData.substring(String("SET settings ").length()));
-    } else if (receivedData.startsWith("TEST overflow")) {
-        #ifdef TEST_MILLIS_OVERFLOW
-        send("Running millis() overflow tests...");
-        test_millis_overflow();
-        send("Overflow tests completed!");
-        #else
-        send("Overflow testing not enabled. Compile with TEST_MILLIS_OVERFLOW flag.");
-        #endif
+void DpSerial::execute(const char *line) {
+    bool found = false;
+    for (size_t i = 0; i < sizeof(COMMANDS) / sizeof(COMMANDS[0]) && !found; i++) {
+        size_t n = strlen(COMMANDS[i].command);
+        if (strncmp(line, COMMANDS[i].command, n) == 0 && (line[n] == ' ' || line[n] == 0)) {
+            const char *args = line + n;
+            while (*args == ' ')
+                args++;
+            (this->*COMMANDS[i].handler)(args);
+            found = true;
+        }
     }
-    
-
-    send("echo: " + receivedData);
+    if (!found && *line) {
+        Serial.print("NOK, unknown command: ");
+        Serial.println(line);
+    }
+    Serial.print("echo: ");
+    Serial.println(line);
 }
 
-void DpSerial::send_info() {
+void DpSerial::send_info(const char *args) {
     send("diyPresso");
-    send("firmwareVersion=" + String(SOFTWARE_VERSION));
-    send("hardwareVersion=" + String(HARDWARE_REVISION));
-    send("buildDate=" + String(BUILD_DATE));
-    send("brewProcessState=" + String(brewProcess.get_state_name()));
-    send("brewProcessError=" + String(brewProcess.get_error_text()));
-    send("boilerControllerState=" + String(boilerController.get_state_name()));
-    send("boilerControllerError=" + String(boilerController.get_error_text()));
-    send("reservoirError=" + String(reservoir.get_error_text()));
+    send_value("firmwareVersion", SOFTWARE_VERSION);
+    send_value("hardwareVersion", HARDWARE_REVISION);
+    send_value("buildDate", BUILD_DATE);
+    send_value("brewProcessState", brewProcess.get_state_name());
+    send_value("brewProcessError", brewProcess.get_error_text());
+    send_value("boilerControllerState", boilerController.get_state_name());
+    send_value("boilerControllerError", boilerController.get_error_text());
+    send_value("reservoirError", reservoir.get_error_text());
+    send_value("wifiState", wifi_state());
+    send_value("mqttBroker", mqttDevice.broker());
+    send_value("mqttState", mqttDevice.get_state_name());
     send("GET info OK");
 }
 
-void DpSerial::send_settings() {
-    send(settings.serialize());
+void DpSerial::send_states(const char *args) {
+    for (int id = 0; id < boilerController.state_count(); id++) {
+        Serial.print("boiler.");
+        send_value(boilerController.state_name(id), boilerController.state_total_time(id), 1);
+    }
+    send_value("boiler.transitions", (unsigned long)boilerController.transitions());
+    for (int id = 0; id < brewProcess.state_count(); id++) {
+        Serial.print("brew.");
+        send_value(brewProcess.state_name(id), brewProcess.state_total_time(id), 1);
+    }
+    send_value("brew.transitions", (unsigned long)brewProcess.transitions());
+    send("GET states OK");
+}
+
+void DpSerial::send_trace(const char *args) {
+    char buf[DP_FSM_TRACE_TEXT];
+    for (int i = 0; i < boilerController.trace_count(); i++) {
+        boilerController.format_trace(buf, sizeof(buf), boilerController.trace(i));
+        Serial.print("boiler: ");
+        Serial.println(buf);
+    }
+    for (int i = 0; i < brewProcess.trace_count(); i++) {
+        brewProcess.format_trace(buf, sizeof(buf), brewProcess.trace(i));
+        Serial.print("brew: ");
+        Serial.println(buf);
+    }
+    send("GET trace OK");
+}
+
+void DpSerial::send_perf(const char *args) {
+    send_value("duty", scheduler.duty_cycle(), 2);
+    send_value("loops", scheduler.loops());
+    send_value("maxLoop", scheduler.max_loop_us());
+    send_value("wakeups", scheduler.wakeups());
+    send_value("latency", scheduler.latency_us());
+    send_value("maxLatency", scheduler.max_latency_us());
+    for (int i = 0; i < scheduler.task_count(); i++) {
+        Serial.print("task.");
+        Serial.print(scheduler.task(i).name);
+        Serial.print('=');
+        Serial.print(scheduler.task(i).runs);
+        Serial.print(',');
+        Serial.println(scheduler.task(i).max_us);
+    }
+    send_value("settings.saves", settings.saves());
+    send_value("settings.erases", settings.erases());
+    send_value("settings.saveTime", settings.save_time());
+    send_value("settings.flashTime", settings.flash_time());
+    send_value("settings.maxStall", settings.max_stall());
+    send_value("shots.maxStall", shotHistory.max_stall());
+    send_value("trace.samples", shotTrace.samples());
+    send_value("trace.sampleTime", shotTrace.sample_time());
+    send_value("trace.maxSampleTime", shotTrace.max_sample_time());
+    send_value("trace.size", (unsigned long)shotTrace.size());
+    send_value("trace.published", shotTrace.published());
+    send_value("trace.dropped", shotTrace.dropped());
+    const heatup_t &heatup = boilerController.heatup();
+    send_value("heatup.count", heatup.count);
+    send_value("heatup.time", heatup.time, 0);
+    send_value("heatup.overshoot", heatup.overshoot, 2);
+    send_value("heatup.lag", heatup.lag, 1);
+    send_value("heatup.heatLag", boilerController.get_heat_lag(), 1);
+    send_value("cmd.received", remoteControl.received());
+    send_value("cmd.rejected", remoteControl.rejected());
+    send_value("telemetry.frames", telemetry.frames());
+    send_value("telemetry.dropped", telemetry.dropped());
+    send_value("telemetry.pauses", telemetry.pauses());
+    send_value("log.written", logger.written());
+    send_value("log.dropped", logger.dropped());
+    send_value("wifi.state", wifi_state());
+    send_value("wifi.attempts", wifi_attempts());
+    send_value("wifi.connectTime", wifi_connect_time());
+    send_value("wifi.maxRunTime", wifi_max_run_time());
+    const wifi_link_t &link = wifi_link();
+    send_value("wifi.rssi", (double)link.rssi, 0);
+    send_value("wifi.rssiMin", (double)link.rssi_min, 0);
+    send_value("wifi.rssiMax", (double)link.rssi_max, 0);
+    send_value("wifi.rssiMean", link.rssi_mean, 1);
+    send_value("wifi.linkUp", link.up / 1000);
+    send_value("wifi.linkUptime", (link.uptime + link.up) / 1000);
+    send_value("wifi.drops", link.drops);
+    send_value("wifi.reconnectTime", link.reconnect_ms);
+    send_value("wifi.maxReconnectTime", link.max_reconnect_ms);
+    send_value("wifi.maxCheckTime", link.max_sample_us);
+    send_value("mqtt.state", mqttDevice.get_state_name());
+    send_value("mqtt.reconnects", mqttDevice.reconnects());
+    send_value("mqtt.messages", mqttDevice.messages());
+    send_value("mqtt.overflows", mqttDevice.overflows());
+    send_value("mqtt.suppressed", mqttDevice.suppressed());
+    send_value("mqtt.sendTime", mqttDevice.send_time());
+    send_value("mqtt.maxSendTime", mqttDevice.max_send_time());
+    mqttDevice.reset_stats();
+    send_value("spool.count", (unsigned long)spool.count());
+    send_value("spool.stored", spool.stored());
+    send_value("spool.dropped", spool.dropped());
+    send_value("spool.drained", spool.drained());
+    send_value("spool.drainRate", spool.drain_rate(), 2);
+    send_value("spool.maxBatchTime", spool.max_batch_time());
+    for (int f = 0; f < STATS_FIELD_COUNT; f++) {
+        RunningStats &st = windowStats.last(f);
+        Serial.print("stats.");
+        Serial.print(WindowStats::field_name(f));
+        Serial.print('=');
+        Serial.print(st.min_value(), 2);
+        Serial.print(',');
+        Serial.print(st.max_value(), 2);
+        Serial.print(',');
+        Serial.print(st.mean(), 2);
+        Serial.print(',');
+        Serial.println(st.stddev(), 2);
+    }
+    send_value("stats.published", windowStats.published());
+    send_value("streams.snapshots", streams.snapshots());
+    send_value("streams.snapshotTime", streams.snapshot_us());
+    for (int id = 0; id < STREAMS_MAX; id++) {
+        const stream_t &st = streams.stream(id);
+        if (!st.active)
+            continue;
+        Serial.print("stream.");
+        Serial.print(id);
+        Serial.print('=');
+        Serial.print(st.samples);
+        Serial.print(',');
+        Serial.print(st.bytes);
+        Serial.print(',');
+        Serial.println(st.max_us);
+    }
+    scheduler.reset_stats();
+    send("GET perf OK");
+}
+
+static void send_shot(const shot_record_t &shot) {
+    char buf[224];
+    ShotHistory::format(buf, sizeof(buf), shot);
+    Serial.println(buf);
+}
+
+void DpSerial::send_shots(const char *args) {
+    int n = atoi(args);
+    int count = shotHistory.count();
+    shotHistory.for_each(max(count - (n > 0 ? n : 10), 0), send_shot);
+    send_value("shots", (unsigned long)count);
+    send("GET shots OK");
+}
+
+static void send_fault_errors(const fault_record_t &f) {
+    Serial.print(",errors=");
+    for (int i = 0; i < f.error_count; i++) {
+        const fault_error_t &e = f.errors[(f.error_head + FAULT_ERRORS - f.error_count + i) % FAULT_ERRORS];
+        if (i)
+            Serial.print(',');
+        Serial.print(FaultLog::module_text(e.module));
+        Serial.print(':');
+        Serial.print(e.code);
+        Serial.print('@');
+        Serial.print(e.time);
+    }
+    Serial.println();
+}
+
+static void send_fault_header(const fault_record_t &f) {
+    Serial.print("rcause=");
+    Serial.print(FaultLog::rcause_text(f.rcause));
+    Serial.print(",resets=");
+    Serial.print(f.resets);
+    Serial.print(",uptime=");
+    Serial.print(f.uptime);
+    send_fault_errors(f);
+}
+
+void DpSerial::send_faults(const char *args) {
+    Serial.print("session: ");
+    send_fault_header(faultLog.session());
+    for (int i = 0, n = 0; i < FAULT_ROWS; i++) {
+        const fault_record_t *f = faultLog.get(i);
+        if (!f)
+            continue;
+        Serial.print("fault.");
+        Serial.print(n);
+        Serial.print(": seq=");
+        Serial.print(f->seq);
+        Serial.print(",trigger=");
+        Serial.print(f->trigger == FAULT_TRIGGER_RESET ? "reset," : "error,");
+        send_fault_header(*f);
+        Serial.print("fault.");
+        Serial.print(n);
+        Serial.print(".samples=");
+        for (int j = 0; j < f->sample_count; j++) {
+            const fault_sample_t &s = f->samples[(f->sample_head + FAULT_SAMPLES - f->sample_count + j) % FAULT_SAMPLES];
+            if (j)
+                Serial.print(';');
+            Serial.print(s.temp / 10.0, 1);
+            Serial.print('/');
+            Serial.print(s.power);
+            Serial.print('/');
+            Serial.print(s.weight);
+            Serial.print('/');
+            Serial.print(brewProcess.state_name(s.state));
+        }
+        Serial.println();
+        n++;
+    }
+    send("GET faults OK");
+}
+
+void DpSerial::send_streams(const char *args) {
+    for (int id = 0; id < STREAMS_MAX; id++) {
+        const stream_t &st = streams.stream(id);
+        if (!st.active)
+            continue;
+        Serial.print("stream.");
+        Serial.print(id);
+        Serial.print(": ");
+        Streams::describe(Serial, st);
+        Serial.print(",samples=");
+        Serial.print(st.samples);
+        Serial.print(",bytes=");
+        Serial.print(st.bytes);
+        Serial.print(",maxTime=");
+        Serial.println(st.max_us);
+    }
+    send("GET streams OK");
+}
+
+void DpSerial::subscribe(const char *args) {
+    int id = streams.subscribe(args, STREAM_SERIAL);
+    if (id >= 0)
+        send_value("SUB OK, stream", (unsigned long)id);
+    else if (id == -2)
+        send("SUB NOK, no free stream");
+    else
+        send("SUB NOK, use: SUB <fields|*> <rate> [text|binary]");
+}
+
+void DpSerial::unsubscribe(const char *args) {
+    send_value("UNSUB OK, removed", (unsigned long)streams.unsubscribe(args, STREAM_SERIAL));
+}
+
+void DpSerial::send_settings(const char *args) {
+    settings.serialize(Serial);
     send("GET settings OK");
 }
 
-void DpSerial::put_settings(String value) {
+void DpSerial::put_telemetry(const char *args) {
+    telemetry.rate(atoi(args));
+    send_value("PUT telemetry OK, rate", (unsigned long)telemetry.rate());
+}
 
-    int res_deserialize = settings.deserialize(value);
+void DpSerial::put_log(const char *args) {
+    logger.level(constrain(atoi(args), 0, LOG_LEVEL_DEBUG));
+    if (strstr(args, "binary"))
+        logger.binary(true);
+    else if (strstr(args, "text"))
+        logger.binary(false);
+    Serial.print("PUT log OK, level=");
+    Serial.print(Logger::level_text(logger.level()));
+    Serial.println(logger.binary() ? ", binary" : ", text");
+}
+
+void DpSerial::put_mqtt(const char *args) {
+    char host[64];
+    unsigned int port = MQTT_PORT;
+    if (sscanf(args, "%63s %u", host, &port) < 1) {
+        send("PUT mqtt NOK, use: PUT mqtt <host> [port]");
+        return;
+    }
+    mqttDevice.broker(host, port);
+    Serial.print("PUT mqtt OK, broker=");
+    Serial.print(mqttDevice.broker());
+    Serial.print(':');
+    Serial.println(mqttDevice.port());
+}
+
+void DpSerial::send_autotune(const char *args) {
+    static const char *const STATUS[] = {"idle", "running", "done", "aborted"};
+    const autotune_result_t &r = boilerController.autotune_result();
+    send_value("autotune.status", STATUS[boilerController.autotune_status()]);
+    send_value("autotune.cycles", (unsigned long)r.cycles);
+    send_value("autotune.ku", r.ku, 2);
+    send_value("autotune.tu", r.tu, 1);
+    send_value("autotune.amplitude", r.amplitude, 2);
+    send_value("autotune.power", r.power, 2);
+    send_value("autotune.P", r.p, 2);
+    send_value("autotune.I", r.i, 3);
+    send_value("autotune.D", r.d, 1);
+    send("GET autotune OK");
+}
+
+void DpSerial::send_model(const char *args) {
+    PlantModel &m = boilerController.model();
+    double hold = m.holding_power(boilerController.set_temp());
+    send_value("model.valid", m.valid() ? "yes" : "no");
+    send_value("model.samples", m.samples());
+    send_value("model.tau", m.time_constant(), 0);
+    send_value("model.gain", m.gain(), 2);
+    send_value("model.deadTime", m.dead_time(), 0);
+    send_value("model.holdPower", hold, 2);
+    send_value("model.heatLoss", hold * HEATER_POWER_W / 100.0, 0);
+    send_value("model.ff", boilerController.feed_forward(), 2);
+    send_value("model.flow", boilerController.flow(), 2);
+    send("GET model OK");
+}
+
+void DpSerial::put_autotune(const char *args) {
+    if (strcmp(args, "start") == 0) {
+        send(boilerController.start_autotune() ? "PUT autotune OK, started" : "PUT autotune NOK, boiler not ready");
+    } else if (strcmp(args, "stop") == 0) {
+        boilerController.stop_autotune();
+        send("PUT autotune OK, stopped");
+    } else if (strcmp(args, "save") == 0) {
+        if (boilerController.autotune_status() != AUTOTUNE_DONE) {
+            send("PUT autotune NOK, no result");
+            return;
+        }
+        const autotune_result_t &r = boilerController.autotune_result();
+        settings.P(r.p); // (limited to the range of the setting)
+        settings.I(r.i);
+        settings.D(r.d);
+        settings.ff_heat(r.power);
+        settings.ff_ready(r.power);
+        settings.save();
+        settings.apply();
+        send("PUT autotune OK, saved");
+        send_settings();
+    } else {
+        send("PUT autotune NOK, expected start, stop or save");
+    }
+}
+
+void DpSerial::put_settings(const char *args) {
+
+    int res_deserialize = settings.deserialize(args);
 
     if (res_deserialize == 0) {
 
         send(settings.temperature());
         int res_save = settings.save(); // all good, save the settings
 
-        if (res_save = 1) {
+        if (res_save == 1) {
             send("PUT settings OK, settings saved.");
             settings.apply();
-        } else if (res_save = 0) {
+        } else if (res_save == 0) {
             send("PUT settings OK, no changes.");
         } else {
-            send("PUT settings NOK, unknown return code when saving settings: " + String(res_save));
+            Serial.print("PUT settings NOK, unknown return code when saving settings: ");
+            Serial.println(res_save);
         }
     } else if (res_deserialize == -1) {
         send("PUT settings NOK, Invalid input string format: settings not saved");
     } else if (res_deserialize == -2) {
         send("PUT settings NOK, unknown key: settings not saved");
     } else {
-        send("PUT settings NOK, settings not saved, unknown error code when deserializing settings: " + String(res_deserialize));
+        Serial.print("PUT settings NOK, settings not saved, unknown error code when deserializing settings: ");
+        Serial.println(res_deserialize);
     }
 
-}
\ No newline at end of file
+}
+
+void DpSerial::test_overflow(const char *args) {
+    #ifdef TEST_MILLIS_OVERFLOW
+    send("Running millis() overflow tests...");
+    test_millis_overflow();
+    send("Overflow tests completed!");
+    #else
+    send("Overflow testing not enabled. Compile with TEST_MILLIS_OVERFLOW flag.");
+    #endif
+}
@@ -4,6 +4,7 @@
 #include <Arduino.h>
 #include "dp_settings.h"
 
+#define SERIAL_LINE_SIZE 320 // max. command line length [chars] (PUT settings with all settings is ~300)
 
 class DpSerial {
     public:
@@ -15,14 +16,44 @@ class DpSerial {
         void send(char data);
         void send(const char *data);
         void receive();
-        void send_info();
-        void send_settings();
+        void send_info(const char *args = NULL);
+        void send_settings(const char *args = NULL);
+        void send_states(const char *args = NULL);
+        void send_trace(const char *args = NULL);
+        void send_perf(const char *args = NULL);
+        void send_shots(const char *args = NULL); // args: number of shots (default 10)
+        void send_faults(const char *args = NULL);
+        void send_streams(const char *args = NULL);
+        void send_autotune(const char *args = NULL);
+        void send_model(const char *args = NULL);
 
     private:
+        typedef void (DpSerial::*command_handler_t)(const char *args);
+        typedef struct {
+            const char *command;        // verb and noun, e.g. "GET info"
+            command_handler_t handler;  // called with the rest of the line (leading spaces removed)
+        } command_t;
+        static const command_t COMMANDS[];
+
         unsigned long _baudRate;
-        void put_settings(String value);
+        char _line[SERIAL_LINE_SIZE];   // command line being received
+        uint16_t _length = 0;
+        bool _overflow = false;         // the line is longer than the buffer: it is dropped
+
+        void execute(const char *line);
+        void send_value(const char *key, const char *value);
+        void send_value(const char *key, unsigned long value);
+        void send_value(const char *key, double value, int digits);
+        void put_telemetry(const char *args);
+        void put_log(const char *args);
+        void put_mqtt(const char *args);
+        void subscribe(const char *args);
+        void unsubscribe(const char *args);
+        void put_settings(const char *args);
+        void put_autotune(const char *args);
+        void test_overflow(const char *args);
 };
 
 extern DpSerial dpSerial;
 
-#endif // DPSERIAL_H
\ No newline at end of file
+#endif // DPSERIAL_H
@@ -1,16 +1,41 @@
 /*
   loading and saving of a settings struct.
-  We check if the stored settings struct is valid, and the version corresponds to the expected version.
-  If there is a mismatch in version or the CRC is invalid we load default values.
+  We check if the stored settings are valid, and the version corresponds to the expected version.
+  If there are no stored settings we load default values, stored settings of an older version are migrated.
+
+  Every field is stored as a record in a flash journal, the key of a journal record is the id of the field in
+  SETTINGS_FIELDS. A save() appends the fields that changed since the last save, so changing one setting normally
+  writes one 16 byte record and erases nothing. Only when the active bank of the journal is full, the other bank is
+  erased and all fields are written to it (compaction).
+  The flash is written in the background by commit(), with one flash operation per call (see commit()).
   (c) 2024 - diyEspresso - PBRI - CC-BY-NC
 */
 
 #include "dp_settings.h"
-#include <FlashAsEEPROM.h>
+#include "dp_journal.h"
+#include "dp_flash.h"
+#include "dp_crc.h"
+#include "dp_log.h"
+#include "dp_time.h"
 #include "dp_boiler.h"
 #include "dp_reservoir.h"
 #include "dp_brew.h"
 
+#define SETTINGS_JOURNAL_SIZE 2048 // two banks of 4 flash rows, 63 records per bank
+#define SETTINGS_JOURNAL_FORMAT 1  // journal format: one record per field, keyed by field id
+#define SETTINGS_ID_VERSION 0      // journal id of the settings version
+#define SETTINGS_OFFSET 4          // the crc is not stored
+
+static_assert(SETTINGS_COUNT < 32, "too many settings fields for the commit mask");
+
+// the journal area at the end of the flash, outside the firmware image: it is kept when a new firmware is uploaded
+static_assert(SETTINGS_JOURNAL_SIZE <= PERSIST_SETTINGS_SIZE, "settings journal larger than its flash area");
+static FlashJournal journal((const void *)PERSIST_SETTINGS, SETTINGS_JOURNAL_SIZE, SETTINGS_JOURNAL_FORMAT);
+
+// The field table, in flash
+#define SETTING_FIELD_INFO(name, id, type, lo, hi, def, since) \
+    { #name, id, SETTING_TYPE_ ##type, (uint8_t)offsetof(settings_t, name), since, lo, hi, def },
+const setting_field_t DpSettings::FIELDS[SETTINGS_COUNT] = { SETTINGS_FIELDS(SETTING_FIELD_INFO) };
 
 DpSettings settings = DpSettings();
 
@@ -20,79 +45,113 @@ DpSettings::DpSettings()
 }
 
 
-/// @brief  calculate crc32 of a buffer
-/// @param s pointer to start of buffer 
-/// @param n length of buffer in bytes
-/// @return  32bit crc
-unsigned long DpSettings::crc32(const unsigned char *s, size_t n)
+/// @brief FNV-1a hash of a key, constexpr for the case labels of find()
+static constexpr uint32_t key_hash(const char *s, uint32_t h = 2166136261UL)
+{
+    return *s ? key_hash(s + 1, (h ^ (uint8_t)*s) * 16777619UL) : h;
+}
+
+/// @brief FNV-1a hash of a key that is not zero terminated
+static uint32_t key_hash(const char *s, size_t len)
+{
+    uint32_t h = 2166136261UL;
+    while (len--)
+        h = (h ^ (uint8_t)*s++) * 16777619UL;
+    return h;
+}
+
+
+/// @brief find a field by key. The hashes of all keys are case labels, so the compiler checks that the hash is
+/// perfect for this set of keys (a collision is a duplicate case value). The key is compared once to rule out other keys.
+/// @return field index, -1 if unknown
+int DpSettings::find(const char *key, size_t len)
 {
-    uint32_t crc = 0xFFFFFFFF;
+    const char *name;
+    int field;
+#define SETTING_CASE(fname, id, type, lo, hi, def, since) \
+    case key_hash(#fname): name = #fname; field = SETTING_ ##fname; break;
 
-	for(size_t i=0;i<n;i++)
+    switch (key_hash(key, len))
     {
-	    unsigned char ch = s[i];
-		for(size_t j=0;j<8;j++)
-        {
-			uint32_t b = (ch^crc) & 1;
-		    crc >>= 1;
-		    if(b) crc = crc^0xEDB88320;
-		    ch >>= 1;
-		}
-	}
-    return ~crc;
+        SETTINGS_FIELDS(SETTING_CASE)
+    // aliases
+    case key_hash("P"): name = "P"; field = SETTING_p; break;
+    case key_hash("I"): name = "I"; field = SETTING_i; break;
+    case key_hash("D"): name = "D"; field = SETTING_d; break;
+    case key_hash("infuseTime"): name = "infuseTime"; field = SETTING_infusionTime; break; // depricated
+    case key_hash("extractTime"): name = "extractTime"; field = SETTING_extractionTime; break; // depricated
+    default:
+        return -1;
+    }
+    return (strlen(name) == len && strncmp(name, key, len) == 0) ? field : -1;
 }
 
 
-/// @brief  Calculate the new CRC value of the settings struct
-void DpSettings::update_crc(void)
+/// @brief read a field of a settings struct as double
+double DpSettings::get(const settings_t *s, uint8_t field)
 {
-    unsigned char *s = (unsigned char*) &settings;
-    settings.crc = crc32( s + 4, sizeof(settings_t) - 4);
+    const unsigned char *p = ((const unsigned char*)s) + FIELDS[field].offset;
+    if ( FIELDS[field].type == SETTING_TYPE_int )
+    {
+        int v;
+        memcpy(&v, p, sizeof(v)); // packed struct: may be unaligned
+        return v;
+    }
+    double v;
+    memcpy(&v, p, sizeof(v));
+    return v;
 }
 
 
-/// @brief return true if CRC of settings struct is valid
-/// @param s pointer to settings struct
-/// @return true if CRC is valid
-bool DpSettings::crc_is_valid(settings_t *s)
+/// @brief write a field of a settings struct (without range check)
+void DpSettings::set(settings_t *s, uint8_t field, double value)
 {
-    return crc32( ((unsigned char*)s) + 4, sizeof(settings_t) - 4 ) == s->crc;
+    unsigned char *p = ((unsigned char*)s) + FIELDS[field].offset;
+    if ( FIELDS[field].type == SETTING_TYPE_int )
+    {
+        int v = (int)value;
+        memcpy(p, &v, sizeof(v));
+    }
+    else
+        memcpy(p, &value, sizeof(value));
+}
+
+
+/// @brief  Calculate the new CRC value of the settings struct
+void DpSettings::update_crc(void)
+{
+    unsigned char *s = (unsigned char*) &settings;
+    settings.crc = crc32( s + SETTINGS_OFFSET, sizeof(settings_t) - SETTINGS_OFFSET);
 }
 
 
 /// @brief set all values to default in settings stuct
 void DpSettings::defaults()
 {
-    settings.version = 2;  // Update this if new fields are added to the settings structure to prevent incorrect reads
-    settings.temperature = 98.0;
-    settings.preInfusionTime = 3;
-    settings.infusionTime = 1;
-    settings.extractionTime = 25;
-    settings.p = 6.2;
-    settings.i = 0.08;
-    settings.d = 70.0;
-    settings.ff_heat = 6.0;
-    settings.ff_ready = 6.0;
-    settings.ff_brew = 35.0;
-    settings.tareWeight = 0.0;
-    settings.trimWeight = 0.0;
-    settings.wifiMode = 0; // off=0
-    settings.shotCounter = 0;
-    settings.commissioningDone = 0; // default is 0 (not done)
-    settings.sleepMinTemp = 0.0; // default is 0 (disabled)
+    settings.version = SETTINGS_VERSION;
+    for (uint8_t f = 0; f < SETTINGS_COUNT; f++)
+        set(&settings, f, FIELDS[f].def);
     update_crc();
 }
 
 
-/// @brief read settings struct from EEPROM to memory
-/// @param s  pointer to settings struct in memory
-void DpSettings::read(settings_t *s)
+/// @brief journal replay callback: copy a stored field into the stored settings struct
+/// Records of unknown fields (removed from the list) are ignored
+void DpSettings::apply_record(uint8_t key, const uint8_t *data, uint8_t len)
 {
-    unsigned char *p = (unsigned char*)s;
-    for (int i=0; i<sizeof(settings_t); i++)
+    settings_t *s = &::settings._stored;
+    if ( key == SETTINGS_ID_VERSION && len == sizeof(s->version) )
     {
-        *p++ = EEPROM.read(i);
-        //Serial.print(i); Serial.print("="); Serial.println(EEPROM.read(i));
+        memcpy(&s->version, data, len);
+        return;
+    }
+    for (uint8_t f = 0; f < SETTINGS_COUNT; f++)
+    {
+        if ( FIELDS[f].id != key )
+            continue;
+        if ( len == (FIELDS[f].type == SETTING_TYPE_int ? sizeof(int) : sizeof(double)) )
+            memcpy(((unsigned char*)s) + FIELDS[f].offset, data, len);
+        return;
     }
 }
 
@@ -101,62 +160,159 @@ void DpSettings::read(settings_t *s)
  * load()
  * return value:
  *  0 = OK, settings loaded
- * -1 = No valid EEPROM values
- * -2 = CRC incorrect
- * -3 = Settings struct version incorrect
+ *  1 = OK, settings of an older (or newer) version loaded and migrated
+ * -1 = No valid journal in flash
  */
 int DpSettings::load()
 {
-    settings_t set;
-    if ( !EEPROM.isValid() )
-    {
-        defaults();
+    flush(); // finish a queued save first
+    defaults();
+    _stored = settings;
+    _stored.version = 0; // not stored: journal of the first version of this format
+    _stored_valid = false;
+    if ( !persist_flash_ok() || journal.begin() < 0 )
         return -1;
-    }
-    read( &set);
-    if ( !crc_is_valid(&set) )
-    {
-        defaults();
-        return -2;
-    }
-    if ( set.version != settings.version )
+    journal.replay(apply_record); // bounded: at most one bank of records
+    _stored_valid = true;
+
+    // migrate field by field: a field that did not exist in the stored version gets its default value
+    unsigned long version = _stored.version;
+    settings = _stored;
+    for (uint8_t f = 0; f < SETTINGS_COUNT; f++)
+        if ( FIELDS[f].since > version )
+            set(&settings, f, FIELDS[f].def);
+    settings.version = SETTINGS_VERSION;
+    update_crc();
+    if ( version != SETTINGS_VERSION )
     {
-        defaults();
-        return -3;
+        save(); // store the migrated settings
+        return 1;
     }
-    read( &settings );
     return 0;
 }
 
 
 /*
- * save()
+ * save(): queue the changed settings, they are written to flash by commit()
  * return value:
  * 0 = No change
- * 1 = Changed values saved
+ * 1 = Changed values queued
  */
 int DpSettings::save()
 {
-    settings_t old_settings;
     update_crc();
-    read( &old_settings );
+    if ( _stored_valid && !memcmp(((unsigned char*)&settings) + SETTINGS_OFFSET, ((unsigned char*)&_stored) + SETTINGS_OFFSET,
+                                  sizeof(settings_t) - SETTINGS_OFFSET) )
+        return 0;
+    if ( !_dirty && _step == COMMIT_IDLE )
+        _commit_start = millis();
+    _dirty = true;
+    return 1;
+}
 
-    unsigned char *s = (unsigned char*) &settings;
-    unsigned char *d = (unsigned char*) &old_settings;
-    bool changed = false;
-    for (int i=0; i<sizeof(settings_t); i++, s+=1, d+=1 )
+
+/// @brief start a commit: take a snapshot of the settings and select the fields to write
+/// @return false if there is nothing to write
+bool DpSettings::commit_start()
+{
+    uint32_t changed = 0; // bit mask of the changed fields, bit SETTINGS_COUNT is the version
+    uint8_t count = 0;
+
+    _dirty = false;
+    for (uint8_t f = 0; f <= SETTINGS_COUNT; f++)
+    {
+        bool differs = (f == SETTINGS_COUNT) ? settings.version != _stored.version : get(&settings, f) != get(&_stored, f);
+        if ( !_stored_valid || differs )
+        {
+            changed |= 1UL << f;
+            count++;
+        }
+    }
+    if ( !count )
+        return false;
+
+    _commit = settings;
+    _compact = journal.space() < count; // full (or no journal yet): write all fields to the other bank
+    if ( _compact )
+    {
+        journal.compact_begin();
+        changed = (1UL << (SETTINGS_COUNT + 1)) - 1;
+        _step = COMMIT_ERASE;
+    }
+    else
+        _step = COMMIT_WRITE;
+    _commit_mask = changed;
+    _commit_first = true;
+    _commit_us = 0;
+    _stored = _commit;
+    _stored_valid = true;
+    return true;
+}
+
+
+/*
+ * commit(): background job of save(), call from the main loop.
+ * Every call does at most one flash operation (a row erase or a record write), because the CPU stalls during a flash
+ * operation (the code runs from flash). The fields of one save are one journal transaction: after a power loss either
+ * all or none of them are loaded.
+ */
+void DpSettings::commit()
+{
+    if ( !persist_flash_ok() ) // the image overlaps the journal area (stock linker script): never write
+        _dirty = false;
+    if ( _step == COMMIT_IDLE && !(_dirty && commit_start()) )
+        return;
+
+    unsigned long start = micros();
+
+    switch ( _step )
     {
-        if ( *s != *d )
+    case COMMIT_ERASE:
+        if ( journal.compact_erase() )
+            _step = COMMIT_WRITE;
+        break;
+    case COMMIT_WRITE:
+        for (uint8_t f = 0; f <= SETTINGS_COUNT; f++)
         {
-            EEPROM.write(i, *s);
-            changed = true;
+            if ( !(_commit_mask & (1UL << f)) )
+                continue;
+            _commit_mask &= ~(1UL << f);
+            uint8_t flags = (_commit_first ? JOURNAL_FIRST : 0) | (_commit_mask ? 0 : JOURNAL_LAST);
+            if ( f == SETTINGS_COUNT )
+                journal.append(SETTINGS_ID_VERSION, &_commit.version, sizeof(_commit.version), flags);
+            else
+                journal.append(FIELDS[f].id, ((const unsigned char*)&_commit) + FIELDS[f].offset,
+                               FIELDS[f].type == SETTING_TYPE_int ? sizeof(int) : sizeof(double), flags);
+            _commit_first = false;
+            break;
         }
+        if ( !_commit_mask )
+            _step = _compact ? COMMIT_HEADER : COMMIT_IDLE;
+        break;
+    case COMMIT_HEADER:
+        journal.compact_end(); // the new bank is valid from here on
+        _step = COMMIT_IDLE;
+        break;
+    default:
+        _step = COMMIT_IDLE;
     }
-    if ( changed )
+
+    unsigned long stall = usec_since(start);
+    _commit_us += stall;
+    _max_stall_us = max(_max_stall_us, stall);
+    if ( _step == COMMIT_IDLE )
     {
-        EEPROM.commit();
+        _saves++;
+        _save_ms = time_since(_commit_start);
+        if ( _dirty ) // saved again during the commit
+            _commit_start = millis();
     }
-    return changed ? 1 : 0;
+}
+
+
+unsigned long DpSettings::erases()
+{
+    return journal.erases();
 }
 
 
@@ -168,6 +324,7 @@ void DpSettings::apply()
   boilerController.set_ff_heat(ff_heat());
   boilerController.set_ff_ready(ff_ready());
   boilerController.set_ff_brew(ff_brew());
+  boilerController.set_heat_lag(heatLag());
 
   reservoir.set_trim(trimWeight());
   reservoir.set_tare(tareWeight());
@@ -182,113 +339,79 @@ void DpSettings::apply()
 
 }
 
-String DpSettings::serialize() {
-    String result = "";
-    result += "version=" + String(settings.version) + "\n";
-    result += "crc=" + String(settings.crc) + "\n";
-    result += "temperature=" + String(settings.temperature) + "\n";
-    result += "preInfusionTime=" + String(settings.preInfusionTime) + "\n";
-    result += "infusionTime=" + String(settings.infusionTime) + "\n";
-    result += "extractionTime=" + String(settings.extractionTime) + "\n";
-    result += "extractionWeight=" + String(settings.extractionWeight) + "\n";
-    result += "p=" + String(settings.p) + "\n";
-    result += "i=" + String(settings.i) + "\n";
-    result += "d=" + String(settings.d) + "\n";
-    result += "ff_heat=" + String(settings.ff_heat) + "\n";
-    result += "ff_ready=" + String(settings.ff_ready) + "\n";
-    result += "ff_brew=" + String(settings.ff_brew) + "\n";
-    result += "tareWeight=" + String(settings.tareWeight) + "\n";
-    result += "trimWeight=" + String(settings.trimWeight) + "\n";
-    result += "commissioningDone=" + String(settings.commissioningDone) + "\n";
-    result += "shotCounter=" + String(settings.shotCounter) + "\n";
-    result += "wifiMode=" + String(settings.wifiMode) + "\n";
-    result += "sleepMinTemp=" + String(settings.sleepMinTemp) + "\n";    
-    return result;
+/// @brief write all settings to `out` as "key=value" lines, without building a String in memory
+void DpSettings::serialize(Print &out) {
+    out.print("version="); out.println(settings.version);
+    out.print("crc="); out.println(settings.crc);
+    for (uint8_t f = 0; f < SETTINGS_COUNT; f++)
+    {
+        out.print(FIELDS[f].name);
+        out.print('=');
+        if ( FIELDS[f].type == SETTING_TYPE_int )
+            out.println((long)get(&settings, f));
+        else
+            out.println(get(&settings, f), 2);
+    }
 }
 
 
 /* receives a string, parses it and updates the settings. For example:
 temperature=98.50,P=7.00,I=0.30,D=80.00,ff_heat=3.00,ff_ready=10.00,ff_brew=80.00,tareWeight=0.00,trimWeight=0.00,preInfusionTime=3.00,infuseTime=1.00,extractTime=25.00,extractionWeight=0.00,commissioningDone=1,shotCounter=5,wifiMode=0
 
-can also be a subset of these values.
+can also be a subset of these values. The keys are looked up with find(), the input is parsed in place.
 
 return value:
   0 = OK
  -1 = Invalid input string
  -2 = Unknown key
+ On an error none of the values of the input are changed.
 
- Note: does not save the settings to EEPROM, call save() after changing settings. This is done on purpose to avoid unnecessary EEPROM writes.
+ Note: does not save the settings to flash, call save() after changing settings. This is done on purpose to avoid unnecessary flash writes.
 */
-int DpSettings::deserialize(String serialized_settings) {
+int DpSettings::deserialize(const char *input) {
     int error = 0;
+    const char *pos = input;
 
-    // split the input string into key value pairs
-    int pos = 0;
-    while (pos < serialized_settings.length()) {
-        int equalPos = serialized_settings.indexOf('=', pos);
-        if (equalPos == -1) {
+    checkpoint();
+    while (*pos) {
+        const char *equal = strchr(pos, '=');
+        if (equal == NULL) {
             error = -1;
             break;
         }
-        String key = serialized_settings.substring(pos, equalPos);
-        pos = equalPos + 1;
-
-        int commaPos = serialized_settings.indexOf(',', pos);
-        String value;
-        if (commaPos == -1) {
-            value = serialized_settings.substring(pos);
-            pos = serialized_settings.length();
-        } else {
-            value = serialized_settings.substring(pos, commaPos);
-            pos = commaPos + 1;
-        }
-
-        Serial.println("key: " + key + ", value: " + value);
-
-        // Process the key-value pairs
-        if (key == "temperature") {
-            temperature(value.toDouble());
-        } else if (key == "p" || key == "P") {
-            P(value.toDouble());
-        } else if (key == "i" || key == "I") {
-            I(value.toDouble());
-        } else if (key == "d" || key == "D") {
-            D(value.toDouble());
-        } else if (key == "ff_heat") {
-            ff_heat(value.toDouble());
-        } else if (key == "ff_ready") {
-            ff_ready(value.toDouble());
-        } else if (key == "ff_brew") {
-            ff_brew(value.toDouble());
-        } else if (key == "tareWeight") {
-            tareWeight(value.toDouble());
-        } else if (key == "trimWeight") {
-            trimWeight(value.toDouble());
-        } else if (key == "preInfusionTime") {
-            preInfusionTime(value.toDouble());
-        } else if (key == "infusionTime" || key == "infuseTime") { // infuseTime is an depricated alias for infusionTime
-            infusionTime(value.toDouble());
-        } else if (key == "extractionTime" || key == "extractTime") { // extractTime is an depricated alias for extractionTime
-            extractionTime(value.toDouble());
-        } else if (key == "extractionWeight") {
-            extractionWeight(value.toDouble());
-        } else if (key == "commissioningDone") {
-            commissioningDone(value.toInt());
-        } else if (key == "shotCounter") {
-             shotCounter(value.toInt());
-        } else if (key == "wifiMode") {
-            wifiMode(value.toInt());
-        } else if (key == "sleepMinTemp") {
-            sleepMinTemp(value.toDouble());
-        } else {
-            Serial.println("Unknown key: " + key);
+        const char *val = equal + 1;
+        const char *end = strchr(val, ',');
+        if (end == NULL)
+            end = val + strlen(val);
+
+        if (assign(pos, equal - pos, val) < 0) {
+            char key[LOG_TEXT_SIZE]; // the key is not zero terminated: copy (the log copies it into its entry)
+            size_t len = min((size_t)(equal - pos), sizeof(key) - 1);
+            memcpy(key, pos, len);
+            key[len] = 0;
+            LOG(SETTINGS_UNKNOWN_KEY, key);
             error = -2; //unknown key
         }
+        pos = *end ? end + 1 : end;
     }
 
     if (error < 0) {
-        load(); // discart updarte and restore settings from EEPROM on error
+        rollback(); // discard the update on error
     }
 
     return error;
 }
+
+/// @brief set one field from its text value (limited to the range of the field), does not save
+/// @return the field index, -1 if the key is unknown
+int DpSettings::assign(const char *key, size_t len, const char *value) {
+    int field = find(key, len);
+    if (field < 0)
+        return -1;
+    if (FIELDS[field].type == SETTING_TYPE_int) {
+        LOG(SETTINGS_SET, FIELDS[field].name, this->value(field, strtol(value, NULL, 10)));
+    } else {
+        LOG(SETTINGS_SET, FIELDS[field].name, this->value(field, strtod(value, NULL)));
+    }
+    return field;
+}
@@ -4,6 +4,16 @@
   if no changes are made to the settings, nothing is saved
   If no valid data is present, default values are saved
   the setters check the range of the values to save, to prevent incorrect data
+
+  All settings are described once, in the SETTINGS_FIELDS list: name, journal id, type, range, default and the
+  settings version that added the field. The settings struct, the field table, the serial parser and serializer,
+  the storage and the settings menu are generated from / driven by this list.
+
+  The settings are stored in a flash journal (see dp_journal.h), one record per field with the journal id as key:
+  save() only appends the changed fields, a flash row is only erased when the journal is full and is compacted.
+  save() only queues the changes, commit() writes them in the background: one flash operation per call.
+  Because every field is stored with its own id, load() of an older version keeps all stored fields and only uses
+  the defaults for the new fields (no reset of the settings after a firmware upgrade).
 */
 
 #ifndef DpSettings_h
@@ -11,77 +21,149 @@
 
 #include "Arduino.h"
 #include "dp_serial.h"
+#include "dp_time.h"
 
 typedef enum wifi_modes { WIFI_MODE_OFF, WIFI_MODE_ON, WIFI_MODE_AP };
 
+#define SETTINGS_VERSION 5 // Update this if fields are added to the settings, and use it as 'since' version of the new fields
+
+// Settings fields: F(name, journal id, type, min, max, default, since version)
+// The journal id is stored in flash: never change or reuse it (id 0 is the settings version).
+#define SETTINGS_FIELDS(F) \
+  F(temperature,        1, double, 0.0,     104.0,     98.0, 1) \
+  F(preInfusionTime,    2, double, 0.0,     60.0,      3.0,  1) \
+  F(infusionTime,       3, double, 0.0,     60.0,      1.0,  1) \
+  F(extractionTime,     4, double, 0.0,     60.0,      25.0, 1) \
+  F(extractionWeight,   5, double, 1.0,     500.0,     0.0,  1) \
+  F(p,                  6, double, 0.0,     10.0,      6.2,  1) \
+  F(i,                  7, double, 0.0,     20.0,      0.08, 1) \
+  F(d,                  8, double, 0.0,     100.0,     70.0, 1) \
+  F(ff_heat,            9, double, 0.0,     100.0,     6.0,  1) \
+  F(ff_ready,          10, double, 0.0,     100.0,     6.0,  1) \
+  F(ff_brew,           11, double, 0.0,     100.0,     35.0, 1) \
+  F(tareWeight,        12, double, -2000.0, 2000.0,    0.0,  1) \
+  F(trimWeight,        13, double, -10.0,   10.0,      0.0,  1) \
+  F(commissioningDone, 14, int,    0,       1,         0,    1) \
+  F(shotCounter,       15, int,    0,       INT32_MAX, 0,    1) \
+  F(wifiMode,          16, int,    0,       2,         0,    1) \
+  F(sleepMinTemp,      17, double, 0.0,     100.0,     0.0,  2) \
+  F(heatLag,           18, double, 0.0,     120.0,     30.0, 4) \
+  F(remoteControl,     19, int,    0,       1,         0,    5)
+
+#define SETTING_ENUM(name, id, type, lo, hi, def, since) SETTING_ ##name,
+#define SETTING_MEMBER(name, id, type, lo, hi, def, since) type name;
+
+// Field indexes in the field table (not stored: the order may change)
+typedef enum { SETTINGS_FIELDS(SETTING_ENUM) SETTINGS_COUNT } setting_index_t;
+
+typedef enum { SETTING_TYPE_double, SETTING_TYPE_int } setting_type_t;
+
+typedef struct {
+    const char *name;   // key of serialize() and deserialize()
+    uint8_t id;         // key in the flash journal
+    uint8_t type;       // setting_type_t
+    uint8_t offset;     // offset in the settings struct
+    uint8_t since;      // settings version that added the field
+    double min, max;    // range of the setter
+    double def;         // default value
+} setting_field_t;
+
 class DpSettings
 {
     private:
         typedef struct __attribute__ ((packed)) settings_struct { // a packed struct has no alignment of fields
             unsigned long int crc; // crc of all the the fields after the crc
             unsigned long int version; // settings struct version
-            double temperature;
-            double preInfusionTime;
-            double infusionTime;
-            double extractionTime;
-            double extractionWeight;
-            double p, i, d, ff_heat, ff_ready, ff_brew;
-            double tareWeight;
-            double trimWeight;
-            int commissioningDone;
-            int shotCounter;
-            int wifiMode;
-            double sleepMinTemp; // minimum temperature during sleep (0 = disabled)
+            SETTINGS_FIELDS(SETTING_MEMBER)
         } settings_t;
+        typedef enum { COMMIT_IDLE, COMMIT_ERASE, COMMIT_WRITE, COMMIT_HEADER } commit_step_t;
         settings_t settings;
-        void read(settings_t *s);
+        settings_t _stored;          // the settings as stored in flash (including a commit in progress)
+        settings_t _commit;          // snapshot of the settings that are being committed
+        settings_t _checkpoint;      // the settings before a batch of changes, for rollback()
+        bool _stored_valid = false;  // false: the journal is empty, the next save writes all settings
+        bool _dirty = false;         // save() was called, commit() has not started the commit yet
+        commit_step_t _step = COMMIT_IDLE;
+        uint32_t _commit_mask = 0;   // fields that still need to be written, bit SETTINGS_COUNT is the version
+        bool _commit_first = true;   // the next record is the first of the transaction
+        bool _compact = false;       // the commit is a compaction
+        unsigned long _commit_start = 0, _commit_us = 0; // start of the commit [msec], sum of the flash operations [usec]
+        unsigned long _save_ms = 0, _max_stall_us = 0, _saves = 0; // save statistics
         void update_crc(void);
-        bool crc_is_valid(settings_t *s);
-        unsigned long crc32(const unsigned char *s, size_t n);
+        bool commit_start();
+        static double get(const settings_t *s, uint8_t field);
+        static void set(settings_t *s, uint8_t field, double value);
+        static void apply_record(uint8_t key, const uint8_t *data, uint8_t len);
     public:
+        static const setting_field_t FIELDS[SETTINGS_COUNT];
+        static int find(const char *key, size_t len); // field index of a key (or an alias), -1 if unknown
+
         DpSettings();
         void defaults();
         int load();
         int save();
+        void commit();                                     // background job: at most one flash operation per call
+        void flush() { while (is_saving()) commit(); }     // finish a queued save now (blocking)
+        bool is_saving() { return _dirty || _step != COMMIT_IDLE; }
+        unsigned long next_deadline() { return is_saving() ? 0 : TIME_NEVER; } // [msec], for the main loop scheduler
         void apply();
-        String serialize();
-        int deserialize(String input);
+        unsigned long saves() { return _saves; }           // number of saves written to flash
+        unsigned long save_time() { return _save_ms; }     // duration of the last save, from queued to committed [msec]
+        unsigned long flash_time() { return _commit_us; }  // sum of the flash operations of the last save [usec]
+        unsigned long max_stall() { return _max_stall_us; } // longest flash operation of a commit() call [usec]
+        unsigned long erases();                            // number of erased flash rows since startup
+        void serialize(Print &out);                        // write all settings as "key=value" lines
+        int deserialize(const char *input);
+        int deserialize(String input) { return deserialize(input.c_str()); }
+        int assign(const char *key, size_t len, const char *value); // one "key=value" (no save), field index or -1
+        void checkpoint() { _checkpoint = settings; }      // before a batch of assign(): remember the settings
+        void rollback() { settings = _checkpoint; }        // discard the batch (in RAM, no flash access)
+
+        // generic access by field index, the setter limits the value to the range of the field
+        double value(uint8_t field) { return get(&settings, field); }
+        double value(uint8_t field, double v) { set(&settings, field, limit(field, v)); return get(&settings, field); }
+        static double limit(uint8_t field, double v) { return min(FIELDS[field].max, max(v, FIELDS[field].min)); }
+
         double temperature() { return settings.temperature; }
-        double temperature(double t) { return settings.temperature = min(104.0, max(t, 0.0)); }
+        double temperature(double t) { return settings.temperature = limit(SETTING_temperature, t); }
         double preInfusionTime() { return settings.preInfusionTime; }
-        double preInfusionTime(double t) { return settings.preInfusionTime = min(60.0, max(t, 0.0)); }
+        double preInfusionTime(double t) { return settings.preInfusionTime = limit(SETTING_preInfusionTime, t); }
         double infusionTime() { return settings.infusionTime; }
-        double infusionTime(double t) { return settings.infusionTime = min(60.0, max(t, 0.0)); }
+        double infusionTime(double t) { return settings.infusionTime = limit(SETTING_infusionTime, t); }
         double extractionTime() { return settings.extractionTime; }
-        double extractionTime(double t) { return settings.extractionTime = min(60.0, max(t, 0.0)); }
+        double extractionTime(double t) { return settings.extractionTime = limit(SETTING_extractionTime, t); }
         double extractionWeight() { return settings.extractionWeight; }
-        double extractionWeight(double w) { return settings.extractionWeight = min(500.0, max(w, 1.0)); }
+        double extractionWeight(double w) { return settings.extractionWeight = limit(SETTING_extractionWeight, w); }
         double P() { return settings.p; }
-        double P(double p) { return settings.p = min(10.0, max(p, 0.0)); }
+        double P(double p) { return settings.p = limit(SETTING_p, p); }
         double I() { return settings.i; }
-        double I(double i) { return settings.i = min(20.0, max(i, 0.00)); }
+        double I(double i) { return settings.i = limit(SETTING_i, i); }
         double D() { return settings.d; }
-        double D(double d) { return settings.d = min(100.0, max(d, 0.0)); }
+        double D(double d) { return settings.d = limit(SETTING_d, d); }
         double ff_heat() { return settings.ff_heat; }
-        double ff_heat(double ff) { return settings.ff_heat = min(100.0, max(ff, 0.0)); }
+        double ff_heat(double ff) { return settings.ff_heat = limit(SETTING_ff_heat, ff); }
         double ff_ready() { return settings.ff_ready; }
-        double ff_ready(double ff) { return settings.ff_ready = min(100.0, max(ff, 0.0)); }
+        double ff_ready(double ff) { return settings.ff_ready = limit(SETTING_ff_ready, ff); }
         double ff_brew() { return settings.ff_brew; }
-        double ff_brew(double ff) { return settings.ff_brew = min(100.0, max(ff, 0.0)); }
+        double ff_brew(double ff) { return settings.ff_brew = limit(SETTING_ff_brew, ff); }
         double tareWeight() { return settings.tareWeight; }
-        double tareWeight(double t) { return settings.tareWeight = min(2000.0, max(t, -2000.0)); }
+        double tareWeight(double t) { return settings.tareWeight = limit(SETTING_tareWeight, t); }
         double trimWeight() { return settings.trimWeight; }
-        double trimWeight(double t) { return settings.trimWeight = min(10.0, max(t, -10.0)); }
+        double trimWeight(double t) { return settings.trimWeight = limit(SETTING_trimWeight, t); }
         int wifiMode() { return settings.wifiMode; }
-        int wifiMode(int state) { return settings.wifiMode = min(2, max(state, 0)); }
+        int wifiMode(int state) { return settings.wifiMode = limit(SETTING_wifiMode, state); }
         int shotCounter() { return settings.shotCounter; }
-        int shotCounter(int count) { return settings.shotCounter = min(INT32_MAX, max(count, 0)); }
+        int shotCounter(int count) { return settings.shotCounter = limit(SETTING_shotCounter, count); }
         int commissioningDone() { return settings.commissioningDone; }
-        int commissioningDone(int state) { return settings.commissioningDone = min(1, max(state, 0)); }
+        int commissioningDone(int state) { return settings.commissioningDone = limit(SETTING_commissioningDone, state); }
         int incShotCounter() { return settings.shotCounter += 1; }
         void zeroShotCounter() { settings.shotCounter = 0; }
         double sleepMinTemp() { return settings.sleepMinTemp; }
-        double sleepMinTemp(double temp) { return settings.sleepMinTemp = min(100.0, max(temp, 0.0)); }
+        double sleepMinTemp(double temp) { return settings.sleepMinTemp = limit(SETTING_sleepMinTemp, temp); }
+        double heatLag() { return settings.heatLag; }
+        double heatLag(double lag) { return settings.heatLag = limit(SETTING_heatLag, lag); }
+        int remoteControl() { return settings.remoteControl; }
+        int remoteControl(int on) { return settings.remoteControl = limit(SETTING_remoteControl, on); }
 };
 
 extern DpSettings settings;
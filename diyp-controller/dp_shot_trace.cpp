@@ -0,0 +1,128 @@
+/*
+  High resolution trace of a shot
+  (c) 2025 - diyPresso - CC-BY-NC
+*/
+#include "dp_shot_trace.h"
+#include "dp_varint.h"
+#include "dp_log.h"
+#include "dp_mqtt.h"
+#include "dp_wifi.h"
+#include "dp_boiler.h"
+#include "dp_brew.h"
+#include "dp_heater.h"
+#include "dp_reservoir.h"
+
+#define SHOT_TRACE_SAMPLE_MAX (5 * VARINT_MAX_SIZE) // max. encoded sample [bytes]
+
+ShotTrace shotTrace;
+
+void ShotTrace::start()
+{
+  if (_ready)
+    _dropped++; // the previous trace was not (completely) published
+  unsigned long epoch = wifi_time();
+  memset(&_header, 0, sizeof(_header));
+  _header.version = SHOT_TRACE_VERSION;
+  _header.flags = epoch ? SHOT_TRACE_FLAG_EPOCH : 0;
+  _header.period = SHOT_TRACE_PERIOD_MS;
+  _header.start = epoch ? epoch : millis() / 1000;
+  _len = sizeof(_header);
+  memset(_prev, 0, sizeof(_prev));
+  _last = millis();
+  _prev[0] = _last; // (the first sample has time 0)
+  _recording = true;
+  _ready = false;
+  sample();
+}
+
+void ShotTrace::sample()
+{
+  unsigned long start = micros();
+  if (_len + SHOT_TRACE_SAMPLE_MAX > sizeof(_buf))
+  {
+    if (brewProcess.state_id() != BrewProcess::SID_state_finished) // (the shot itself is complete)
+      _header.flags |= SHOT_TRACE_FLAG_TRUNCATED;
+    _recording = false;
+    return;
+  }
+  _last = millis();
+  int32_t s[5] = {
+    (int32_t)_last,
+    (int32_t)lround(100.0 * boilerController.act_temp()),
+    (int32_t)lround(10.0 * heaterDevice.power()),
+    (int32_t)lround(10.0 * reservoir.last_weight()),
+    brewProcess.state_id(),
+  };
+  _len += varint_encode(_buf + _len, sizeof(_buf) - _len, (uint32_t)(s[0] - _prev[0]));
+  for (uint8_t i = 1; i < 5; i++)
+    _len += varint_encode(_buf + _len, sizeof(_buf) - _len, zigzag_encode(s[i] - _prev[i]));
+  memcpy(_prev, s, sizeof(_prev));
+  _header.samples++;
+
+  unsigned long us = usec_since(start);
+  _samples++;
+  _sample_us += us;
+  _max_sample_us = max(_max_sample_us, us);
+}
+
+void ShotTrace::finish(uint32_t shot)
+{
+  _recording = false;
+  _header.shot = shot;
+  memcpy(_buf, &_header, sizeof(_header));
+  _size = _len;
+  _chunk = 0;
+  _chunks = (_len + SHOT_TRACE_CHUNK - 1) / SHOT_TRACE_CHUNK;
+  _ready = true;
+  LOG(SHOT_TRACE, (unsigned long)shot, (unsigned)_header.samples, (unsigned)_len);
+}
+
+void ShotTrace::publish_chunk()
+{
+  uint8_t msg[sizeof(uint32_t) + 2 + SHOT_TRACE_CHUNK];
+  uint16_t offset = _chunk * SHOT_TRACE_CHUNK;
+  uint16_t n = min((uint16_t)SHOT_TRACE_CHUNK, (uint16_t)(_len - offset));
+  memcpy(msg, &_header.shot, sizeof(uint32_t));
+  msg[4] = _chunk;
+  msg[5] = _chunks;
+  memcpy(msg + 6, _buf + offset, n);
+  _last_chunk = millis();
+  if (!mqttDevice.publish("shots", msg, 6 + n))
+    return; // the same chunk again in the next period
+  if (++_chunk >= _chunks) // (published when the last chunk is sent)
+  {
+    _ready = false;
+    _published++;
+  }
+}
+
+void ShotTrace::control()
+{
+  if (_recording)
+  {
+    uint8_t state = brewProcess.state_id();
+    if (state != BrewProcess::SID_state_pre_infuse && state != BrewProcess::SID_state_infuse &&
+        state != BrewProcess::SID_state_extract && state != BrewProcess::SID_state_finished)
+      _recording = false; // done or aborted: wait for finish()
+    else if (time_since(_last) >= SHOT_TRACE_PERIOD_MS)
+      sample();
+  }
+  if (_ready && mqttDevice.is_on() && time_since(_last_chunk) >= SHOT_TRACE_CHUNK_PERIOD_MS)
+    publish_chunk();
+}
+
+unsigned long ShotTrace::next_deadline()
+{
+  unsigned long next = TIME_NEVER;
+  if (_recording)
+  {
+    unsigned long dt = time_since(_last);
+    next = dt >= SHOT_TRACE_PERIOD_MS ? 0 : SHOT_TRACE_PERIOD_MS - dt;
+  }
+  if (_ready && mqttDevice.is_on())
+  {
+    unsigned long dt = time_since(_last_chunk);
+    next = min(next, dt >= SHOT_TRACE_CHUNK_PERIOD_MS ? 0 : SHOT_TRACE_CHUNK_PERIOD_MS - dt);
+  }
+  return next;
+}
@@ -0,0 +1,81 @@
+/*
+  High resolution trace of a shot: boiler temperature, heater power, reservoir weight and brew state at 10 Hz
+  (c) 2025 - diyPresso - CC-BY-NC
+
+  The shot history starts the trace when a shot starts (pre_infuse); control() then adds a sample every
+  SHOT_TRACE_PERIOD_MS while the brew process is in pre_infuse, infuse, extract or finished (the final weight settles
+  after the pump stops), as the shot history. The samples are encoded as they are taken, in a fixed RAM buffer: every
+  field as the difference with the previous sample, zigzag and varint encoded, so a sample is about 5 bytes and a 40
+  second shot about 2 kB. When the buffer is full the trace is cut off (flag, unless the shot was already finished).
+
+  When the shot history finishes the shot, the trace is published to MQTT, topic <topic>/shots, in chunks of at most
+  SHOT_TRACE_CHUNK bytes (one chunk per SHOT_TRACE_CHUNK_PERIOD_MS, a chunk that was not sent is sent again):
+
+    chunk:  shot (uint32), chunk index (uint8), chunk count (uint8), data
+    data:   header (shot_trace_header_t), samples
+    sample: varints: time since the previous sample [msec], zigzag deltas of temperature [0.01 degC],
+            power [0.1 %], reservoir weight [0.1 gram] and brew state id (the first sample relative to zero)
+
+  The host decoder is server/shot_trace.py.
+*/
+#ifndef SHOT_TRACE_H
+#define SHOT_TRACE_H
+
+#include <Arduino.h>
+#include "dp_time.h"
+
+#define SHOT_TRACE_PERIOD_MS 100        // sample period [msec]
+#define SHOT_TRACE_SIZE 3072            // trace buffer [bytes]: ~60 seconds
+#define SHOT_TRACE_CHUNK 384            // max. data bytes per MQTT message
+#define SHOT_TRACE_CHUNK_PERIOD_MS 100  // [msec]
+#define SHOT_TRACE_VERSION 1
+#define SHOT_TRACE_FLAG_TRUNCATED 0x01  // the buffer was full before the end of the shot
+#define SHOT_TRACE_FLAG_EPOCH 0x02      // start time is unix time (else uptime)
+
+typedef struct __attribute__((packed)) {
+  uint8_t version;
+  uint8_t flags;
+  uint16_t period;                      // sample period [msec]
+  uint32_t shot;                        // shot counter (as in the shot history)
+  uint32_t start;                       // start of the shot, unix time or uptime [sec]
+  uint16_t samples;
+  uint16_t reserved;
+} shot_trace_header_t;
+
+class ShotTrace
+{
+  private:
+    uint8_t _buf[SHOT_TRACE_SIZE];      // header and samples
+    uint16_t _len = 0;
+    shot_trace_header_t _header;
+    bool _recording = false, _ready = false; // taking samples, finished and waiting to be published
+    unsigned long _last = 0;            // millis() of the last sample
+    int32_t _prev[5];                   // previous sample: time, temp, power, weight, state
+    uint8_t _chunk = 0, _chunks = 0;    // next chunk to send, number of chunks
+    unsigned long _last_chunk = 0;
+
+    // statistics
+    unsigned long _samples = 0, _sample_us = 0, _max_sample_us = 0; // all samples, their total and longest time [usec]
+    unsigned long _published = 0, _dropped = 0; // traces sent, traces not sent (a new shot started first)
+    uint16_t _size = 0;                 // size of the last trace [bytes]
+
+    void sample();
+    void publish_chunk();
+
+  public:
+    void start();                       // a shot starts (from the shot history)
+    void finish(uint32_t shot);         // the shot is done: publish it
+    void control();                     // take the samples and publish the chunks, call from the main loop
+    unsigned long next_deadline();      // [msec]
+    bool is_recording() { return _recording; }
+    unsigned long samples() { return _samples; }
+    unsigned long sample_time() { return _samples ? _sample_us / _samples : 0; } // mean [usec]
+    unsigned long max_sample_time() { return _max_sample_us; }
+    uint16_t size() { return _size; }
+    unsigned long published() { return _published; }
+    unsigned long dropped() { return _dropped; }
+};
+
+extern ShotTrace shotTrace;
+
+#endif // SHOT_TRACE_H
@@ -0,0 +1,391 @@
+/*
+  Shot history: a record of every shot, kept in a ring of flash rows
+  (c) 2025 - diyPresso - CC-BY-NC
+*/
+#include "dp_shots.h"
+#include "dp_varint.h"
+#include "dp_crc.h"
+#include "dp_flash.h"
+#include "dp_brew.h"
+#include "dp_boiler.h"
+#include "dp_heater.h"
+#include "dp_reservoir.h"
+#include "dp_settings.h"
+#include "dp_wifi.h"
+#include "dp_mqtt.h"
+#include "dp_faults.h"
+#include "dp_shot_trace.h"
+
+// the flash area of the ring, at the end of the flash: it is kept when a new firmware is uploaded
+static_assert(SHOT_ROWS * SHOT_ROW_SIZE <= PERSIST_SHOTS_SIZE, "shot ring larger than its flash area");
+static_assert(SHOT_RECORD_MAX >= (1 + SHOT_FIELDS * VARINT_MAX_SIZE + 2 + 3) / 4 * 4, "SHOT_RECORD_MAX too small");
+static const uint8_t *const shots_area = (const uint8_t *)PERSIST_SHOTS;
+
+ShotHistory shotHistory;
+
+static uint32_t shots_exported = 0; // shot number of the last shot published to MQTT
+static int shots_sent;
+
+ShotHistory::ShotHistory() : _flash(shots_area, SHOT_ROWS * SHOT_ROW_SIZE)
+{
+  _area = shots_area;
+  memset(&_prev, 0, sizeof(_prev));
+}
+
+/*
+ * Recording
+ */
+
+void ShotHistory::start(unsigned long now)
+{
+  _recording = true;
+  _finished = false;
+  _state = BrewProcess::SID_state_pre_infuse;
+  _phase_start = _last_sample = now;
+  _duration[0] = _duration[1] = _duration[2] = 0;
+  _start_weight = _extract_weight = _end_weight = reservoir.weight();
+  _temp.reset();
+  _energy = 0.0;
+  shotTrace.start();
+}
+
+void ShotHistory::control()
+{
+  uint8_t state = brewProcess.state_id();
+  bool shot_state = state == BrewProcess::SID_state_pre_infuse || state == BrewProcess::SID_state_infuse ||
+                    state == BrewProcess::SID_state_extract || state == BrewProcess::SID_state_finished;
+  unsigned long now = millis();
+
+  if (!_recording)
+  {
+    if (state != BrewProcess::SID_state_pre_infuse)
+      return;
+    start(now);
+  }
+
+  // time weighted sample of the boiler temperature and the heater power
+  double dt = time_diff(now, _last_sample) / 1000.0; // [sec]
+  _last_sample = now;
+  _temp.add(boilerController.act_temp(), dt);
+  _energy += heaterDevice.power() * dt;
+
+  if (state == _state && shot_state)
+    return;
+
+  // phase change: add the time of the previous phase
+  if (_state != BrewProcess::SID_state_finished)
+    _duration[_state - BrewProcess::SID_state_pre_infuse] += time_diff(now, _phase_start);
+  if (_state == BrewProcess::SID_state_extract)
+    _end_weight = reservoir.weight();
+  if (state == BrewProcess::SID_state_extract && _state == BrewProcess::SID_state_infuse)
+    _extract_weight = reservoir.weight();
+  if (state == BrewProcess::SID_state_finished)
+    _finished = true;
+  _phase_start = now;
+  _state = state;
+
+  if (!shot_state)
+    finish();
+}
+
+void ShotHistory::finish()
+{
+  shot_record_t &r = _queued;
+  unsigned long epoch = wifi_time();
+  double extract = _duration[2] / 1000.0; // [sec]
+
+  _recording = false;
+  r.flags = (epoch ? SHOT_FLAG_EPOCH : 0) | (_finished ? 0 : SHOT_FLAG_ABORTED);
+  r.shot = settings.shotCounter();
+  r.time = epoch ? epoch : millis() / 1000;
+  r.pre_infuse = min(_duration[0] / 100, 0xFFFFUL);
+  r.infuse = min(_duration[1] / 100, 0xFFFFUL);
+  r.extract = min(_duration[2] / 100, 0xFFFFUL);
+  r.start_weight = lround(10.0 * _start_weight);
+  r.end_weight = lround(10.0 * _end_weight);
+  r.flow = (extract > 0.0) ? constrain(lround(100.0 * (_extract_weight - _end_weight) / extract), 0, 0xFFFF) : 0;
+  r.temp_mean = lround(10.0 * _temp.mean());
+  r.temp_min = lround(10.0 * _temp.min_value());
+  r.temp_max = lround(10.0 * _temp.max_value());
+  r.temp_sd = min(lround(100.0 * _temp.stddev()), 0xFFFFL);
+  r.energy = lround(max(_energy, 0.0));
+  _pending = true; // (a shot that is still queued is replaced)
+  shotTrace.finish(r.shot);
+}
+
+/*
+ * Record encoding
+ */
+
+// payload: varints, most fields as the difference with the previous record, followed by a 16 bit CRC
+uint8_t ShotHistory::encode(uint8_t *buf, const shot_record_t &r, const shot_record_t &prev)
+{
+  uint32_t fields[SHOT_FIELDS] = {
+    r.flags,
+    zigzag_encode(r.shot - prev.shot),
+    zigzag_encode(r.time - prev.time),
+    r.pre_infuse, r.infuse, r.extract,
+    zigzag_encode(r.start_weight - prev.start_weight),
+    zigzag_encode(r.start_weight - r.end_weight),
+    r.flow,
+    zigzag_encode(r.temp_mean - prev.temp_mean),
+    (uint32_t)max(r.temp_mean - r.temp_min, 0),
+    (uint32_t)max(r.temp_max - r.temp_mean, 0),
+    r.energy,
+    r.temp_sd,                  // (added later: optional when decoding)
+  };
+  uint8_t n = 1; // buf[0] is the length of the payload
+  for (uint8_t i = 0; i < SHOT_FIELDS; i++)
+  {
+    uint8_t len = varint_encode(buf + n, SHOT_RECORD_MAX - 2 - n, fields[i]);
+    if (!len)
+      return 0; // does not fit (not with SHOT_RECORD_MAX, see the static_assert)
+    n += len;
+  }
+  buf[0] = n - 1;
+  uint16_t crc = crc32(buf, n);
+  buf[n++] = crc & 0xFF;
+  buf[n++] = crc >> 8;
+  while (n % 4)
+    buf[n++] = 0xFF;
+  return n;
+}
+
+// decode the record at buf (at most size bytes), false if it is not valid
+bool ShotHistory::decode(const uint8_t *buf, uint8_t size, shot_record_t *r, const shot_record_t &prev)
+{
+  uint8_t len = buf[0];
+  if (len == 0 || len + 3 > size)
+    return false;
+  uint16_t crc = crc32(buf, len + 1);
+  if (buf[len + 1] != (crc & 0xFF) || buf[len + 2] != (crc >> 8))
+    return false;
+
+  uint32_t fields[SHOT_FIELDS] = { 0 };
+  uint8_t pos = 1;
+  for (uint8_t i = 0; i < sizeof(fields) / sizeof(fields[0]); i++)
+  {
+    if (i == 13 && pos == len + 1) // a record without the temperature deviation
+      break;
+    uint8_t n = varint_decode(buf + pos, len + 1 - pos, &fields[i]);
+    if (!n)
+      return false;
+    pos += n;
+  }
+  r->flags = fields[0];
+  r->shot = prev.shot + zigzag_decode(fields[1]);
+  r->time = prev.time + zigzag_decode(fields[2]);
+  r->pre_infuse = fields[3];
+  r->infuse = fields[4];
+  r->extract = fields[5];
+  r->start_weight = prev.start_weight + zigzag_decode(fields[6]);
+  r->end_weight = r->start_weight - zigzag_decode(fields[7]);
+  r->flow = fields[8];
+  r->temp_mean = prev.temp_mean + zigzag_decode(fields[9]);
+  r->temp_min = r->temp_mean - fields[10];
+  r->temp_max = r->temp_mean + fields[11];
+  r->energy = fields[12];
+  r->temp_sd = fields[13];
+  return true;
+}
+
+/*
+ * Flash ring
+ */
+
+// sequence number of a row, 0 = not valid (an erased row reads 0xFF)
+uint32_t ShotHistory::row_seq(const uint8_t *row)
+{
+  uint32_t seq;
+  memcpy(&seq, row, sizeof(seq));
+  return (seq == 0xFFFFFFFF) ? 0 : seq;
+}
+
+// walk the records of a row, returns the offset of the first free byte
+// last: the last record of the row, callback: called for each record after skipping `*skip` records
+uint16_t ShotHistory::scan_row(int8_t r, shot_record_t *last, shot_callback_t callback, int *skip)
+{
+  const uint8_t *p = row(r);
+  uint16_t pos = sizeof(uint32_t);
+  shot_record_t rec;
+  memset(last, 0, sizeof(*last));
+  while (pos < SHOT_ROW_SIZE && p[pos] != 0xFF)
+  {
+    if (!decode(p + pos, SHOT_ROW_SIZE - pos, &rec, *last))
+      return SHOT_ROW_SIZE; // damaged: the rest of the row is not used
+    *last = rec;
+    pos += (p[pos] + 3 + 3) & ~3;
+    if (callback && skip && (*skip)-- <= 0)
+      callback(rec);
+  }
+  return pos;
+}
+
+void ShotHistory::begin()
+{
+  _row = -1;
+  if (!persist_flash_ok()) // the image overlaps the ring (stock linker script)
+    return;
+  for (int8_t r = 0; r < SHOT_ROWS; r++)
+  {
+    uint32_t seq = row_seq(row(r));
+    if (seq && (_row < 0 || (int32_t)(seq - _row_seq) > 0)) // newest row, wrap-around safe
+    {
+      _row = r;
+      _row_seq = seq;
+    }
+  }
+  if (_row >= 0)
+  {
+    _pos = scan_row(_row, &_prev, NULL, NULL);
+    shots_exported = _prev.shot; // shots that were stored before the reset are not published again
+  }
+}
+
+void ShotHistory::for_each(int skip, shot_callback_t callback)
+{
+  shot_record_t last;
+  if (_row < 0)
+    return;
+  for (int8_t i = 1; i <= SHOT_ROWS; i++) // oldest row first: the one after the current row
+  {
+    int8_t r = (_row + i) % SHOT_ROWS;
+    if (row_seq(row(r)))
+      scan_row(r, &last, callback, &skip);
+  }
+}
+
+static int shots_counted;
+static void count_shot(const shot_record_t &) { shots_counted++; }
+
+int ShotHistory::count()
+{
+  shots_counted = 0;
+  for_each(0, count_shot);
+  return shots_counted;
+}
+
+void ShotHistory::commit_start()
+{
+  bool new_row = (_row < 0);
+  if (!new_row)
+  {
+    _len = encode(_buf, _queued, _prev);
+    new_row = (_pos + _len > SHOT_ROW_SIZE);
+  }
+  if (new_row)
+  {
+    shot_record_t zero;
+    memset(&zero, 0, sizeof(zero));
+    _len = encode(_buf, _queued, zero);
+  }
+  _written = 0;
+  _pending = false;
+  _step = !_len ? COMMIT_IDLE : new_row ? COMMIT_ERASE : COMMIT_WRITE; // (_len 0: not encoded, dropped)
+}
+
+void ShotHistory::commit()
+{
+  if (_step == COMMIT_IDLE)
+  {
+    if (!_pending || settings.is_saving() || faultLog.is_writing()) // one flash user at a time
+      return;
+    if (!persist_flash_ok())
+    {
+      _pending = false; // not stored
+      return;
+    }
+    commit_start();
+    if (_step == COMMIT_IDLE)
+      return;
+  }
+
+  unsigned long start = micros();
+  switch (_step)
+  {
+  case COMMIT_ERASE: // the next row of the ring (the oldest one)
+    _row = (_row + 1) % SHOT_ROWS;
+    _flash.erase(row(_row), SHOT_ROW_SIZE);
+    _step = COMMIT_HEADER;
+    break;
+  case COMMIT_HEADER:
+  {
+    uint32_t seq = _row_seq + 1;
+    if (seq == 0xFFFFFFFF || seq == 0)
+      seq = 1;
+    _flash.write(row(_row), &seq, sizeof(seq));
+    _row_seq = seq;
+    _pos = sizeof(uint32_t);
+    _step = COMMIT_WRITE;
+    break;
+  }
+  case COMMIT_WRITE:
+  {
+    // one write per flash page: a record may cross a page boundary
+    uint16_t pos = _pos + _written;
+    uint8_t n = min(_len - _written, SHOT_PAGE_SIZE - pos % SHOT_PAGE_SIZE);
+    _flash.write(row(_row) + pos, _buf + _written, n);
+    _written += n;
+    if (_written >= _len)
+    {
+      _pos += _len;
+      _prev = _queued;
+      _step = COMMIT_IDLE;
+    }
+    break;
+  }
+  default:
+    _step = COMMIT_IDLE;
+  }
+  _max_stall_us = max(_max_stall_us, usec_since(start));
+}
+
+/*
+ * Output
+ */
+
+int ShotHistory::format(char *buf, size_t len, const shot_record_t &s)
+{
+  return snprintf(buf, len,
+                  "shot=%lu,time=%lu,%s%spre=%u.%u,infuse=%u.%u,extract=%u.%u,start=%ld.%ld,end=%ld.%ld,flow=%u.%02u,"
+                  "temp=%d.%d,min=%d.%d,max=%d.%d,sd=%u.%02u,energy=%lu",
+                  (unsigned long)s.shot, (unsigned long)s.time, (s.flags & SHOT_FLAG_EPOCH) ? "" : "uptime=1,",
+                  (s.flags & SHOT_FLAG_ABORTED) ? "aborted=1," : "",
+                  s.pre_infuse / 10, s.pre_infuse % 10, s.infuse / 10, s.infuse % 10, s.extract / 10, s.extract % 10,
+                  (long)s.start_weight / 10, labs(s.start_weight % 10), (long)s.end_weight / 10, labs(s.end_weight % 10),
+                  s.flow / 100, s.flow % 100,
+                  s.temp_mean / 10, abs(s.temp_mean % 10), s.temp_min / 10, abs(s.temp_min % 10),
+                  s.temp_max / 10, abs(s.temp_max % 10), s.temp_sd / 100, s.temp_sd % 100, (unsigned long)s.energy);
+}
+
+static void publish_shot(const shot_record_t &s)
+{
+  if ((int32_t)(s.shot - shots_exported) <= 0 || shots_sent >= SHOT_EXPORT_BATCH)
+    return;
+  mqttDevice.measurement("shot");
+  mqttDevice.write("shot", (long)s.shot);
+  mqttDevice.write("time", (long)s.time);
+  mqttDevice.write("flags", (long)s.flags);
+  mqttDevice.write("pre", s.pre_infuse / 10.0);
+  mqttDevice.write("infuse", s.infuse / 10.0);
+  mqttDevice.write("extract", s.extract / 10.0);
+  mqttDevice.write("w_start", s.start_weight / 10.0);
+  mqttDevice.write("w_end", s.end_weight / 10.0);
+  mqttDevice.write("flow", s.flow / 100.0);
+  mqttDevice.write("t_mean", s.temp_mean / 10.0);
+  mqttDevice.write("t_min", s.temp_min / 10.0);
+  mqttDevice.write("t_max", s.temp_max / 10.0);
+  mqttDevice.write("t_sd", s.temp_sd / 100.0);
+  mqttDevice.write("energy", (long)s.energy);
+  mqttDevice.send();
+  shots_exported = s.shot;
+  shots_sent++;
+}
+
+void ShotHistory::publish()
+{
+  if (!mqttDevice.is_on() || _row < 0 || (int32_t)(_prev.shot - shots_exported) <= 0)
+    return;
+  shots_sent = 0;
+  for_each(0, publish_shot);
+}
@@ -0,0 +1,100 @@
+/*
+  Shot history: a record of every shot, kept in a ring of flash rows
+  (c) 2025 - diyPresso - CC-BY-NC
+
+  control() follows the brew process: a shot starts when the brew process enters pre_infuse, and ends when it leaves
+  the shot states (pre_infuse, infuse, extract, finished). During the shot the boiler temperature and the heater power
+  are integrated (the temperature statistics are weighted with the time of each sample), at the end a record is queued and written to flash by commit() (one flash operation per call).
+
+  Flash layout: SHOT_ROWS rows of 256 bytes, used as a ring. A row starts with a 32 bit sequence number, followed by
+  records: [length] [payload] [CRC-16], padded to 4 bytes. The payload is varint encoded, most fields as the difference
+  with the previous record in the same row (the first record of a row is relative to zero), so a record is about
+  24 bytes: ~10 shots per row, ~300 shots in total. When the ring is full, the oldest row is erased.
+*/
+#ifndef SHOTS_H
+#define SHOTS_H
+
+#include <Arduino.h>
+#include <FlashStorage.h>
+#include "dp_time.h"
+#include "dp_stats.h"
+
+#define SHOT_ROWS 32            // flash rows of the ring (8 kB)
+#define SHOT_ROW_SIZE 256       // [bytes]
+#define SHOT_PAGE_SIZE 64       // flash write unit [bytes]
+#define SHOT_FIELDS 14          // varint fields of a record
+#define SHOT_RECORD_MAX 76      // max. encoded record size: length, SHOT_FIELDS * 5 (longest varint), CRC, padding [bytes]
+#define SHOT_EXPORT_BATCH 4     // max. number of shots per publish() call
+
+#define SHOT_FLAG_EPOCH 0x01    // time is unix time (else uptime)
+#define SHOT_FLAG_ABORTED 0x02  // the shot did not reach the finished state
+
+typedef struct {
+  uint8_t flags;
+  uint32_t shot;                // shot counter
+  uint32_t time;                // end of the shot, unix time or uptime [sec]
+  uint16_t pre_infuse, infuse, extract; // durations [0.1 sec]
+  int32_t start_weight, end_weight;     // reservoir weight at the start and end of the shot [0.1 gram]
+  uint16_t flow;                // mean flow during extraction [0.01 gram/sec]
+  int16_t temp_min, temp_max, temp_mean; // boiler temperature during the shot [0.1 degC]
+  uint16_t temp_sd;             // standard deviation of the boiler temperature [0.01 degC] (0 in older records)
+  uint32_t energy;              // heater energy [%.sec], 100 = 1 sec at full power
+} shot_record_t;
+
+typedef void (*shot_callback_t)(const shot_record_t &shot);
+
+class ShotHistory
+{
+  private:
+    typedef enum { COMMIT_IDLE, COMMIT_ERASE, COMMIT_HEADER, COMMIT_WRITE } commit_step_t;
+
+    // recording of the current shot
+    bool _recording = false;
+    uint8_t _state = 0;                    // brew state at the last sample
+    unsigned long _phase_start = 0, _last_sample = 0;
+    unsigned long _duration[3];            // pre-infuse, infuse, extract [msec]
+    bool _finished = false;
+    double _start_weight, _extract_weight, _end_weight;
+    RunningStats _temp;                    // boiler temperature, time weighted
+    double _energy;                        // heater power integrated over time [%.sec]
+
+    // flash ring
+    FlashClass _flash;
+    const uint8_t *_area;
+    int8_t _row = -1;                      // current row, -1 = none
+    uint32_t _row_seq = 0;                 // sequence number of the current row
+    uint16_t _pos = 0;                     // next free byte in the current row
+    shot_record_t _prev;                   // previous record in the current row (delta encoding base)
+    shot_record_t _queued;                 // record waiting to be written
+    bool _pending = false;
+    commit_step_t _step = COMMIT_IDLE;
+    uint8_t _buf[SHOT_RECORD_MAX];         // encoded record being written
+    uint8_t _len = 0, _written = 0;        // size of the encoded record, bytes written so far
+    unsigned long _max_stall_us = 0;
+
+    void start(unsigned long now);
+    void finish();
+    const uint8_t *row(int8_t r) { return _area + r * SHOT_ROW_SIZE; }
+    static uint32_t row_seq(const uint8_t *row);
+    static uint8_t encode(uint8_t *buf, const shot_record_t &r, const shot_record_t &prev);
+    static bool decode(const uint8_t *buf, uint8_t size, shot_record_t *r, const shot_record_t &prev);
+    uint16_t scan_row(int8_t r, shot_record_t *last, shot_callback_t callback, int *skip); // returns the end of the records
+    void commit_start();
+
+  public:
+    ShotHistory();
+    void begin();                          // find the current row in flash
+    void control();                        // follow the brew process, call from the main loop
+    void commit();                         // background flash writer: at most one flash operation per call
+    bool is_writing() { return _step != COMMIT_IDLE; } // a record is being written
+    unsigned long next_deadline() { return (_pending || is_writing()) ? 0 : TIME_NEVER; } // [msec]
+    int count();                           // number of stored shots
+    void for_each(int skip, shot_callback_t callback); // all stored shots, oldest first, after skipping `skip` shots
+    void publish();                        // send the shots that are not yet sent to MQTT (max. SHOT_EXPORT_BATCH per call)
+    static int format(char *buf, size_t len, const shot_record_t &shot); // text format (key=value list)
+    unsigned long max_stall() { return _max_stall_us; } // longest flash operation [usec]
+};
+
+extern ShotHistory shotHistory;
+
+#endif // SHOTS_H
@@ -0,0 +1,98 @@
+/*
+  Store-and-forward of the MQTT state samples while offline
+  (c) 2025 - diyPresso - CC-BY-NC
+*/
+#include "dp_spool.h"
+#include "dp_time.h"
+#include "dp_mqtt.h"
+#include "dp_wifi.h"
+#include "dp_boiler.h"
+#include "dp_brew.h"
+#include "dp_heater.h"
+#include "dp_reservoir.h"
+#include "dp_settings.h"
+
+Spool spool;
+
+static int16_t scaled(double value, double scale)
+{
+  return constrain(lround(value * scale), INT16_MIN, INT16_MAX);
+}
+
+void Spool::store()
+{
+  if (_stored && time_since(_last) < SPOOL_PERIOD_MS)
+    return;
+  _last = millis();
+  uint8_t next = (_head + 1) & (SPOOL_SIZE - 1);
+  if (next == _tail) // full: drop the oldest
+  {
+    _tail = (_tail + 1) & (SPOOL_SIZE - 1);
+    _dropped++;
+  }
+  spool_record_t &r = _ring[_head];
+  r.time = millis();
+  r.t_set = scaled(boilerController.set_temp(), 100.0);
+  r.t_act = scaled(boilerController.act_temp(), 100.0);
+  r.h_pwr = scaled(heaterDevice.power(), 100.0);
+  r.h_avg = scaled(heaterDevice.average(), 100.0);
+  r.r_wgt = scaled(reservoir.last_weight(), 10.0);
+  r.w_cur = scaled(brewProcess.weight(), 10.0);
+  r.w_end = scaled(brewProcess.end_weight(), 10.0);
+  r.shots = settings.shotCounter();
+  r.boil = boilerController.state_id();
+  r.brew = brewProcess.state_id();
+  r.errors = (boilerController.is_error() ? 0x01 : 0) | (brewProcess.is_error() ? 0x02 : 0) | (reservoir.is_error() ? 0x04 : 0);
+  r.reserved = 0;
+  _head = next;
+  _stored++;
+}
+
+// the same fields as send_state(), with the time of the sample
+bool Spool::send(const spool_record_t &r, unsigned long unix_time)
+{
+  double weight = r.r_wgt / 10.0;
+  mqttDevice.write("t_set", r.t_set / 100.0);
+  mqttDevice.write("t_act", r.t_act / 100.0);
+  mqttDevice.write("h_pwr", r.h_pwr / 100.0);
+  mqttDevice.write("h_avg", r.h_avg / 100.0);
+  mqttDevice.write("r_lvl", max(0.0, min(100.0 * weight / RESERVOIR_CAPACITY, 100.0)));
+  mqttDevice.write("r_wgt", weight);
+  mqttDevice.write("w_cur", r.w_cur / 10.0);
+  mqttDevice.write("w_end", r.w_end / 10.0);
+  mqttDevice.write("shots", (long)r.shots);
+  mqttDevice.write("boil", (char *)boilerController.state_name(r.boil));
+  mqttDevice.write("brew", (char *)brewProcess.state_name(r.brew));
+  mqttDevice.write("errors", (long)r.errors);
+  mqttDevice.timestamp(unix_time);
+  return mqttDevice.send() != 0;
+}
+
+void Spool::drain()
+{
+  if (_tail == _head || !mqttDevice.is_on())
+    return;
+  unsigned long now = wifi_time(); // [sec]
+  if (!now)
+    return;
+
+  unsigned long start = micros();
+  if (!_drain_count)
+    _drain_start = millis();
+  for (int i = 0; i < SPOOL_BATCH && _tail != _head; i++)
+  {
+    const spool_record_t &r = _ring[_tail];
+    if (!send(r, now - time_since(r.time) / 1000))
+      break; // try again in the next run
+    _tail = (_tail + 1) & (SPOOL_SIZE - 1);
+    _drained++;
+    _drain_count++;
+  }
+  _max_batch_us = max(_max_batch_us, usec_since(start));
+
+  if (_tail == _head) // drain complete
+  {
+    _drain_rate = _drain_count * 1000.0 / (time_since(_drain_start) + SPOOL_DRAIN_PERIOD_MS);
+    _drain_count = 0;
+  }
+}
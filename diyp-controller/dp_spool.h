@@ -0,0 +1,66 @@
+/*
+  Store-and-forward of the MQTT state samples while offline
+  (c) 2025 - diyPresso - CC-BY-NC
+
+  While MQTT is not connected, send_state() stores a sample in a RAM ring (store(), at most one per SPOOL_PERIOD_MS)
+  instead of losing it. When the connection is back, the drain task sends the stored samples in batches of
+  SPOOL_BATCH every SPOOL_DRAIN_PERIOD_MS, with their original time as the influxDB timestamp, so the gap is filled in. The drain rate is limited so the live
+  samples (and the control loop) keep priority. When the ring is full the oldest sample is dropped.
+
+  The samples have a millis() time; the unix time is calculated when they are sent, from the time of the WiFi module
+  (the ring is not drained before the module has the time). A sample is 24 bytes, the ring holds SPOOL_SIZE samples
+  (about 10 minutes at one sample per 5 seconds).
+  Note: no spill to flash: the flash is shared with the settings, shot history and fault log writers, and a flash
+  write stalls the CPU, which is not worth it for telemetry.
+*/
+#ifndef SPOOL_H
+#define SPOOL_H
+
+#include <Arduino.h>
+
+#define SPOOL_SIZE 128              // samples in the ring (power of 2)
+#define SPOOL_BATCH 4               // max. samples sent per drain run
+#define SPOOL_DRAIN_PERIOD_MS 1000  // drain task period [msec]
+#define SPOOL_PERIOD_MS 5000        // min. time between two stored samples [msec]
+
+static_assert((SPOOL_SIZE & (SPOOL_SIZE - 1)) == 0, "SPOOL_SIZE must be a power of 2");
+
+typedef struct {
+  uint32_t time;                    // millis()
+  int16_t t_set, t_act;             // boiler temperature [0.01 degC]
+  int16_t h_pwr, h_avg;             // heater power [0.01 %]
+  int16_t r_wgt;                    // reservoir weight [0.1 gram]
+  int16_t w_cur, w_end;             // brew weight [0.1 gram]
+  uint16_t shots;
+  uint8_t boil, brew;               // state ids
+  uint8_t errors;                   // bit 0: boiler, bit 1: brew, bit 2: reservoir
+  uint8_t reserved;
+} spool_record_t;
+
+class Spool
+{
+  private:
+    spool_record_t _ring[SPOOL_SIZE];
+    uint8_t _head = 0, _tail = 0;   // write and read index
+    unsigned long _stored = 0, _dropped = 0, _drained = 0;
+    unsigned long _drain_start = 0, _drain_count = 0; // current drain: millis() of the first batch, samples sent
+    double _drain_rate = 0.0;       // samples per second of the last complete drain
+    unsigned long _max_batch_us = 0;
+    unsigned long _last = 0;        // millis() of the last stored sample
+
+    bool send(const spool_record_t &r, unsigned long unix_time);
+
+  public:
+    void store();                   // store a sample of the state (call instead of sending it)
+    void drain();                   // send a batch of stored samples when MQTT is connected (task)
+    int count() { return (_head - _tail) & (SPOOL_SIZE - 1); }
+    unsigned long stored() { return _stored; }
+    unsigned long dropped() { return _dropped; } // samples lost because the ring was full
+    unsigned long drained() { return _drained; }
+    double drain_rate() { return _drain_rate; }
+    unsigned long max_batch_time() { return _max_batch_us; } // [usec]
+};
+
+extern Spool spool;
+
+#endif // SPOOL_H
@@ -0,0 +1,62 @@
+/*
+  Running statistics (Welford) and the windowed aggregates of the telemetry
+  (c) 2025 - diyPresso - CC-BY-NC
+*/
+#include "dp_stats.h"
+#include "dp_mqtt.h"
+#include "dp_boiler.h"
+#include "dp_heater.h"
+#include "dp_reservoir.h"
+
+#define STATS_NAME_OF(name, expr, deadband) #name,
+#define STATS_DEADBAND_OF(name, expr, deadband) deadband,
+static const char *const STATS_NAMES[] = { STATS_FIELDS(STATS_NAME_OF) };
+static const float STATS_DEADBANDS[] = { STATS_FIELDS(STATS_DEADBAND_OF) };
+
+WindowStats windowStats;
+
+const char *WindowStats::field_name(uint8_t field)
+{
+  return field < STATS_FIELD_COUNT ? STATS_NAMES[field] : "-";
+}
+
+#define STATS_SAMPLE(name, expr, deadband) _window[STATS_##name].add(expr);
+
+void WindowStats::sample()
+{
+  STATS_FIELDS(STATS_SAMPLE)
+}
+
+void WindowStats::publish()
+{
+  bool active = false;
+  for (uint8_t f = 0; f < STATS_FIELD_COUNT; f++)
+  {
+    _last[f] = _window[f];
+    _window[f].reset();
+    if (_last[f].max_value() - _last[f].min_value() >= STATS_DEADBANDS[f])
+      active = true;
+  }
+  _windows++;
+  if (!active || !mqttDevice.is_on())
+    return;
+
+  char name[16];
+  mqttDevice.measurement("stats");
+  for (uint8_t f = 0; f < STATS_FIELD_COUNT; f++)
+  {
+    RunningStats &s = _last[f];
+    if (!s.count())
+      continue;
+    snprintf(name, sizeof(name), "%s_min", STATS_NAMES[f]);
+    mqttDevice.write(name, s.min_value());
+    snprintf(name, sizeof(name), "%s_max", STATS_NAMES[f]);
+    mqttDevice.write(name, s.max_value());
+    snprintf(name, sizeof(name), "%s_mean", STATS_NAMES[f]);
+    mqttDevice.write(name, s.mean());
+    snprintf(name, sizeof(name), "%s_sd", STATS_NAMES[f]);
+    mqttDevice.write(name, s.stddev());
+  }
+  if (mqttDevice.send())
+    _published++;
+}
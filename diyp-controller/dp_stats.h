@@ -0,0 +1,76 @@
+/*
+  Running statistics (Welford) and the windowed aggregates of the telemetry
+  (c) 2025 - diyPresso - CC-BY-NC
+
+  RunningStats keeps the count, min, max, mean and variance of a series in O(1) memory, updated per sample with
+  Welford's method (numerically stable, no sum of squares). Samples can have a weight, e.g. the time they represent.
+
+  WindowStats samples the fast telemetry fields (STATS_FIELDS) every STATS_SAMPLE_PERIOD_MS and publishes their
+  aggregates per window of STATS_WINDOW_MS to MQTT (measurement "stats": <field>_min, _max, _mean, _sd), so the
+  dips and peaks between two state messages are not lost. A window in which every field stayed within its deadband
+  is not published (nothing happened that the state messages do not show). The last window is kept for GET perf.
+*/
+#ifndef STATS_H
+#define STATS_H
+
+#include <Arduino.h>
+
+#define STATS_SAMPLE_PERIOD_MS 100  // [msec]
+#define STATS_WINDOW_MS 10000       // [msec]
+
+class RunningStats
+{
+  private:
+    unsigned long _count = 0;
+    double _weight = 0.0, _mean = 0.0, _m2 = 0.0, _min = 0.0, _max = 0.0;
+
+  public:
+    void reset() { _count = 0; _weight = _mean = _m2 = 0.0; }
+    void add(double x, double weight = 1.0)
+    {
+      if (!_count++)
+        _min = _max = _mean = x;
+      _min = min(_min, x);
+      _max = max(_max, x);
+      if (weight <= 0.0)
+        return;
+      _weight += weight;
+      double delta = x - _mean;
+      _mean += delta * weight / _weight;
+      _m2 += weight * delta * (x - _mean);
+    }
+    unsigned long count() { return _count; }
+    double min_value() { return _min; }
+    double max_value() { return _max; }
+    double mean() { return _mean; }
+    double variance() { return _weight > 0.0 ? _m2 / _weight : 0.0; } // (of the population)
+    double stddev() { return sqrt(variance()); }
+};
+
+// F(name, expression, deadband)
+#define STATS_FIELDS(F) \
+  F(t_act, boilerController.act_temp(), 0.2) \
+  F(h_pwr, heaterDevice.power(),        2.0) \
+  F(r_wgt, reservoir.last_weight(),     2.0)
+
+#define STATS_FIELD_ID(name, expr, deadband) STATS_##name,
+typedef enum : uint8_t { STATS_FIELDS(STATS_FIELD_ID) STATS_FIELD_COUNT } stats_field_t;
+
+class WindowStats
+{
+  private:
+    RunningStats _window[STATS_FIELD_COUNT], _last[STATS_FIELD_COUNT]; // current and last complete window
+    unsigned long _windows = 0, _published = 0;
+
+  public:
+    void sample();                  // add a sample of every field (task, every STATS_SAMPLE_PERIOD_MS)
+    void publish();                 // close the window: publish the aggregates and start a new window (task)
+    RunningStats &last(uint8_t field) { return _last[field]; }
+    static const char *field_name(uint8_t field);
+    unsigned long windows() { return _windows; }
+    unsigned long published() { return _published; }
+};
+
+extern WindowStats windowStats;
+
+#endif // STATS_H
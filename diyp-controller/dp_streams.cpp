@@ -0,0 +1,308 @@
+/*
+  Telemetry streams: subscriptions to a set of fields at a rate, on the serial port or MQTT
+  (c) 2025 - diyPresso - CC-BY-NC
+*/
+#include "dp_streams.h"
+#include "dp_telemetry.h"
+#include "dp_mqtt.h"
+#include "dp_boiler.h"
+#include "dp_brew.h"
+#include "dp_heater.h"
+#include "dp_reservoir.h"
+#include "dp_settings.h"
+
+#define STREAM_NAME_OF(name, type, expr) #name,
+#define STREAM_TYPE_OF(name, type, expr) type,
+static const char *const STREAM_NAMES[] = { STREAM_FIELDS(STREAM_NAME_OF) };
+static const stream_type_t STREAM_TYPES[] = { STREAM_FIELDS(STREAM_TYPE_OF) };
+
+#define STREAM_LINE_SIZE 256 // max. length of a text sample on serial [bytes]
+
+static_assert(STREAM_FIELD_COUNT <= 16, "the field mask of a binary sample is 16 bits");
+
+Streams streams;
+
+const char *Streams::field_name(uint8_t field)
+{
+  return field < STREAM_FIELD_COUNT ? STREAM_NAMES[field] : "-";
+}
+
+void Streams::describe(Print &out, const stream_t &s)
+{
+  bool first = true;
+  for (uint8_t f = 0; f < STREAM_FIELD_COUNT; f++)
+    if (s.fields & (1UL << f))
+    {
+      if (!first)
+        out.print(',');
+      out.print(STREAM_NAMES[f]);
+      first = false;
+    }
+  out.print(' ');
+  out.print(1000.0 / s.period, 2);
+  out.print(s.binary ? " binary" : " text");
+  out.print(s.sink == STREAM_MQTT ? " mqtt" : " serial");
+}
+
+// "name,name,..." or "*", returns the field mask (0 if a name is unknown)
+uint32_t Streams::parse_fields(const char *list, size_t len)
+{
+  if (len == 1 && *list == '*')
+    return (1UL << STREAM_FIELD_COUNT) - 1;
+  uint32_t mask = 0;
+  while (len)
+  {
+    const char *comma = (const char *)memchr(list, ',', len);
+    size_t n = comma ? (size_t)(comma - list) : len;
+    uint8_t f = 0;
+    while (f < STREAM_FIELD_COUNT && !(strlen(STREAM_NAMES[f]) == n && strncmp(STREAM_NAMES[f], list, n) == 0))
+      f++;
+    if (f == STREAM_FIELD_COUNT)
+      return 0;
+    mask |= 1UL << f;
+    list += comma ? n + 1 : n;
+    len -= comma ? n + 1 : n;
+  }
+  return mask;
+}
+
+// args: <fields> <rate> [text|binary]
+int Streams::subscribe(const char *args, stream_sink_t sink)
+{
+  const char *space = strchr(args, ' ');
+  if (!space)
+    return -1;
+  uint32_t fields = parse_fields(args, space - args);
+  double rate = atof(space + 1);
+  if (!fields || rate <= 0.0)
+    return -1;
+  rate = min(rate, sink == STREAM_MQTT ? (double)STREAMS_MQTT_MAX_RATE : (double)STREAMS_MAX_RATE);
+
+  if (sink == STREAM_MQTT)
+  {
+    uint8_t count = 0;
+    for (uint8_t id = 0; id < STREAMS_MAX; id++)
+      count += _streams[id].active && _streams[id].sink == STREAM_MQTT;
+    if (count >= STREAMS_MQTT_MAX)
+      return -2;
+  }
+
+  for (uint8_t id = 0; id < STREAMS_MAX; id++)
+  {
+    stream_t &s = _streams[id];
+    if (s.active)
+      continue;
+    memset(&s, 0, sizeof(s));
+    s.sink = sink;
+    s.binary = strstr(space, "binary") != NULL;
+    s.fields = fields;
+    s.period = lround(1000.0 / rate);
+    s.last = millis() - s.period; // the first sample is due now
+    s.active = true;
+    return id;
+  }
+  return -2;
+}
+
+// args: <id> or * (all streams of the sink), only streams of the sink (a serial UNSUB does not stop an MQTT stream)
+int Streams::unsubscribe(const char *args, stream_sink_t sink)
+{
+  int removed = 0;
+  for (uint8_t id = 0; id < STREAMS_MAX; id++)
+  {
+    stream_t &s = _streams[id];
+    bool match = (*args == '*') || (*args >= '0' && *args <= '9' && atoi(args) == id);
+    if (s.active && s.sink == sink && match)
+    {
+      s.active = false;
+      removed++;
+    }
+  }
+  return removed;
+}
+
+#define STREAM_SAMPLE(name, type, expr) _snapshot[STREAM_##name] = (expr);
+
+void Streams::snapshot()
+{
+  unsigned long start = micros();
+  STREAM_FIELDS(STREAM_SAMPLE)
+  _snapshot_us = usec_since(start);
+  _snapshots++;
+}
+
+static const char *state_text(stream_type_t type, double value)
+{
+  return type == STREAM_BOILER_STATE ? boilerController.state_name((uint8_t)value) : brewProcess.state_name((uint8_t)value);
+}
+
+bool Streams::send_text(uint8_t id, stream_t &s)
+{
+  TextLine<STREAM_LINE_SIZE> line;
+  if (s.sink == STREAM_MQTT)
+  {
+    mqttDevice.measurement("stream");
+    mqttDevice.write((char *)"id", (long)id);
+  }
+  else
+  {
+    line.print("stream");
+    line.print(id);
+    line.print(": ");
+  }
+
+  bool first = true;
+  for (uint8_t f = 0; f < STREAM_FIELD_COUNT; f++)
+  {
+    if (!(s.fields & (1UL << f)))
+      continue;
+    stream_type_t type = STREAM_TYPES[f];
+    double value = _snapshot[f];
+    if (s.sink == STREAM_MQTT)
+    {
+      if (type == STREAM_FLOAT)
+        mqttDevice.write((char *)STREAM_NAMES[f], value);
+      else if (type == STREAM_INT)
+        mqttDevice.write((char *)STREAM_NAMES[f], (long)value);
+      else
+        mqttDevice.write((char *)STREAM_NAMES[f], (char *)state_text(type, value));
+      continue;
+    }
+    if (!first)
+      line.print(',');
+    line.print(STREAM_NAMES[f]);
+    line.print('=');
+    if (type == STREAM_FLOAT)
+      line.print(value, 2);
+    else if (type == STREAM_INT)
+      line.print((long)value);
+    else
+      line.print(state_text(type, value));
+    first = false;
+  }
+
+  size_t n;
+  if (s.sink == STREAM_MQTT)
+    n = mqttDevice.send();
+  else
+  {
+    line.println();
+    if (!line.send())
+      return false;
+    n = line.length();
+  }
+  s.bytes += n;
+  return true;
+}
+
+// payload: stream id, field mask (16 bits), the values of the fields in the mask (float or int32)
+bool Streams::send_binary(uint8_t id, stream_t &s)
+{
+  uint8_t buf[1 + sizeof(uint16_t) + STREAM_FIELD_COUNT * sizeof(uint32_t)];
+  static_assert(sizeof(buf) <= TELEMETRY_MAX_PAYLOAD, "stream payload size");
+  size_t n = 0;
+  uint16_t mask = s.fields;
+  buf[n++] = id;
+  memcpy(buf + n, &mask, sizeof(mask));
+  n += sizeof(mask);
+  for (uint8_t f = 0; f < STREAM_FIELD_COUNT; f++)
+  {
+    if (!(mask & (1U << f)))
+      continue;
+    if (STREAM_TYPES[f] == STREAM_FLOAT)
+    {
+      float value = _snapshot[f];
+      memcpy(buf + n, &value, sizeof(value));
+    }
+    else
+    {
+      int32_t value = (int32_t)_snapshot[f];
+      memcpy(buf + n, &value, sizeof(value));
+    }
+    n += sizeof(uint32_t);
+  }
+
+  if (s.sink == STREAM_MQTT)
+  {
+    char subtopic[16];
+    snprintf(subtopic, sizeof(subtopic), "stream/%d", id);
+    if (!mqttDevice.publish(subtopic, buf, n))
+      return false;
+  }
+  else if (!telemetry.send(TELEMETRY_STREAM, buf, n))
+    return false;
+  s.bytes += n;
+  return true;
+}
+
+void Streams::control()
+{
+  bool sampled = false;
+  for (uint8_t id = 0; id < STREAMS_MAX; id++)
+  {
+    stream_t &s = _streams[id];
+    if (!s.active || time_since(s.last) < s.period)
+      continue;
+    s.last = millis();
+    if (s.sink == STREAM_MQTT && !mqtt_allowed()) // (opt-in withdrawn, or the broker changed)
+    {
+      s.active = false;
+      continue;
+    }
+    // nobody listening: no snapshot, no formatting (dtr(): operator bool() of the USB serial port blocks for 10 msec)
+    if (s.sink == STREAM_SERIAL ? !Serial.dtr() : !mqttDevice.is_on())
+      continue;
+    if (!sampled)
+      snapshot(); // once for all streams that are due
+    sampled = true;
+
+    unsigned long start = micros();
+    if (s.binary ? send_binary(id, s) : send_text(id, s))
+      s.samples++;
+    s.max_us = max(s.max_us, usec_since(start));
+  }
+}
+
+unsigned long Streams::next_deadline()
+{
+  unsigned long next = TIME_NEVER;
+  for (uint8_t id = 0; id < STREAMS_MAX; id++)
+  {
+    const stream_t &s = _streams[id];
+    if (!s.active)
+      continue;
+    unsigned long dt = time_since(s.last);
+    next = min(next, (dt >= s.period) ? 0 : s.period - dt);
+  }
+  return next;
+}
+
+// MQTT control topic <topic>/sub: "SUB ..." or "UNSUB ...", the reply is published to <topic>/reply
+static void on_control(const char *payload, size_t len)
+{
+  char reply[48];
+  if (strncmp(payload, "SUB ", 4) == 0)
+  {
+    int id = streams.subscribe(payload + 4, STREAM_MQTT);
+    if (id >= 0)
+      snprintf(reply, sizeof(reply), "SUB OK, stream=%d", id);
+    else
+      snprintf(reply, sizeof(reply), id == -2 ? "SUB NOK, no free stream" : "SUB NOK, syntax error");
+  }
+  else if (strncmp(payload, "UNSUB ", 6) == 0)
+    snprintf(reply, sizeof(reply), "UNSUB OK, removed=%d", streams.unsubscribe(payload + 6, STREAM_MQTT));
+  else
+    snprintf(reply, sizeof(reply), "NOK, unknown command");
+  mqttDevice.publish("reply", (const uint8_t *)reply, strlen(reply));
+}
+
+// opt-in, and not on the public broker (as the command topic, see dp_remote.h)
+bool Streams::mqtt_allowed()
+{
+  return settings.remoteControl() && !mqttDevice.public_broker();
+}
+
+void Streams::begin()
+{
+  mqttDevice.subscribe("sub", on_control, Streams::mqtt_allowed);
+}
@@ -0,0 +1,102 @@
+/*
+  Telemetry streams: subscriptions to a set of fields at a rate, on the serial port or MQTT
+  (c) 2025 - diyPresso - CC-BY-NC
+
+  A client subscribes with `SUB <fields> <rate> [text|binary]` on the serial port, or with the same text published to
+  the MQTT topic <topic>/sub (the stream is then published to MQTT):
+
+    SUB t_act,h_pwr,pid_p,pid_i,pid_d 10 binary    -> stream 0, 10 Hz
+    SUB * 0.2                                       -> all fields every 5 seconds
+    UNSUB 0   or   UNSUB *
+
+  <fields> is a comma separated list of STREAM_FIELDS names or * (all), <rate> in [Hz] (max. STREAMS_MAX_RATE).
+  The control topic <topic>/sub takes the same opt-in as the command topic (setting remoteControl=1, never on the
+  public broker MQTT_PUBLIC_BROKER, see dp_remote.h), and an MQTT stream is limited to STREAMS_MQTT_MAX_RATE (each
+  message is a blocking send to the WiFi module) and to STREAMS_MAX - 1 streams, so one is left for the serial port.
+  MQTT streams stop when the control topic is no longer allowed (e.g. after `PUT mqtt` to the public broker).
+  All streams that are due in a loop are sampled from one shared snapshot of the state, so the state is only read
+  when a stream needs it, and only the subscribed fields are formatted and sent. A serial stream is only sent when a
+  host has the port open (DTR), with one write() per sample (see Telemetry::write()), an MQTT stream when MQTT is on.
+
+  Text: "stream<id>: name=value,..." on serial, an influxDB line (measurement "stream", field id) on MQTT.
+  Binary: the stream id, the field mask and the values (32 bit float or int, little-endian) as a telemetry frame of
+  type TELEMETRY_STREAM on serial (see dp_telemetry.h), or as the raw payload of <topic>/stream/<id> on MQTT.
+*/
+#ifndef STREAMS_H
+#define STREAMS_H
+
+#include <Arduino.h>
+#include "dp_time.h"
+
+#define STREAMS_MAX 4
+#define STREAMS_MAX_RATE 50       // [Hz]
+#define STREAMS_MQTT_MAX_RATE 2   // [Hz]
+#define STREAMS_MQTT_MAX (STREAMS_MAX - 1) // (one stream is always left for the serial port)
+
+typedef enum : uint8_t { STREAM_FLOAT, STREAM_INT, STREAM_BOILER_STATE, STREAM_BREW_STATE } stream_type_t;
+
+// F(name, type, expression)
+#define STREAM_FIELDS(F) \
+  F(t_set, STREAM_FLOAT,        boilerController.set_temp()) \
+  F(t_act, STREAM_FLOAT,        boilerController.act_temp()) \
+  F(pid_p, STREAM_FLOAT,        boilerController.pid_p()) \
+  F(pid_i, STREAM_FLOAT,        boilerController.pid_i()) \
+  F(pid_d, STREAM_FLOAT,        boilerController.pid_d()) \
+  F(h_pwr, STREAM_FLOAT,        heaterDevice.power()) \
+  F(h_avg, STREAM_FLOAT,        heaterDevice.average()) \
+  F(r_lvl, STREAM_FLOAT,        reservoir.level()) \
+  F(r_wgt, STREAM_FLOAT,        reservoir.last_weight()) \
+  F(w_cur, STREAM_FLOAT,        brewProcess.weight()) \
+  F(w_end, STREAM_FLOAT,        brewProcess.end_weight()) \
+  F(shots, STREAM_INT,          settings.shotCounter()) \
+  F(boil,  STREAM_BOILER_STATE, boilerController.state_id()) \
+  F(brew,  STREAM_BREW_STATE,   brewProcess.state_id()) \
+  F(m_rec, STREAM_INT,          mqttDevice.reconnects()) \
+  F(msec,  STREAM_INT,          millis())
+
+#define STREAM_FIELD_ID(name, type, expr) STREAM_##name,
+typedef enum : uint8_t { STREAM_FIELDS(STREAM_FIELD_ID) STREAM_FIELD_COUNT } stream_field_t;
+
+typedef enum : uint8_t { STREAM_SERIAL, STREAM_MQTT } stream_sink_t;
+
+typedef struct {
+  bool active;
+  stream_sink_t sink;
+  bool binary;
+  uint32_t fields;                // bit mask of stream_field_t
+  unsigned long period;           // [msec]
+  unsigned long last;             // millis() of the last sample
+  unsigned long samples, bytes;   // statistics
+  unsigned long max_us;           // longest sample (format and send) [usec]
+} stream_t;
+
+class Streams
+{
+  private:
+    stream_t _streams[STREAMS_MAX];
+    double _snapshot[STREAM_FIELD_COUNT];
+    unsigned long _snapshots = 0, _snapshot_us = 0;
+
+    void snapshot();
+    bool send_text(uint8_t id, stream_t &s); // false if the sample was dropped (serial output paused, see Telemetry::write())
+    bool send_binary(uint8_t id, stream_t &s);
+    static uint32_t parse_fields(const char *list, size_t len);
+    static bool mqtt_allowed();   // the MQTT control topic (and MQTT streams) are allowed
+
+  public:
+    void begin();                 // subscribe to the MQTT control topic (before mqttDevice.init())
+    int subscribe(const char *args, stream_sink_t sink); // returns the stream id, -1 on a syntax error, -2 if all are in use (or STREAMS_MQTT_MAX)
+    int unsubscribe(const char *args, stream_sink_t sink); // returns the number of removed streams
+    void control();               // sample the streams that are due, call from the main loop
+    unsigned long next_deadline(); // [msec]
+
+    const stream_t &stream(uint8_t id) { return _streams[id]; }
+    unsigned long snapshots() { return _snapshots; }
+    unsigned long snapshot_us() { return _snapshot_us; } // time of the last snapshot [usec]
+    static const char *field_name(uint8_t field);
+    static void describe(Print &out, const stream_t &s); // "<fields> <rate> <format> <sink>"
+};
+
+extern Streams streams;
+
+#endif // STREAMS_H
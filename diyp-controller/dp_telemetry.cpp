@@ -0,0 +1,114 @@
+/*
+  Binary telemetry on the USB serial port
+  (c) 2025 - diyPresso - CC-BY-NC
+*/
+#include "dp_telemetry.h"
+#include "dp_cobs.h"
+#include "dp_crc.h"
+#include "dp_boiler.h"
+#include "dp_brew.h"
+#include "dp_heater.h"
+#include "dp_pump.h"
+#include "dp_reservoir.h"
+#include "dp_mqtt.h"
+
+#define TELEMETRY_FLOW_FILTER 0.2 // low-pass filter factor of the flow per sample
+
+Telemetry telemetry;
+
+static int16_t scaled(double value, double scale)
+{
+  return constrain(lround(value * scale), INT16_MIN, INT16_MAX);
+}
+
+void Telemetry::rate(int hz)
+{
+  hz = constrain(hz, 0, TELEMETRY_MAX_RATE);
+  _period = hz ? 1000 / hz : 0;
+  _last = millis();
+  _last_weight = reservoir.last_weight();
+  _flow = 0.0;
+}
+
+bool Telemetry::write(const void *buf, size_t n)
+{
+  if (!Serial.dtr()) // (not !Serial: that waits 10 msec)
+    return false;
+  if (_paused && time_since(_paused) < TELEMETRY_PAUSE)
+    return false;
+  _paused = 0;
+  unsigned long start = micros();
+  size_t written = Serial.write((const uint8_t *)buf, n);
+  if (usec_since(start) > TELEMETRY_SLOW_WRITE || written != n)
+  {
+    _paused = millis() | 1; // (never 0)
+    _pauses++;
+  }
+  return written == n;
+}
+
+bool Telemetry::send(uint8_t type, const void *payload, size_t len)
+{
+  uint8_t frame[2 + TELEMETRY_MAX_PAYLOAD + sizeof(uint32_t)];
+  uint8_t buf[1 + COBS_MAX_SIZE(sizeof(frame)) + 1];
+
+  if (len > TELEMETRY_MAX_PAYLOAD) // (a caller error: counted as dropped, never written past the frame)
+  {
+    _dropped++;
+    return false;
+  }
+  frame[0] = type;
+  frame[1] = _sequence++;
+  memcpy(frame + 2, payload, len);
+  uint32_t crc = crc32(frame, 2 + len);
+  memcpy(frame + 2 + len, &crc, sizeof(crc)); // (little-endian)
+
+  size_t n = 0;
+  buf[n++] = 0x00;
+  n += cobs_encode(buf + n, frame, 2 + len + sizeof(crc));
+  buf[n++] = 0x00;
+
+  if (!write(buf, n))
+  {
+    _dropped++;
+    return false;
+  }
+  _frames++;
+  return true;
+}
+
+void Telemetry::control()
+{
+  if (!_period || time_since(_last) < _period)
+    return;
+  double dt = time_since(_last) / 1000.0; // [sec]
+  _last = millis();
+
+  double weight = reservoir.last_weight();
+  _flow += TELEMETRY_FLOW_FILTER * ((_last_weight - weight) / dt - _flow);
+  _last_weight = weight;
+
+  telemetry_sample_t s;
+  s.time = _last;
+  s.act_temp = scaled(boilerController.act_temp(), 100.0);
+  s.set_temp = scaled(boilerController.set_temp(), 100.0);
+  s.p = scaled(boilerController.pid_p(), 100.0);
+  s.i = scaled(boilerController.pid_i(), 100.0);
+  s.d = scaled(boilerController.pid_d(), 100.0);
+  s.power = scaled(heaterDevice.power(), 100.0);
+  s.weight = scaled(weight, 10.0);
+  s.flow = scaled(_flow, 100.0);
+  s.boiler_state = boilerController.state_id();
+  s.brew_state = brewProcess.state_id();
+  s.flags = (heaterDevice.is_on() ? 0x01 : 0) | (pumpDevice.is_on() ? 0x02 : 0) | (mqttDevice.is_on() ? 0x04 : 0);
+  static_assert(sizeof(s) <= TELEMETRY_MAX_PAYLOAD, "telemetry payload size");
+  send(TELEMETRY_SAMPLE, &s, sizeof(s));
+}
+
+unsigned long Telemetry::next_deadline()
+{
+  if (!_period)
+    return TIME_NEVER;
+  unsigned long dt = time_since(_last);
+  return (dt >= _period) ? 0 : _period - dt;
+}
@@ -0,0 +1,96 @@
+/*
+  Binary telemetry on the USB serial port
+  (c) 2025 - diyPresso - CC-BY-NC
+
+  When enabled (`PUT telemetry <rate>`, rate in [Hz], 0 = off), a sample of the controller state is sent at a fixed
+  rate as a binary frame, between the text lines of the serial port:
+
+    0x00  COBS( type, sequence, payload, CRC-32 )  0x00
+
+  The COBS encoding removes all zero bytes from the frame, so a zero byte delimits a frame and text (which never
+  contains a zero byte) can be told apart: a chunk between two zero bytes that does not decode to a frame with a valid
+  CRC is text. The payload is little-endian and has a fixed layout per frame type, see telemetry_sample_t.
+  The host decoder is server/telemetry.py.
+
+  write() is the gate for all unsolicited output on the port (telemetry frames, log lines, streams): on the SAMD21
+  native USB port availableForWrite() is a constant, and write() blocks until the host has taken the data. So output
+  is only sent while a host has the port open (DTR), in one write() per frame or line, and after a write() that took
+  longer than TELEMETRY_SLOW_WRITE (the host does not keep up) it is dropped for TELEMETRY_PAUSE.
+*/
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include <Arduino.h>
+#include "dp_time.h"
+
+#define TELEMETRY_MAX_RATE 50     // [Hz]
+#define TELEMETRY_MAX_PAYLOAD 72  // [bytes]
+#define TELEMETRY_SLOW_WRITE 5000 // a write() that takes longer pauses the output [usec]
+#define TELEMETRY_PAUSE 1000      // [msec]
+#define TELEMETRY_SAMPLE 0x01     // frame types
+#define TELEMETRY_LOG 0x02        // log message, see dp_log.h
+#define TELEMETRY_STREAM 0x03     // sample of a subscribed stream, see dp_streams.h
+
+typedef struct __attribute__((packed)) {
+  uint32_t time;                  // millis() [msec]
+  int16_t act_temp, set_temp;     // boiler temperature [0.01 degC]
+  int16_t p, i, d;                // PID terms [0.01 %]
+  int16_t power;                  // heater power [0.01 %]
+  int16_t weight;                 // reservoir weight [0.1 gram]
+  int16_t flow;                   // flow out of the reservoir [0.01 gram/sec]
+  uint8_t boiler_state, brew_state; // state ids
+  uint8_t flags;                  // bit 0: heater on, bit 1: pump on, bit 2: MQTT connected
+} telemetry_sample_t;
+
+class Telemetry
+{
+  private:
+    unsigned long _period = 0;    // [msec], 0 = off
+    unsigned long _last = 0;      // millis() of the last sample
+    uint8_t _sequence = 0;        // frame counter, to detect lost frames
+    double _last_weight = 0.0, _flow = 0.0; // [gram], [gram/sec]
+    unsigned long _frames = 0, _dropped = 0; // sent frames, frames that were not sent (paused, payload too long)
+    unsigned long _paused = 0;    // millis() of the last slow write, 0 = not paused
+    unsigned long _pauses = 0;
+
+  public:
+    bool write(const void *buf, size_t n); // bytes to the serial port with one write(), false if not sent (see above)
+    bool send(uint8_t type, const void *payload, size_t len); // send a frame, false if dropped (paused, payload too long)
+    void rate(int hz);            // 0 = off, max. TELEMETRY_MAX_RATE
+    int rate() { return _period ? 1000 / _period : 0; }
+    bool is_on() { return _period != 0; }
+    void control();               // send a sample when it is due, call from the main loop
+    unsigned long next_deadline(); // [msec]
+    unsigned long frames() { return _frames; }
+    unsigned long dropped() { return _dropped; }
+    unsigned long pauses() { return _pauses; } // slow writes
+};
+
+extern Telemetry telemetry;
+
+// A text line, formatted with print() into a buffer and sent with one telemetry.write() (longer text is cut off)
+template <size_t N> class TextLine : public Print
+{
+  private:
+    uint8_t _buf[N];
+    size_t _len = 0;
+
+  public:
+    size_t write(uint8_t c) override
+    {
+      if (_len >= N)
+        return 0;
+      _buf[_len++] = c;
+      return 1;
+    }
+    using Print::write;
+    size_t length() { return _len; }
+    bool send()                   // println() first; a cut off line still ends with the line end
+    {
+      if (_len == N)
+        memcpy(_buf + N - 2, "\r\n", 2);
+      return telemetry.write(_buf, _len);
+    }
+};
+
+#endif // TELEMETRY_H
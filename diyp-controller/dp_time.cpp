@@ -3,6 +3,7 @@
   Handles the 49.7-day millis() overflow gracefully
  */
 #include <Arduino.h>
+#include "dp_log.h"
 
 const ulong UL_MAX = 4294967295;
 
@@ -87,7 +88,7 @@ void reset_test_millis()
 // Test overflow scenarios
 void test_millis_overflow()
 {
-    Serial.println("\n=== TESTING MILLIS() OVERFLOW PROTECTION ===");
+    LOG(TIME_TEST_START);
     
     // Test 1: Normal operation (no overflow)
     unsigned long start = 1000;
@@ -96,9 +97,7 @@ void test_millis_overflow()
     
     set_test_millis(start + 5000);
     unsigned long elapsed = test_time_since(test_start);
-    Serial.print("Test 1 - Normal: elapsed=");
-    Serial.print(elapsed);
-    Serial.println(elapsed == 5000 ? " ✓ PASS" : " ✗ FAIL");
+    LOG(TIME_TEST_RESULT, 1, "Normal", elapsed, elapsed == 5000 ? "PASS" : "FAIL");
     
     // Test 2: Overflow scenario
     start = UL_MAX - 2000;  // Near overflow
@@ -107,9 +106,7 @@ void test_millis_overflow()
     
     set_test_millis(1000);  // After overflow
     elapsed = test_time_since(test_start);
-    Serial.print("Test 2 - Overflow: elapsed=");
-    Serial.print(elapsed);
-    Serial.println(elapsed == 3000 ? " ✓ PASS" : " ✗ FAIL");
+    LOG(TIME_TEST_RESULT, 2, "Overflow", elapsed, elapsed == 3000 ? "PASS" : "FAIL");
     
     // Test 3: Timeout functions
     start = UL_MAX - 1000;
@@ -118,8 +115,7 @@ void test_millis_overflow()
     
     set_test_millis(2000);  // After overflow
     bool timeout = test_time_since(test_start) >= 3000;
-    Serial.print("Test 3 - Timeout: ");
-    Serial.println(timeout ? " ✓ PASS" : " ✗ FAIL");
+    LOG(TIME_TEST_RESULT, 3, "Timeout", test_time_since(test_start), timeout ? "PASS" : "FAIL");
     
     // Test 4: Multiple overflow cycles
     start = UL_MAX - 500;
@@ -128,11 +124,9 @@ void test_millis_overflow()
     
     set_test_millis(UL_MAX + 1000);  // Multiple overflows
     elapsed = test_time_since(test_start);
-    Serial.print("Test 4 - Multiple overflows: elapsed=");
-    Serial.print(elapsed);
-    Serial.println(elapsed == 1500 ? " ✓ PASS" : " ✗ FAIL");
+    LOG(TIME_TEST_RESULT, 4, "Multiple overflows", elapsed, elapsed == 1500 ? "PASS" : "FAIL");
     
     reset_test_millis();
-    Serial.println("=== OVERFLOW TEST COMPLETE ===\n");
+    LOG(TIME_TEST_DONE);
 }
 #endif
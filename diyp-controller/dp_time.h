@@ -2,6 +2,8 @@
 #define TIME_H
 #include <Arduino.h>
 
+#define TIME_NEVER 0xFFFFFFFFUL // 'no deadline' value for functions that return a time until a deadline [msec]
+
 unsigned long time_diff(unsigned long ts1, unsigned long ts2);
 unsigned long time_since(unsigned long ts);
 unsigned long usec_since(unsigned long usec_ts);
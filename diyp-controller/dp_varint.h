@@ -0,0 +1,47 @@
+/*
+  Variable length integer encoding (LEB128 varint, as used by protobuf)
+  7 bits per byte, the high bit is set if more bytes follow: values < 128 take one byte.
+  Signed values are zigzag encoded first (0, -1, 1, -2, 2 ... -> 0, 1, 2, 3, 4 ...), so small negative values are short too.
+  (c) 2025 - diyPresso - CC-BY-NC
+*/
+#ifndef VARINT_H
+#define VARINT_H
+
+#include <Arduino.h>
+
+#define VARINT_MAX_SIZE 5 // bytes of a 32 bit value
+
+inline uint32_t zigzag_encode(int32_t v) { return ((uint32_t)v << 1) ^ (uint32_t)(v >> 31); }
+inline int32_t zigzag_decode(uint32_t v) { return (int32_t)(v >> 1) ^ -(int32_t)(v & 1); }
+
+// write a varint to buf, returns the number of bytes written (0 if it does not fit in `size` bytes)
+inline uint8_t varint_encode(uint8_t *buf, size_t size, uint32_t v)
+{
+  uint8_t n = 0;
+  do {
+    if (n >= size)
+      return 0;
+    uint8_t b = v & 0x7F;
+    v >>= 7;
+    buf[n++] = v ? (b | 0x80) : b;
+  } while (v);
+  return n;
+}
+
+// read a varint from buf, returns the number of bytes read (0 if incomplete or too long)
+inline uint8_t varint_decode(const uint8_t *buf, size_t size, uint32_t *v)
+{
+  uint32_t result = 0;
+  for (uint8_t n = 0; n < size && n < VARINT_MAX_SIZE; n++)
+  {
+    result |= (uint32_t)(buf[n] & 0x7F) << (7 * n);
+    if (!(buf[n] & 0x80))
+    {
+      *v = result;
+      return n + 1;
+    }
+  }
+  return 0;
+}
+
+#endif // VARINT_H
@@ -6,6 +6,7 @@
 #include <WiFiNINA.h>
 #include <WiFiUdp.h>
 #include "EasyWiFi.h"
+#include "dp_wifi.h"
 
 /*********** Global Settings  **********/
 EasyWiFi MyEasyWiFi;
@@ -28,7 +29,7 @@ void printWiFiStatus()
     long rssi = WiFi.RSSI(); Serial.print("- Rssi: "); Serial.print(rssi); Serial.println("dBm");
 }
 
-void wifi_loop()
+void wifi_start()
 {
   if (WiFi.status()==WL_CONNECTED)
   {
@@ -37,13 +38,50 @@ void wifi_loop()
   else
   {
     Serial.println("* Not Connected, starting EasyWiFi");
-    MyEasyWiFi.start();
   }
-} // end Main loop
+  MyEasyWiFi.start();
+}
+
+void wifi_control()
+{
+  MyEasyWiFi.control();
+}
+
+const char *wifi_state()
+{
+  return MyEasyWiFi.get_state_name();
+}
+
+unsigned long wifi_attempts()
+{
+  return MyEasyWiFi.attempts();
+}
+
+unsigned long wifi_connect_time()
+{
+  return MyEasyWiFi.connect_time();
+}
+
+unsigned long wifi_max_run_time()
+{
+  unsigned long us = MyEasyWiFi.max_run_time();
+  MyEasyWiFi.reset_stats();
+  return us;
+}
+
+const wifi_link_t &wifi_link()
+{
+  return MyEasyWiFi.link();
+}
 
 void wifi_erase()
 {
    MyEasyWiFi.erase();
 }
 
-
+unsigned long wifi_time()
+{
+  if (WiFi.status() != WL_CONNECTED)
+    return 0;
+  return WiFi.getTime();
+}
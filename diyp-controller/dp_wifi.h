@@ -2,8 +2,29 @@
 #define WIFI_H
 #include "dp.h"
 
+#define WIFI_POLL_PERIOD_MS 100 // scheduler period of wifi_control() [msec]
+
+// Link supervision while connected (see EasyWiFi::supervise())
+typedef struct {
+  long rssi, rssi_min, rssi_max;  // last, lowest and highest signal strength [dBm]
+  double rssi_mean;               // low-pass filtered [dBm]
+  unsigned long samples;          // link checks with an RSSI value
+  unsigned long up;               // time since connected, 0 if not connected [msec]
+  unsigned long uptime;           // connected time of the previous links [msec]
+  unsigned long drops;            // links lost (or dropped for a weak signal)
+  unsigned long reconnect_ms, max_reconnect_ms; // time from a lost link to connected, last and longest [msec]
+  unsigned long max_sample_us;    // longest link check [usec]
+} wifi_link_t;
+
 void wifi_setup();
-void wifi_loop();
+void wifi_start();   // start connecting in the background (does not wait for the connection)
+void wifi_control(); // run the connection state machine (EasyWiFi), from the scheduler
+const char *wifi_state();
+unsigned long wifi_attempts();     // logon attempts since wifi_start()
+unsigned long wifi_connect_time(); // time from wifi_start() to connected [msec]
+unsigned long wifi_max_run_time(); // longest step of the state machine since the last call [usec]
+const wifi_link_t &wifi_link();    // link quality and reconnect statistics
 void wifi_erase();
+unsigned long wifi_time(); // unix time [sec] from the WiFi module (NTP), 0 if not connected
 
 #endif // WIFI_H
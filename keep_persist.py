@@ -0,0 +1,8 @@
+# PlatformIO extra script: upload without erasing the whole flash.
+#
+# The sam-ba upload of the atmelsam platform calls bossac with --erase, which erases the flash from the start of the
+# sketch to the end, including the settings, fault log and shot history at the end of the flash (see
+# diyp-controller/dp_flash.h). Without --erase bossac erases only the rows it writes.
+Import("env")
+
+env.Replace(UPLOADERFLAGS=[f for f in env.get("UPLOADERFLAGS", []) if f not in ("--erase", "-e")])
@@ -0,0 +1,513 @@
+#!/usr/bin/env python3
+"""
+Host simulator of the diyPresso boiler: a thermal plant model with the boiler controller of the firmware
+(diyp-controller/dp_boiler.cpp, dp_pid.cpp, dp_autotune.cpp, dp_model.cpp), to try control changes without a machine.
+
+The plant has two heat capacities: the heater element with the boiler wall, and the water. The heater (1300 W, the
+average of the 1 sec PWM) heats the wall, the wall heats the water, the water loses heat to the room and to the cold
+water of a shot. The RTD reads the water temperature with a first order lag and a dead time. The controller code is
+ported line by line from the firmware (same sample time, limits, states and feed-forward), so the results can be
+compared with the firmware; when the firmware changes, change the port here too.
+
+  python3 boiler_sim.py                 # heat-up with the default settings
+  python3 boiler_sim.py --autotune      # relay auto-tune, then heat-up before and after with the tuned settings
+  python3 boiler_sim.py --shots         # shots at 3 flows, feed-forward from the settings and from the plant model
+  python3 boiler_sim.py --heatup        # cold starts with the PID only, and at full power to the learned switch point
+  python3 boiler_sim.py --csv heatup.csv
+"""
+import argparse
+import csv
+import math
+from collections import deque
+
+DT = 0.1  # simulation step [sec]
+
+# settings defaults (diyp-controller/dp_settings.h)
+DEFAULTS = {"temperature": 98.0, "p": 6.2, "i": 0.08, "d": 70.0, "ff_heat": 6.0, "ff_ready": 6.0, "ff_brew": 35.0,
+            "heatLag": 30.0}
+LIMITS = {"p": (0.0, 10.0), "i": (0.0, 20.0), "d": (0.0, 100.0), "ff_heat": (0.0, 100.0), "ff_ready": (0.0, 100.0)}
+
+# diyp-controller/dp_boiler.h
+TEMP_WINDOW = 10.0
+WINDUP_LIMIT_MIN = -7.0
+WINDUP_LIMIT_MAX = 7.0
+FF_WATER_HEAT = 4.186
+FF_DRAW_SCALE = 0.8
+FF_DRAW_LEAD = 0.5
+FF_DRAW_LAG = 5.0
+FF_DRAW_MAX = 50.0
+HEATUP_MIN_RISE = 20.0
+HEATUP_RATE_TAU = 5.0
+HEATUP_PEAK_RATE = 0.002
+HEATUP_LAG_FILTER = 0.5
+HEATUP_LAG_MAX = 120.0
+TIMEOUT_COAST = 180.0
+FF_FLOW_TAU = 2.0
+HEATER_POWER_W = 1300.0  # (dp_heater.h)
+
+# diyp-controller/dp_autotune.h
+AUTOTUNE_AMPLITUDE = 15.0
+AUTOTUNE_MAX_POWER = 40.0
+AUTOTUNE_HYSTERESIS = 0.2
+AUTOTUNE_SKIP_CYCLES = 1
+AUTOTUNE_CYCLES = 3
+AUTOTUNE_KP = 0.33
+AUTOTUNE_TI = 0.5
+AUTOTUNE_TD = 1.0 / 3.0
+
+# diyp-controller/dp_model.h
+MODEL_SAMPLE = 5.0
+MODEL_DELAYS = 8
+MODEL_AMBIENT = 20.0
+MODEL_FORGET = 0.999
+MODEL_TRACE_MAX = 1.0e4
+MODEL_P0 = 100.0
+MODEL_ERROR_FILTER = 0.01
+MODEL_HOLDOFF = 60.0
+MODEL_MIN_SAMPLES = 100
+MODEL_MAX_HOLD = 30.0
+MODEL_STABLE_SAMPLES = 60
+MODEL_STABLE = 0.5
+
+SETTLE_BAND = 0.5  # settled: within this band of the setpoint for the rest of the run [degC]
+
+
+class Plant:
+    """boiler thermal model, temperatures in [degC], power in [%] of the heater
+    (the lags are chosen so the old defaults P=5 I=0.1 D=10 overshoot 2 degC, as measured on a machine, see TODO.md)"""
+    HEATER_W = 1300.0
+    C_WALL = 600.0       # heater element and boiler wall [J/K]
+    C_WATER = 3400.0     # water [J/K]
+    H_WALL = 30.0        # wall to water [W/K]
+    UA_LOSS = 0.9        # water to room [W/K]
+    T_ROOM = 20.0
+    SENSOR_TAU = 10.0    # RTD lag [sec]
+    DEAD_TIME = 5.0      # [sec]
+    CP_WATER = 4.186     # [J/(g K)]
+
+    def __init__(self, temp=T_ROOM):
+        self.wall = self.water = self.sensor = temp
+        self.delay = deque([temp] * int(self.DEAD_TIME / DT))
+        self.flow = 0.0  # cold water through the boiler [g/sec]
+
+    def step(self, power):
+        q_heater = self.HEATER_W * power / 100.0
+        q_wall = self.H_WALL * (self.wall - self.water)
+        q_loss = self.UA_LOSS * (self.water - self.T_ROOM) + self.flow * self.CP_WATER * (self.water - self.T_ROOM)
+        self.wall += (q_heater - q_wall) / self.C_WALL * DT
+        self.water += (q_wall - q_loss) / self.C_WATER * DT
+        self.delay.append(self.water)
+        self.sensor += (self.delay.popleft() - self.sensor) * DT / self.SENSOR_TAU
+        return self.sensor
+
+
+class Pid:
+    """DpPID (dp_pid.cpp)"""
+    def __init__(self, p, i, d, sample=1.0):
+        self.kp, self.ki, self.kd = p, i, d
+        self.sample = sample
+        self.ff = 0.0
+        self.term_i = 0.0
+        self.last_error = 0.0
+        self.last_input = None
+        self.elapsed = 0.0
+        self.output = 0.0
+
+    def reset(self, temp):
+        self.term_i = 0.0
+        self.last_error = 0.0
+        self.last_input = temp
+        self.elapsed = 0.0
+
+    def preload(self, temp, setpoint, output):
+        self.reset(temp)
+        self.term_i = min(WINDUP_LIMIT_MAX, max(WINDUP_LIMIT_MIN, output - self.ff - self.kp * (setpoint - temp)))
+
+    def compute(self, temp, setpoint):
+        self.elapsed += DT
+        if self.elapsed < self.sample - 1e-9:
+            return self.output
+        dt, self.elapsed = self.elapsed, 0.0
+        if self.last_input is None:
+            self.last_input = temp
+        error = setpoint - temp
+        term_p = self.kp * error
+        self.term_i += self.ki * dt * (error + self.last_error) / 2.0
+        self.term_i = min(WINDUP_LIMIT_MAX, max(WINDUP_LIMIT_MIN, self.term_i))
+        term_d = -self.kd * (temp - self.last_input) / dt
+        self.output = min(100.0, max(0.0, self.ff + term_p + self.term_i + term_d))
+        self.last_input = temp
+        self.last_error = error
+        return self.output
+
+
+class RelayAutotune:
+    """RelayAutotune (dp_autotune.cpp)"""
+    def __init__(self, setpoint, bias, temp, amplitude=AUTOTUNE_AMPLITUDE, max_power=AUTOTUNE_MAX_POWER):
+        self.setpoint, self.amplitude, self.max_power = setpoint, amplitude, max_power
+        self.bias = min(max_power, max(0.0, bias))
+        self.high = temp < setpoint
+        self.time = 0.0
+        self.cycle_start = None
+        self.switch_low = 0.0
+        self.t_min = self.t_max = temp
+        self.energy = 0.0
+        self.sums = [0.0, 0.0, 0.0, 0.0]  # tu, a, d, power
+        self.measured = self.cycles = 0
+        self.status = "running"
+        self.result = {}
+        self.power = self.relay()
+
+    def relay(self):
+        return min(self.max_power, self.bias + self.amplitude) if self.high else max(0.0, self.bias - self.amplitude)
+
+    def update(self, temp):
+        if self.status != "running":
+            return self.power
+        self.energy += self.power * DT
+        self.time += DT
+        self.t_min, self.t_max = min(self.t_min, temp), max(self.t_max, temp)
+        if self.high and temp > self.setpoint + AUTOTUNE_HYSTERESIS:
+            self.high = False
+            self.switch_low = self.time
+        elif not self.high and temp < self.setpoint - AUTOTUNE_HYSTERESIS:
+            self.high = True
+            if self.cycle_start is not None:
+                self.cycle()
+            self.cycle_start = self.time
+            self.t_min = self.t_max = temp
+            self.energy = 0.0
+        self.power = self.relay()
+        return self.power
+
+    def cycle(self):
+        tu = self.time - self.cycle_start
+        t_high = self.switch_low - self.cycle_start
+        a = (self.t_max - self.t_min) / 2.0
+        d = (min(self.max_power, self.bias + self.amplitude) - max(0.0, self.bias - self.amplitude)) / 2.0
+        power = self.energy / tu
+        self.cycles += 1
+        if self.cycles > AUTOTUNE_SKIP_CYCLES:
+            for k, v in enumerate((tu, a, d, power)):
+                self.sums[k] += v
+            self.measured += 1
+        self.bias = min(self.max_power, max(0.0, self.bias + d * (2.0 * t_high - tu) / tu))
+        if self.measured >= AUTOTUNE_CYCLES:
+            self.finish()
+
+    def finish(self):
+        tu, a, d, power = (s / self.measured for s in self.sums)
+        if a <= AUTOTUNE_HYSTERESIS:
+            self.status = "aborted"
+            return
+        ku = 4.0 * d / (math.pi * math.sqrt(a * a - AUTOTUNE_HYSTERESIS ** 2))
+        p = AUTOTUNE_KP * ku
+        self.result = {"ku": ku, "tu": tu, "amplitude": a, "power": power, "p": p, "i": p / (AUTOTUNE_TI * tu),
+                       "d": p * AUTOTUNE_TD * tu}
+        self.status = "done"
+
+
+class PlantModel:
+    """PlantModel (dp_model.cpp): recursive least squares per dead time"""
+    def __init__(self):
+        self.rls = [{"theta": [0.0, 0.0], "p": [[MODEL_P0, 0.0], [0.0, MODEL_P0]], "error": -1.0}
+                    for _ in range(MODEL_DELAYS)]
+        self.u = [0.0] * MODEL_DELAYS
+        self.temp = None
+        self.energy = self.elapsed = 0.0
+        self.disturbed = -MODEL_HOLDOFF
+        self.time = 0.0
+        self.best = 0
+        self.samples = 0
+        self.valid = self.stable = False
+        self.hold = 0.0
+
+    def update(self, temp, power, disturbed):
+        if disturbed:
+            self.disturbed = self.time
+        if self.temp is None:
+            self.temp = temp
+            return
+        self.energy += power * DT
+        self.elapsed += DT
+        self.time += DT
+        if self.elapsed < MODEL_SAMPLE - 1e-9:
+            return
+        self.u = [self.energy / self.elapsed] + self.u[:-1]  # u[d] = u[k - d], this sample is k
+        if self.time - self.disturbed >= MODEL_HOLDOFF:
+            y = temp - self.temp
+            for d, r in enumerate(self.rls):
+                self.fit(r, [(self.temp - MODEL_AMBIENT) / 100.0, self.u[d] / 100.0], y)
+                if r["error"] < self.rls[self.best]["error"]:
+                    self.best = d
+            self.samples += 1
+            if self.samples % MODEL_STABLE_SAMPLES == 0:
+                hold = self.holding_power(MODEL_AMBIENT + 80.0)
+                self.stable, self.hold = abs(hold - self.hold) < MODEL_STABLE, hold
+            self.valid = self.stable and self.check()
+        self.temp = temp
+        self.energy = self.elapsed = 0.0
+
+    @staticmethod
+    def fit(r, x, y):
+        p, theta = r["p"], r["theta"]
+        px = [p[0][0] * x[0] + p[0][1] * x[1], p[1][0] * x[0] + p[1][1] * x[1]]
+        lam = MODEL_FORGET if p[0][0] + p[1][1] < MODEL_TRACE_MAX else 1.0
+        den = lam + x[0] * px[0] + x[1] * px[1]
+        e = y - theta[0] * x[0] - theta[1] * x[1]
+        r["error"] = e * e if r["error"] < 0 else r["error"] + MODEL_ERROR_FILTER * (e * e - r["error"])
+        k = [px[0] / den, px[1] / den]
+        theta[0] += k[0] * e
+        theta[1] += k[1] * e
+        for i in range(2):
+            for j in range(2):
+                p[i][j] = (p[i][j] - k[i] * px[j]) / lam
+
+    def ab(self):
+        a, b = self.rls[self.best]["theta"]
+        return a / 100.0, b / 100.0
+
+    def check(self):
+        a, b = self.ab()
+        if self.samples < MODEL_MIN_SAMPLES or not -1.0 < a < 0.0 or b <= 0.0:
+            return False
+        return 0.0 < self.holding_power(MODEL_AMBIENT + 80.0) < MODEL_MAX_HOLD
+
+    def gain(self):
+        a, b = self.ab()
+        return -b / a if a < 0.0 else 0.0
+
+    def time_constant(self):
+        a, _ = self.ab()
+        return -MODEL_SAMPLE / math.log(1.0 + a) if -1.0 < a < 0.0 else 0.0
+
+    def dead_time(self):
+        return self.best * MODEL_SAMPLE
+
+    def holding_power(self, temp):
+        a, b = self.ab()
+        return -a * (temp - MODEL_AMBIENT) / b if b > 0.0 else 0.0
+
+
+class Boiler:
+    """BoilerStateMachine (dp_boiler.cpp): states heating, ready, brew and autotune
+    (model=False: the feed-forward from the settings only, as before the plant model)"""
+    def __init__(self, settings, temp, model=True, boost=True):
+        self.settings = settings
+        self.set_temp = settings["temperature"]
+        self.pid = Pid(settings["p"], settings["i"], settings["d"])
+        self.state = None
+        self.brew = False
+        self.autotune = None
+        self.tuned = None  # the last auto-tune
+        self.model = PlantModel() if model else None
+        self.flow = self.draw_lag = self.draw_ff = 0.0
+        self.boost = boost
+        self.time = self.coast_start = self.coast_temp = self.coast_rate = self.rate = 0.0
+        self.last_temp = self.peak = temp
+        self.next_state(temp)
+
+    def next_state(self, temp):
+        if self.autotune is not None:
+            state = "autotune"
+        elif self.brew:
+            state = "brew"
+        elif self.state is None and self.boost and self.set_temp - temp > HEATUP_MIN_RISE:
+            state = "boost"  # (from state off)
+        elif self.state == "boost" and temp + self.rate * self.settings["heatLag"] < self.set_temp:
+            state = "boost"
+        elif self.state == "boost" or (self.state == "coast" and self.rate > HEATUP_PEAK_RATE
+                                       and self.time - self.coast_start < TIMEOUT_COAST):
+            state = "coast"
+        elif self.state in ("ready", "brew", "autotune") and abs(self.set_temp - temp) <= TEMP_WINDOW:
+            state = "ready"
+        else:
+            state = "ready" if abs(self.set_temp - temp) < TEMP_WINDOW else "heating"
+        if state != self.state:
+            if self.state == "autotune" or (self.state == "brew" and self.model and self.model.valid):
+                self.pid.reset(temp)
+            if state == "coast":
+                self.coast_start, self.coast_temp, self.coast_rate, self.peak = self.time, temp, self.rate, temp
+            self.pid.ff = {"heating": self.settings["ff_heat"], "ready": self.settings["ff_ready"],
+                           "brew": self.settings["ff_brew"], "autotune": 0.0, "boost": 0.0, "coast": 0.0}[state]
+            if self.state == "coast":
+                self.end_coast(temp, state)
+            self.state = state
+        if self.model and self.model.valid and state in ("ready", "brew"):
+            ff = self.model.holding_power(self.set_temp)
+            self.pid.ff = ff if state == "ready" else min(100.0, ff + self.draw_ff)
+
+    def end_coast(self, temp, state):
+        """learn the thermal lag from the rise after the switch point, hand over to the PID at the holding power"""
+        if state in ("ready", "heating") and self.rate <= HEATUP_PEAK_RATE and self.coast_rate > 0.0:  # (not the timeout)
+            lag = min(HEATUP_LAG_MAX, max(0.0, (self.peak - self.coast_temp) / self.coast_rate))
+            self.settings["heatLag"] += HEATUP_LAG_FILTER * (lag - self.settings["heatLag"])
+        hold = self.model.holding_power(self.set_temp) if self.model and self.model.valid else self.settings["ff_ready"]
+        self.pid.preload(temp, self.set_temp, hold)
+
+    def draw_compensation(self, flow):
+        flow = flow if self.brew else 0.0  # (from the reservoir weight in the firmware)
+        self.flow += (flow - self.flow) * DT / (FF_FLOW_TAU + DT)
+        ff = FF_DRAW_SCALE * self.flow * FF_WATER_HEAT * max(0.0, self.set_temp - MODEL_AMBIENT) / HEATER_POWER_W * 100.0
+        self.draw_lag += (ff - self.draw_lag) * DT / (FF_DRAW_LAG + DT)
+        lead = FF_DRAW_LEAD * (self.model.dead_time() if self.model else 0.0)
+        self.draw_ff = min(FF_DRAW_MAX, max(0.0, self.draw_lag + lead / FF_DRAW_LAG * (ff - self.draw_lag)))
+
+    def start_autotune(self, temp, bias):
+        self.autotune = RelayAutotune(self.set_temp, bias, temp)
+
+    def control(self, temp, flow=0.0):
+        self.time += DT
+        self.rate += ((temp - self.last_temp) / DT - self.rate) * DT / (HEATUP_RATE_TAU + DT)
+        self.last_temp = temp
+        self.peak = max(self.peak, temp)
+        self.draw_compensation(flow)
+        self.next_state(temp)
+        power = self.pid.compute(temp, self.set_temp)
+        if self.state in ("boost", "coast"):
+            power = 100.0 if self.state == "boost" else 0.0
+        if self.autotune is not None:
+            power = self.autotune.update(temp)
+            if self.autotune.status != "running":  # back to state ready
+                self.tuned, self.autotune = self.autotune, None
+        if self.model:
+            self.model.update(temp, power, self.brew)
+        return power
+
+
+def metrics(trace, setpoint, start=0.0):
+    """(time to the setpoint band [sec], settle time [sec], overshoot [degC]) of the samples from start"""
+    samples = [(t, temp) for t, temp, _ in trace if t >= start]
+    reached = next((t for t, temp in samples if temp >= setpoint - SETTLE_BAND), None)
+    settled = start
+    for t, temp in samples:
+        if abs(temp - setpoint) > SETTLE_BAND:
+            settled = None
+        elif settled is None:
+            settled = t
+    overshoot = max((temp - setpoint for t, temp in samples if reached is not None and t >= reached), default=0.0)
+    return (None if reached is None else reached - start,
+            None if settled is None else settled - start,
+            max(0.0, overshoot))
+
+
+def simulate(settings, duration, temp=Plant.T_ROOM, shots=(), model=True, boost=True):
+    """heat-up from temp, shots: [(start [sec], duration [sec], flow [g/sec])], returns [(time, temp, power)]"""
+    plant = Plant(temp)
+    boiler = Boiler(settings, plant.sensor, model, boost)
+    trace = []
+    power = 0.0
+    for n in range(int(duration / DT)):
+        t = n * DT
+        plant.flow = next((f for s, d, f in shots if s <= t < s + d), 0.0)
+        boiler.brew = plant.flow > 0
+        power = boiler.control(plant.sensor, plant.flow)
+        plant.step(power)
+        trace.append((t, plant.sensor, power))
+    return trace
+
+
+def shot_metrics(trace, setpoint, start, window=400.0):
+    """(temperature drop [degC], recovery: back in the setpoint band [sec], overshoot [degC],
+    integral of the absolute error [degC*sec]) from the start of a shot"""
+    samples = [(t, temp) for t, temp, _ in trace if start <= t < start + window]
+    _, recovery, overshoot = metrics(trace, setpoint, start)
+    drop = setpoint - min(temp for t, temp in samples)
+    iae = sum(abs(temp - setpoint) for t, temp in samples) * DT
+    return drop, recovery, max(overshoot, max(temp for t, temp in samples) - setpoint), iae
+
+
+def shots(settings, start=1800.0, runs=((1.2, 40.0), (2.5, 30.0), (4.0, 25.0))):
+    """a shot after the heat-up at a few flows [g/sec] and durations [sec], feed-forward from the settings and the model"""
+    for flow, duration in runs:
+        for model in (False, True):
+            trace = simulate(settings, start + 600.0, shots=[(start, duration, flow)], model=model)
+            drop, recovery, overshoot, iae = shot_metrics(trace, settings["temperature"], start)
+            print(f"shot {flow:.1f} g/sec {duration:.0f} sec, feed-forward {'model' if model else 'settings'}: "
+                  f"drop {drop:.2f} degC, recovered {'never' if recovery is None else f'{recovery:.0f} sec'}, "
+                  f"overshoot {overshoot:.2f} degC, error integral {iae:.0f} degC*sec")
+
+
+def heatups(settings, duration, starts=3):
+    """a cold start with the PID only, then cold starts with the full power heat-up (learning the thermal lag)"""
+    for n in range(starts + 1):
+        boost = n > 0
+        lag = settings["heatLag"]
+        trace = simulate(settings, duration, boost=boost)
+        reached, settled, overshoot = metrics(trace, settings["temperature"])
+        fmt = lambda v: "never" if v is None else f"{v:.0f} sec"
+        print(f"cold start {n}, {f'thermal lag {lag:.1f} sec' if boost else 'PID only'}: at temperature "
+              f"{fmt(reached)}, settled {fmt(settled)}, overshoot {overshoot:.2f} degC")
+
+
+def autotune(settings, settle=900.0, timeout=3600.0):
+    """heat up, settle, run the relay experiment, returns (result, status, trace)"""
+    plant = Plant()
+    boiler = Boiler(settings, plant.sensor, model=False)
+    trace = []
+    power_avg = 0.0
+    for n in range(int((settle + timeout) / DT)):
+        t = n * DT
+        if boiler.autotune is None and boiler.tuned is None and t >= settle:
+            boiler.start_autotune(plant.sensor, power_avg)
+        power = boiler.control(plant.sensor)
+        power_avg += (power - power_avg) * DT / 30.0  # (the average power of the heater device)
+        plant.step(power)
+        trace.append((t, plant.sensor, power))
+        if boiler.tuned is not None:
+            break
+    tune = boiler.tuned or boiler.autotune
+    return (tune.result if tune else {}), (tune.status if tune else "idle"), trace
+
+
+def report(name, settings, trace):
+    reached, settled, overshoot = metrics(trace, settings["temperature"])
+    fmt = lambda v: "never" if v is None else f"{v:.0f} sec"
+    print(f"{name}: P={settings['p']:.2f} I={settings['i']:.3f} D={settings['d']:.1f} ff_heat={settings['ff_heat']:.1f} "
+          f"ff_ready={settings['ff_ready']:.1f}: at temperature {fmt(reached)}, settled {fmt(settled)}, "
+          f"overshoot {overshoot:.2f} degC")
+
+
+def write_csv(filename, trace):
+    with open(filename, "w", newline="") as f:
+        writer = csv.writer(f)
+        writer.writerow(["time", "temp", "power"])
+        for t, temp, power in trace[::10]:
+            writer.writerow([f"{t:.1f}", f"{temp:.2f}", f"{power:.1f}"])
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Simulate the diyPresso boiler and its controller")
+    parser.add_argument("--autotune", action="store_true", help="relay auto-tune, compare the heat-up before and after")
+    parser.add_argument("--shots", action="store_true", help="shots with the feed-forward from the settings and the model")
+    parser.add_argument("--heatup", action="store_true", help="cold starts with the PID and with the full power heat-up")
+    parser.add_argument("--duration", type=float, default=1200.0, help="simulated time of a heat-up [sec]")
+    parser.add_argument("--csv", help="write the (last) heat-up to a CSV file")
+    args = parser.parse_args()
+
+    settings = dict(DEFAULTS)
+    if args.shots:
+        shots(settings)
+        return
+    if args.heatup:
+        heatups(settings, args.duration)
+        return
+    trace = simulate(settings, args.duration)
+    report("before", settings, trace)
+    if args.autotune:
+        result, status, _ = autotune(settings)
+        if status != "done":
+            print(f"autotune {status}")
+            return
+        print(f"autotune: Ku={result['ku']:.2f} %/degC, Tu={result['tu']:.0f} sec, amplitude {result['amplitude']:.2f} "
+              f"degC, holding power {result['power']:.1f} %")
+        tuned = {"p": result["p"], "i": result["i"], "d": result["d"], "ff_heat": result["power"], "ff_ready": result["power"]}
+        settings.update({k: min(LIMITS[k][1], max(LIMITS[k][0], v)) for k, v in tuned.items()})  # (as saved)
+        trace = simulate(settings, args.duration)
+        report("after", settings, trace)
+    if args.csv:
+        write_csv(args.csv, trace)
+
+
+if __name__ == "__main__":
+    main()
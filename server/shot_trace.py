@@ -0,0 +1,138 @@
+#!/usr/bin/env python3
+"""
+Decode the shot traces of the diyPresso controller (see diyp-controller/dp_shot_trace.h)
+
+Subscribes to the MQTT topic diyPressoOne/+/shots (or reads saved chunk files, one MQTT payload per file), joins the
+chunks of a shot (per machine) and writes the trace to shot_<mac>_<n>.csv (shot_<n>.csv from files): time [sec],
+temperature [degC], heater power [%], reservoir weight [gram], brew state id and the flow [gram/sec] computed from the
+weight.
+
+  python3 shot_trace.py --broker test.mosquitto.org
+  python3 shot_trace.py chunk0.bin chunk1.bin
+"""
+import argparse
+import csv
+import struct
+import sys
+
+SHOT_TRACE_VERSION = 1
+SHOT_TRACE_FLAG_TRUNCATED = 0x01
+SHOT_TRACE_FLAG_EPOCH = 0x02
+
+CHUNK_FORMAT = "<IBB"  # shot, chunk index, chunk count
+HEADER_FORMAT = "<BBHIIHH"  # version, flags, period, shot, start, samples, reserved
+FLOW_FILTER = 0.3  # low-pass filter factor of the flow per sample
+
+
+def zigzag_decode(v):
+    return (v >> 1) ^ -(v & 1)
+
+
+def varints(data, pos):
+    while pos < len(data):
+        value = shift = 0
+        while True:
+            b = data[pos]
+            pos += 1
+            value |= (b & 0x7F) << shift
+            shift += 7
+            if not b & 0x80:
+                break
+        yield value
+
+
+def decode_trace(data):
+    """returns (header dict, [(time, temp, power, weight, state)])"""
+    size = struct.calcsize(HEADER_FORMAT)
+    version, flags, period, shot, start, count, _ = struct.unpack(HEADER_FORMAT, data[:size])
+    if version != SHOT_TRACE_VERSION:
+        raise ValueError(f"unknown trace version {version}")
+    header = {"shot": shot, "flags": flags, "period": period, "start": start, "samples": count}
+    values = list(varints(data, size))
+    samples = []
+    t = temp = power = weight = state = 0
+    for i in range(0, len(values) - 4, 5):
+        dt, d_temp, d_power, d_weight, d_state = values[i:i + 5]
+        t += dt
+        temp += zigzag_decode(d_temp)
+        power += zigzag_decode(d_power)
+        weight += zigzag_decode(d_weight)
+        state += zigzag_decode(d_state)
+        samples.append((t / 1000.0, temp / 100.0, power / 10.0, weight / 10.0, state))
+    return header, samples[:count]
+
+
+def write_csv(filename, samples):
+    flow = 0.0
+    with open(filename, "w", newline="") as f:
+        writer = csv.writer(f)
+        writer.writerow(["time", "temp", "power", "weight", "state", "flow"])
+        for i, (t, temp, power, weight, state) in enumerate(samples):
+            if i > 0 and t > samples[i - 1][0]:
+                flow += FLOW_FILTER * ((samples[i - 1][3] - weight) / (t - samples[i - 1][0]) - flow)
+            writer.writerow([f"{t:.3f}", f"{temp:.2f}", f"{power:.1f}", f"{weight:.1f}", state, f"{flow:.2f}"])
+
+
+class Assembler:
+    """collects the chunks per (source, shot), returns the trace when all chunks are in"""
+    def __init__(self):
+        self.shots = {}
+
+    def add(self, payload, source=""):
+        """source: the MQTT topic (one per machine), the shot numbers of two machines are independent"""
+        size = struct.calcsize(CHUNK_FORMAT)
+        shot, index, count = struct.unpack(CHUNK_FORMAT, payload[:size])
+        key = (source, shot)
+        chunks = self.shots.setdefault(key, {})
+        chunks[index] = payload[size:]  # (a chunk that was sent again replaces the first copy)
+        if len(chunks) < count:
+            return None
+        del self.shots[key]
+        return b"".join(chunks[i] for i in range(count))
+
+
+def handle(data, device=None):
+    header, samples = decode_trace(data)
+    filename = f"shot_{device}_{header['shot']}.csv" if device else f"shot_{header['shot']}.csv"
+    write_csv(filename, samples)
+    notes = " (truncated)" if header["flags"] & SHOT_TRACE_FLAG_TRUNCATED else ""
+    start = "unix time" if header["flags"] & SHOT_TRACE_FLAG_EPOCH else "uptime"
+    print(f"shot {header['shot']}: {len(samples)} samples, {len(data)} bytes, start {header['start']} ({start})"
+          f"{notes} -> {filename}")
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Decode diyPresso shot traces to CSV")
+    parser.add_argument("files", nargs="*", help="chunk files (MQTT payloads), else subscribe to MQTT")
+    parser.add_argument("--broker", default="test.mosquitto.org", help="MQTT broker")
+    parser.add_argument("--port", type=int, default=1883)
+    parser.add_argument("--topic", default="diyPressoOne/+/shots")
+    args = parser.parse_args()
+
+    assembler = Assembler()
+    if args.files:
+        for name in args.files:
+            with open(name, "rb") as f:
+                data = assembler.add(f.read())
+            if data:
+                handle(data)
+        if assembler.shots:
+            print(f"incomplete shots: {sorted(shot for _, shot in assembler.shots)}", file=sys.stderr)
+        return
+
+    import paho.mqtt.subscribe as subscribe
+
+    def on_message(client, userdata, msg):
+        data = assembler.add(msg.payload, msg.topic)
+        if data:
+            parts = msg.topic.split("/")  # diyPressoOne/<mac>/shots
+            handle(data, parts[1] if len(parts) == 3 else None)
+
+    try:
+        subscribe.callback(on_message, args.topic, hostname=args.broker, port=args.port)
+    except KeyboardInterrupt:
+        pass
+
+
+if __name__ == "__main__":
+    main()
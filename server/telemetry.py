@@ -0,0 +1,228 @@
+#!/usr/bin/env python3
+"""
+Decode the binary telemetry of the diyPresso controller (see diyp-controller/dp_telemetry.h)
+
+Reads the serial port (or a raw capture file), splits the stream on zero bytes, decodes the COBS frames and
+checks the CRC. Samples are written to a CSV file (one column per field), or to a Parquet file if the output name
+ends with .parquet (needs pyarrow). Text lines, binary log messages (PUT log <level> binary) and binary stream
+samples (SUB <fields> <rate> binary) are printed; the log message formats are read from diyp-controller/dp_log.h,
+the stream fields from diyp-controller/dp_streams.h.
+
+  python3 telemetry.py /dev/tty.usbmodem11301 --rate 50 -o shot.csv
+  python3 telemetry.py capture.bin -o shot.parquet
+"""
+import argparse
+import csv
+import os
+import re
+import struct
+import sys
+import zlib
+
+TELEMETRY_SAMPLE = 0x01
+TELEMETRY_LOG = 0x02
+TELEMETRY_STREAM = 0x03
+
+LOG_HEADER = os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "diyp-controller", "dp_log.h")
+STREAMS_HEADER = os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "diyp-controller", "dp_streams.h")
+LOG_LEVELS = {"LOG_LEVEL_ERROR": "ERROR", "LOG_LEVEL_WARNING": "WARNING", "LOG_LEVEL_INFO": "INFO", "LOG_LEVEL_DEBUG": "DEBUG"}
+
+SAMPLE_FORMAT = "<IhhhhhhhhBBB"
+SAMPLE_FIELDS = [
+    # name, scale
+    ("time", 1000.0),      # [sec]
+    ("act_temp", 100.0),   # [degC]
+    ("set_temp", 100.0),
+    ("p", 100.0),          # [%]
+    ("i", 100.0),
+    ("d", 100.0),
+    ("power", 100.0),
+    ("weight", 10.0),      # [gram]
+    ("flow", 100.0),       # [gram/sec]
+    ("boiler_state", 1),
+    ("brew_state", 1),
+    ("flags", 1),
+]
+
+
+def cobs_decode(data):
+    out = bytearray()
+    i = 0
+    while i < len(data):
+        code = data[i]
+        if code == 0 or i + code > len(data) + 1:
+            return None
+        out += data[i + 1:i + code]
+        i += code
+        if code < 0xFF and i < len(data):
+            out.append(0)
+    return bytes(out)
+
+
+def decode_frame(chunk):
+    """returns (type, sequence, payload) or None if the chunk is not a valid frame"""
+    frame = cobs_decode(chunk)
+    if frame is None or len(frame) < 6:
+        return None
+    body, crc = frame[:-4], struct.unpack("<I", frame[-4:])[0]
+    if zlib.crc32(body) != crc:
+        return None
+    return body[0], body[1], body[2:]
+
+
+def decode_sample(payload):
+    values = struct.unpack(SAMPLE_FORMAT, payload[:struct.calcsize(SAMPLE_FORMAT)])
+    return {name: (v / scale if scale != 1 else v) for (name, scale), v in zip(SAMPLE_FIELDS, values)}
+
+
+def load_log_messages(filename=LOG_HEADER):
+    """the message table of dp_log.h: [(name, level, format)], the index is the message ID"""
+    try:
+        with open(filename) as f:
+            text = f.read()
+    except OSError:
+        return []
+    return re.findall(r'M\((\w+),\s*(\w+),\s*"((?:[^"\\]|\\.)*)"\)', text)
+
+
+def decode_log(payload, messages):
+    time, msg_id = struct.unpack("<IB", payload[:5])
+    if msg_id >= len(messages):
+        return f"[{time}] message {msg_id} (unknown)"
+    name, level, fmt = messages[msg_id]
+    pos = 5
+    out = ""
+    parts = re.split(r"(%[dufs])", fmt)
+    for part in parts:
+        if part in ("%d", "%u", "%f") and pos + 4 <= len(payload):
+            code = {"%d": "<i", "%u": "<I", "%f": "<f"}[part]
+            value = struct.unpack(code, payload[pos:pos + 4])[0]
+            out += f"{value:.2f}" if part == "%f" else str(value)
+            pos += 4
+        elif part == "%s" and pos < len(payload):
+            end = payload.find(b"\x00", pos)
+            end = len(payload) if end < 0 else end
+            out += payload[pos:end].decode(errors="replace")
+            pos = end + 1
+        else:
+            out += part
+    return f"[{time}] {LOG_LEVELS.get(level, level)}: {out}"
+
+
+def load_stream_fields(filename=STREAMS_HEADER):
+    """the field table of dp_streams.h: [(name, type)], the index is the bit in the field mask"""
+    try:
+        with open(filename) as f:
+            text = f.read()
+    except OSError:
+        return []
+    return re.findall(r"F\((\w+),\s*(STREAM_\w+),", text)
+
+
+def decode_stream(payload, fields):
+    stream_id, mask = struct.unpack("<BH", payload[:3])
+    pos = 3
+    values = []
+    for bit, (name, ftype) in enumerate(fields):
+        if not mask & (1 << bit) or pos + 4 > len(payload):
+            continue
+        value = struct.unpack("<f" if ftype == "STREAM_FLOAT" else "<i", payload[pos:pos + 4])[0]
+        values.append(f"{name}={value:.2f}" if ftype == "STREAM_FLOAT" else f"{name}={value}")
+        pos += 4
+    return f"stream{stream_id}: " + ",".join(values)
+
+
+class ColumnWriter:
+    """collects the samples in columns, written at close()"""
+    def __init__(self, filename):
+        self.filename = filename
+        self.columns = {name: [] for name, _ in SAMPLE_FIELDS}
+        self.columns["lost"] = []
+
+    def add(self, sample, lost):
+        for name, _ in SAMPLE_FIELDS:
+            self.columns[name].append(sample[name])
+        self.columns["lost"].append(lost)
+
+    def close(self):
+        if self.filename.endswith(".parquet"):
+            import pyarrow
+            import pyarrow.parquet
+            pyarrow.parquet.write_table(pyarrow.table(self.columns), self.filename)
+            return
+        with open(self.filename, "w", newline="") as f:
+            writer = csv.writer(f)
+            writer.writerow(self.columns.keys())
+            writer.writerows(zip(*self.columns.values()))
+
+
+def read_stream(source, rate):
+    if source.startswith("/dev/") or source.upper().startswith("COM"):
+        import serial
+        port = serial.Serial(source, 115200, timeout=0.1)
+        port.write(b"PUT telemetry %d\n" % rate)
+        try:
+            while True:
+                data = port.read(4096)
+                if data:
+                    yield data
+        finally:
+            port.write(b"PUT telemetry 0\n")
+            port.close()
+    else:
+        with open(source, "rb") as f:
+            while True:
+                data = f.read(4096)
+                if not data:
+                    break
+                yield data
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Decode diyPresso binary telemetry to CSV or Parquet")
+    parser.add_argument("source", help="serial port or raw capture file")
+    parser.add_argument("-o", "--output", default="telemetry.csv", help="output file (.csv or .parquet)")
+    parser.add_argument("--rate", type=int, default=50, help="sample rate to request from the controller [Hz]")
+    args = parser.parse_args()
+
+    writer = ColumnWriter(args.output)
+    messages = load_log_messages()
+    stream_fields = load_stream_fields()
+    buffer = b""
+    last_seq = None
+    frames = bad = lost_total = 0
+    try:
+        for data in read_stream(args.source, args.rate):
+            buffer += data
+            chunks = buffer.split(b"\x00")
+            buffer = chunks.pop()  # incomplete
+            for chunk in chunks:
+                if not chunk:
+                    continue
+                frame = decode_frame(chunk)
+                if frame is None:
+                    text = chunk.decode(errors="replace").strip()
+                    if text:
+                        print(text)
+                    else:
+                        bad += 1
+                    continue
+                ftype, seq, payload = frame
+                lost = 0 if last_seq is None else (seq - last_seq - 1) & 0xFF
+                last_seq = seq
+                lost_total += lost
+                if ftype == TELEMETRY_SAMPLE:
+                    writer.add(decode_sample(payload), lost)
+                    frames += 1
+                elif ftype == TELEMETRY_LOG:
+                    print(decode_log(payload, messages))
+                elif ftype == TELEMETRY_STREAM:
+                    print(decode_stream(payload, stream_fields))
+    except KeyboardInterrupt:
+        pass
+    writer.close()
+    print(f"{frames} samples written to {args.output}, {lost_total} lost, {bad} bad frames", file=sys.stderr)
+
+
+if __name__ == "__main__":
+    main()